@@ -0,0 +1,246 @@
+// Seek latency and decode throughput of the cdg reader.  Times seek() plus rendering
+// the first frame after it, which is what the user waits for when scrubbing or
+// restarting a track, for random seeks and for stepping forwards and backwards
+// through the track.  Then pushes the whole track and a stream of nothing but tile
+// blocks through CdgImageFrame for packets/sec, the tile blocks also through the
+// per pixel tile drawing CdgImageFrame had before its lookup table, as the before
+// figure.
+//
+// Usage: cdgbench [file.cdg] [seeks per pattern (1000)]
+//
+// Without a file a made up 5 minute track is used: mostly tile blocks and empty
+// packets, with palette loads and a memory preset now and then.
+
+#include "cdg/cdgfilereader.h"
+#include "cdg/cdgimageframe.h"
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr int PACKETS_PER_SECOND = 300;
+constexpr int SYNTHETIC_SECONDS = 300;
+constexpr int TILE_BLOCK_PACKETS = 100000;
+constexpr qint64 THROUGHPUT_MIN_MS = 1000;
+constexpr char SUBCODE_MASK = 0x3F;
+constexpr char SUBCODE_COMMAND = 0x09;
+
+cdg::CDG_SubCode packet(const cdg::CdgCommand instruction) {
+    cdg::CDG_SubCode subCode{};
+    subCode.command = cdg::CdgCommand(SUBCODE_COMMAND);
+    subCode.instruction = instruction;
+    return subCode;
+}
+
+cdg::CDG_SubCode randomTile(std::mt19937 &rng, const bool xorTile) {
+    std::uniform_int_distribution<int> byte(0, 255);
+    auto tile = packet(xorTile ? cdg::CmdTileBlockXOR : cdg::CmdTileBlock);
+    tile.data[0] = char(byte(rng) & 0x0F);
+    tile.data[1] = char(byte(rng) & 0x0F);
+    tile.data[2] = char(byte(rng) % 18);
+    tile.data[3] = char(byte(rng) % 50);
+    for (int row = 4; row < 16; row++)
+        tile.data[row] = char(byte(rng) & 0x3F);
+    return tile;
+}
+
+QByteArray syntheticTrack(const int seconds) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<cdg::CDG_SubCode> packets;
+    packets.reserve(size_t(seconds * PACKETS_PER_SECOND));
+    for (int second = 0; second < seconds; second++) {
+        if (second % 60 == 0) {
+            // Clear screen the way real discs do it, the preset repeated a few times
+            for (int repeat = 0; repeat < 16; repeat++) {
+                auto preset = packet(cdg::CmdMemoryPreset);
+                preset.data[1] = char(repeat);
+                packets.emplace_back(preset);
+            }
+        }
+        if (second % 20 == 0) {
+            for (const auto table : {cdg::CmdColorsLow, cdg::CmdColorsHigh}) {
+                auto colors = packet(table);
+                for (auto &value : colors.data)
+                    value = char(byte(rng) & 0x3F);
+                packets.emplace_back(colors);
+            }
+        }
+        while (packets.size() < size_t((second + 1) * PACKETS_PER_SECOND)) {
+            const int kind = percent(rng);
+            if (kind < 45) {
+                packets.emplace_back(cdg::CDG_SubCode{});
+                continue;
+            }
+            packets.emplace_back(randomTile(rng, kind >= 85));
+        }
+    }
+    return QByteArray(reinterpret_cast<const char *>(packets.data()), int(packets.size() * sizeof(cdg::CDG_SubCode)));
+}
+
+std::vector<cdg::CDG_SubCode> tileBlocks(const int count) {
+    std::mt19937 rng(2);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::vector<cdg::CDG_SubCode> packets;
+    packets.reserve(size_t(count));
+    for (int i = 0; i < count; i++)
+        packets.emplace_back(randomTile(rng, percent(rng) >= 80));
+    return packets;
+}
+
+// CdgImageFrame::cmdTileBlock as it was before the lookup table: a branch per pixel
+// and a scanLine() call per row.  Only here as the before figure.
+void referenceTileBlock(QImage &image, const cdg::CdgTileBlockData &tile, const cdg::TileBlockType type) {
+    constexpr static std::array<char, 6> MASKS{0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+    if (tile.row >= 18 || tile.column >= 50 || tile.color0 >= 16 || tile.color1 >= 16)
+        return;
+    for (auto y = 0; y < 12; y++) {
+        auto ptr = image.scanLine(int(y + tile.top)) + tile.left;
+        const auto rowData = tile.tilePixels[y];
+        for (auto x = 0; x < 6; x++) {
+            const char color = (rowData & MASKS[x]) ? tile.color1 : tile.color0;
+            if (type == cdg::TileBlockXOR)
+                ptr[x] ^= color;
+            else
+                ptr[x] = color;
+        }
+    }
+}
+
+void referenceApply(QImage &image, const cdg::CDG_SubCode &subCode) {
+    if ((subCode.command & SUBCODE_MASK) != SUBCODE_COMMAND)
+        return;
+    switch (subCode.instruction & SUBCODE_MASK) {
+        case cdg::CmdTileBlock:
+            referenceTileBlock(image, cdg::CdgTileBlockData(subCode.data), cdg::TileBlockNormal);
+            break;
+        case cdg::CmdTileBlockXOR:
+            referenceTileBlock(image, cdg::CdgTileBlockData(subCode.data), cdg::TileBlockXOR);
+            break;
+    }
+}
+
+QImage referenceImage() {
+    QImage image(cdg::FRAME_DIM_FULL, QImage::Format_Indexed8);
+    image.fill(0);
+    return image;
+}
+
+// Decodes packets over and over for at least THROUGHPUT_MIN_MS
+template<typename Decode>
+qint64 packetsPerSecond(const std::vector<cdg::CDG_SubCode> &packets, Decode decode) {
+    qint64 decoded = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        for (const auto &subCode : packets)
+            decode(subCode);
+        decoded += qint64(packets.size());
+    } while (timer.elapsed() < THROUGHPUT_MIN_MS);
+    return qint64(decoded * 1000000000.0 / timer.nsecsElapsed());
+}
+
+bool sameTileOutput(const std::vector<cdg::CDG_SubCode> &packets) {
+    CdgImageFrame frame;
+    QImage reference = referenceImage();
+    for (const auto &subCode : packets) {
+        frame.applySubCode(subCode);
+        referenceApply(reference, subCode);
+    }
+    const QImage decoded = frame.getImage();
+    for (int y = 0; y < cdg::FRAME_DIM_FULL.height(); y++) {
+        if (std::memcmp(decoded.constScanLine(y), reference.constScanLine(y), size_t(cdg::FRAME_DIM_FULL.width())) != 0)
+            return false;
+    }
+    return true;
+}
+
+void report(const char *pattern, std::vector<qint64> samples) {
+    std::sort(samples.begin(), samples.end());
+    std::printf("%-24s %10lld %10lld %10lld\n", pattern,
+                static_cast<long long>(samples[samples.size() / 2]),
+                static_cast<long long>(samples[std::min(samples.size() - 1, samples.size() * 95 / 100)]),
+                static_cast<long long>(samples.back()));
+}
+
+std::vector<qint64> timeSeeks(CdgFileReader &reader, const int seeks, const std::function<int(int)> &target) {
+    std::vector<uchar> frame(cdg::CDG_IMAGE_SIZE);
+    std::vector<qint64> samples;
+    samples.reserve(size_t(seeks));
+    for (int i = 0; i < seeks; i++) {
+        const int positionMS = target(i);
+        QElapsedTimer timer;
+        timer.start();
+        reader.seek(positionMS);
+        reader.moveToNextFrame(frame.data());
+        samples.emplace_back(timer.nsecsElapsed() / 1000);
+    }
+    return samples;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QByteArray cdgData;
+    if (argc > 1) {
+        QFile file(argv[1]);
+        if (!file.open(QIODevice::ReadOnly)) {
+            std::fprintf(stderr, "Unable to open %s\n", argv[1]);
+            return 1;
+        }
+        cdgData = file.readAll();
+    } else {
+        cdgData = syntheticTrack(SYNTHETIC_SECONDS);
+    }
+    const int seeks = argc > 2 ? std::max(1, std::atoi(argv[2])) : 1000;
+
+    QElapsedTimer loadTimer;
+    loadTimer.start();
+    CdgFileReader reader(cdgData);
+    const qint64 loadMs = loadTimer.elapsed();
+    const int durationMS = reader.getTotalDurationMS();
+    std::printf("Track: %d s, %d packets, keyframe index built in %lld ms\n\n", durationMS / 1000,
+                int(cdgData.size() / int(sizeof(cdg::CDG_SubCode))), static_cast<long long>(loadMs));
+
+    // Seeks land a bit before the end so there is always a frame left to render
+    const int lastMS = std::max(0, durationMS - 1000);
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> anywhere(0, lastMS);
+    const int stepMS = std::max(1, lastMS / seeks);
+
+    std::printf("%-24s %10s %10s %10s\n", "seek + first frame", "median us", "p95 us", "max us");
+    report("random", timeSeeks(reader, seeks, [&](int) { return anywhere(rng); }));
+    report("forward steps", timeSeeks(reader, seeks, [&](int i) { return i * stepMS; }));
+    report("backward steps", timeSeeks(reader, seeks, [&](int i) { return lastMS - i * stepMS; }));
+
+    std::vector<cdg::CDG_SubCode> track(size_t(cdgData.size()) / sizeof(cdg::CDG_SubCode));
+    std::memcpy(track.data(), cdgData.constData(), track.size() * sizeof(cdg::CDG_SubCode));
+    const auto tiles = tileBlocks(TILE_BLOCK_PACKETS);
+    CdgImageFrame frame;
+    QImage reference = referenceImage();
+
+    std::printf("\n%-24s %12s\n", "decode", "packets/sec");
+    std::printf("%-24s %12lld\n", "track",
+                static_cast<long long>(packetsPerSecond(track, [&](const cdg::CDG_SubCode &subCode) {
+                    frame.applySubCode(subCode);
+                })));
+    std::printf("%-24s %12lld\n", "tile blocks",
+                static_cast<long long>(packetsPerSecond(tiles, [&](const cdg::CDG_SubCode &subCode) {
+                    frame.applySubCode(subCode);
+                })));
+    std::printf("%-24s %12lld\n", "tile blocks, before",
+                static_cast<long long>(packetsPerSecond(tiles, [&](const cdg::CDG_SubCode &subCode) {
+                    referenceApply(reference, subCode);
+                })));
+    std::printf("\nTile blocks drawn the same as before: %s\n", sameTileOutput(tiles) ? "yes" : "NO");
+    return 0;
+}
@@ -0,0 +1,109 @@
+// Load time and memory of the karaoke catalog.  Loads a made up catalog either into
+// SongCatalog, the way TableModelKaraokeSongs::loadData() does, or into one shared
+// KaraokeSong per row with the lowercase copies filled in, the layout the model used
+// before SongCatalog.  Run each layout in its own process, freed memory isn't
+// reliably given back to the system so the second one would be measured wrong.
+// Every string of a row gets its own buffer, like the ones read from SQLite, or
+// the shared layout would get the generator's artist names for free.
+//
+// Usage: songcatalogbench [songs (500000)] [catalog|shared (catalog)]
+//
+// RSS is read from /proc/self/status and shows as -1 where that doesn't exist.
+
+#include "synthcatalog.h"
+#include "models/songcatalog.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+// Songs are generated in batches outside of the timed part, the generator would
+// otherwise dominate the load time and a whole pre-generated catalog the RSS.
+constexpr int BATCH_SIZE = 10000;
+
+qint64 residentKiB() {
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly))
+        return -1;
+    while (!status.atEnd()) {
+        const QByteArray line = status.readLine();
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').first().toLongLong();
+    }
+    return -1;
+}
+
+// QString copies share the buffer, this one doesn't
+QString ownCopy(const QString &text) {
+    return QString(text.constData(), text.size());
+}
+
+std::vector<KaraokeSong> nextBatch(SynthCatalog &generator, const int count, const int firstId) {
+    std::vector<KaraokeSong> batch;
+    batch.reserve(size_t(count));
+    for (int i = 0; i < count; i++) {
+        const auto song = generator.next();
+        KaraokeSong karaokeSong;
+        karaokeSong.id = firstId + i;
+        karaokeSong.artist = ownCopy(song.artist);
+        karaokeSong.title = ownCopy(song.title);
+        karaokeSong.songid = ownCopy(song.songId);
+        karaokeSong.duration = 180000 + (firstId + i) % 120000;
+        karaokeSong.filename = ownCopy(song.filename);
+        karaokeSong.path = ownCopy(song.path);
+        karaokeSong.searchString = ownCopy(SynthCatalog::searchText(song));
+        karaokeSong.plays = 0;
+        batch.emplace_back(std::move(karaokeSong));
+    }
+    return batch;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    const int songCount = argc > 1 ? std::atoi(argv[1]) : 500000;
+    const bool shared = argc > 2 && std::strcmp(argv[2], "shared") == 0;
+
+    SynthCatalog generator;
+    SongCatalog catalog;
+    std::vector<SongCatalog::Row> rows;
+    std::vector<std::shared_ptr<KaraokeSong>> sharedSongs;
+
+    const qint64 rssBefore = residentKiB();
+    qint64 loadNs = 0;
+    for (int loaded = 0; loaded < songCount; loaded += BATCH_SIZE) {
+        auto batch = nextBatch(generator, std::min(BATCH_SIZE, songCount - loaded), loaded);
+        QElapsedTimer timer;
+        timer.start();
+        for (auto &song : batch) {
+            if (shared) {
+                song.artistL = song.artist.toLower();
+                song.titleL = song.title.toLower();
+                song.songidL = song.songid.toLower();
+                sharedSongs.emplace_back(std::make_shared<KaraokeSong>(std::move(song)));
+            } else {
+                rows.emplace_back(catalog.append(song));
+            }
+        }
+        loadNs += timer.nsecsElapsed();
+    }
+    if (!shared)
+        catalog.squeeze();
+    const qint64 rssAfter = residentKiB();
+
+    std::printf("Layout:           %s\n", shared ? "shared KaraokeSong per row" : "SongCatalog");
+    std::printf("Songs:            %d\n", songCount);
+    std::printf("Load time:        %lld ms\n", static_cast<long long>(loadNs / 1000000));
+    if (!shared)
+        std::printf("Catalog estimate: %zu KiB\n", catalog.memoryUsage() / 1024);
+    std::printf("RSS before:       %lld KiB\n", static_cast<long long>(rssBefore));
+    std::printf("RSS after:        %lld KiB\n", static_cast<long long>(rssAfter));
+    if (rssBefore >= 0 && rssAfter >= 0)
+        std::printf("RSS growth:       %lld KiB\n", static_cast<long long>(rssAfter - rssBefore));
+    return 0;
+}
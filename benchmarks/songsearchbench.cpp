@@ -0,0 +1,108 @@
+// Search latency of the karaoke catalog.  Builds the trigram index over a made up
+// catalog and times searches the way TableModelKaraokeSongs runs them: the index
+// narrows the candidates, then every candidate is checked against its haystack.
+// The check runs on one thread here, the model spreads it over the thread pool,
+// so the numbers are an upper bound for what the user waits for.
+//
+// Usage: songsearchbench [songs (500000)] [runs per query (50)]
+
+#include "synthcatalog.h"
+#include "models/songsearchindex.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+
+namespace {
+
+struct Timing {
+    qint64 medianUs{0};
+    qint64 p95Us{0};
+    qint64 maxUs{0};
+    size_t candidates{0};
+    size_t matches{0};
+    bool indexed{false};
+};
+
+Timing timeSearch(const SongSearchIndex &index, const QStringList &haystacks, const QString &search, const int runs) {
+#if QT_VERSION < QT_VERSION_CHECK(5, 15, 0)
+    const QStringList needles = search.split(' ', QString::SplitBehavior::SkipEmptyParts);
+#else
+    const QStringList needles = search.split(' ', Qt::SplitBehavior(Qt::SkipEmptyParts));
+#endif
+    Timing timing;
+    std::vector<qint64> samples;
+    std::vector<int> candidates;
+    std::vector<int> matches;
+    for (int run = 0; run < runs; run++) {
+        QElapsedTimer timer;
+        timer.start();
+        timing.indexed = index.candidates(needles, candidates);
+        if (!timing.indexed) {
+            // Too short for the index, the model scans everything
+            candidates.resize(size_t(haystacks.size()));
+            std::iota(candidates.begin(), candidates.end(), 0);
+        }
+        matches.clear();
+        for (const int row : candidates) {
+            const QString &haystack = haystacks.at(row);
+            if (std::all_of(needles.begin(), needles.end(), [&haystack](const QString &needle) {
+                return haystack.contains(needle);
+            }))
+                matches.emplace_back(row);
+        }
+        samples.emplace_back(timer.nsecsElapsed() / 1000);
+    }
+    std::sort(samples.begin(), samples.end());
+    timing.medianUs = samples[samples.size() / 2];
+    timing.p95Us = samples[std::min(samples.size() - 1, samples.size() * 95 / 100)];
+    timing.maxUs = samples.back();
+    timing.candidates = candidates.size();
+    timing.matches = matches.size();
+    return timing;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    const int songCount = argc > 1 ? std::atoi(argv[1]) : 500000;
+    const int runs = argc > 2 ? std::max(1, std::atoi(argv[2])) : 50;
+
+    SynthCatalog catalog;
+    QStringList haystacks;
+    haystacks.reserve(songCount);
+    for (int i = 0; i < songCount; i++)
+        haystacks.append(SynthCatalog::searchText(catalog.next()));
+
+    SongSearchIndex index;
+    QElapsedTimer timer;
+    timer.start();
+    for (int row = 0; row < songCount; row++)
+        index.addSong(row, haystacks.at(row));
+    std::printf("Indexed %d songs in %lld ms, %zu distinct trigrams\n\n", songCount,
+                static_cast<long long>(timer.elapsed()), index.trigramCount());
+
+    const QStringList &words = catalog.words();
+    const QStringList &artists = catalog.artists();
+    const QStringList searches{
+            words.at(0).toLower(),
+            words.at(0).toLower() + " " + words.at(1).toLower(),
+            words.at(words.size() / 2).toLower(),
+            artists.at(0).toLower(),
+            artists.at(artists.size() - 1).toLower(),
+            "sb01234",
+            words.at(0).left(2).toLower(),
+            "zqxzqx"
+    };
+    std::printf("%-32s %8s %10s %8s %10s %10s %10s\n", "search", "index", "candidates", "matches",
+                "median us", "p95 us", "max us");
+    for (const auto &search : searches) {
+        const auto timing = timeSearch(index, haystacks, search, runs);
+        std::printf("%-32s %8s %10zu %8zu %10lld %10lld %10lld\n", qPrintable(search.left(32)),
+                    timing.indexed ? "yes" : "no", timing.candidates, timing.matches,
+                    static_cast<long long>(timing.medianUs), static_cast<long long>(timing.p95Us),
+                    static_cast<long long>(timing.maxUs));
+    }
+    return 0;
+}
@@ -0,0 +1,90 @@
+#ifndef SYNTHCATALOG_H
+#define SYNTHCATALOG_H
+
+#include <QString>
+#include <QStringList>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <vector>
+
+// Made up karaoke catalog for the benchmarks.  Words are built from syllables so
+// the text has a realistic spread of trigrams, a few words and artists are far
+// more common than the rest like in a real catalog.  The same seed always gives
+// the same songs, so runs before and after a change can be compared.
+class SynthCatalog {
+public:
+    struct Song {
+        QString artist;
+        QString title;
+        QString songId;
+        QString filename;
+        QString path;
+    };
+
+    explicit SynthCatalog(const unsigned seed = 1) : m_rng(seed) {
+        static const char *syllables[] = {
+                "ka", "ro", "ke", "lo", "ve", "ma", "ri", "an", "ne", "da", "to", "mi", "sa", "be", "el",
+                "on", "ty", "ra", "li", "go", "ha", "st", "ar", "de", "ni", "qu", "ee", "ch", "ow", "er"
+        };
+        std::uniform_int_distribution<int> syllableCount(1, 4);
+        std::uniform_int_distribution<size_t> syllable(0, std::size(syllables) - 1);
+        for (int i = 0; i < wordCount; i++) {
+            QString word;
+            for (int s = syllableCount(m_rng); s > 0; s--)
+                word.append(syllables[syllable(m_rng)]);
+            m_words.append(word);
+        }
+        for (int i = 0; i < artistCount; i++)
+            m_artists.append(phrase(1, 3, true));
+    }
+
+    Song next() {
+        Song song;
+        song.artist = m_artists.at(skewed(artistCount));
+        song.title = phrase(1, 5, true);
+        song.songId = QString("SB%1-%2").arg(m_next / 20, 5, 10, QChar('0')).arg(m_next % 20 + 1, 2, 10, QChar('0'));
+        song.filename = song.songId + " - " + song.artist + " - " + song.title + ".zip";
+        song.path = "/media/karaoke/" + song.artist.left(1) + "/" + song.filename;
+        m_next++;
+        return song;
+    }
+
+    // Lowercased artist, title and song id, close to what the karaoke model indexes
+    static QString searchText(const Song &song) {
+        return QString(song.artist + " " + song.title + " " + song.songId).toLower();
+    }
+
+    [[nodiscard]] const QStringList &words() const { return m_words; }
+    [[nodiscard]] const QStringList &artists() const { return m_artists; }
+
+private:
+    static constexpr int wordCount = 5000;
+    static constexpr int artistCount = 25000;
+
+    // Index below count, low indices are picked far more often than high ones
+    int skewed(const int count) {
+        const double u = m_uniform(m_rng);
+        return std::min(count - 1, int(u * u * u * count));
+    }
+
+    QString phrase(const int minWords, const int maxWords, const bool capitalize) {
+        std::uniform_int_distribution<int> length(minWords, maxWords);
+        QStringList words;
+        for (int w = length(m_rng); w > 0; w--) {
+            QString word = m_words.at(skewed(wordCount));
+            if (capitalize)
+                word[0] = word[0].toUpper();
+            words.append(word);
+        }
+        return words.join(' ');
+    }
+
+    std::mt19937 m_rng;
+    std::uniform_real_distribution<double> m_uniform{0.0, 1.0};
+    QStringList m_words;
+    QStringList m_artists;
+    int m_next{0};
+};
+
+#endif // SYNTHCATALOG_H
@@ -25,6 +25,7 @@
 #include <QFileInfo>
 #include <QApplication>
 #include "tagreader.h"
+#include "dbaccess.h"
 #include <QtConcurrent>
 
 BmDbUpdateThread::BmDbUpdateThread(QSqlDatabase db, QObject *parent) :
@@ -77,8 +78,7 @@ QStringList BmDbUpdateThread::findMediaFiles(QString directory)
 
 void BmDbUpdateThread::run()
 {
-    database.open();
-    qInfo() << database.lastError();
+    DbAccess::open(database);
     TagReader reader;
     emit progressMaxChanged(0);
     emit progressChanged(0);
@@ -90,13 +90,6 @@ void BmDbUpdateThread::run()
     emit stateChanged("Getting metadata and adding songs to the database");
     emit progressMessage("Getting metadata and adding songs to the database");
     emit progressMaxChanged(files.size());
-    qInfo() << "Setting sqlite synchronous mode to OFF";
-    query.exec("PRAGMA synchronous=OFF");
-    qInfo() << query.lastError();
-    qInfo() << "Increasing sqlite cache size";
-    query.exec("PRAGMA cache_size=500000");
-    qInfo() << query.lastError();
-    query.exec("PRAGMA temp_store=2");
     qInfo() << "Beginning transaction";
     query.exec("BEGIN TRANSACTION");
     qInfo() << query.lastError();
@@ -137,13 +130,6 @@ void BmDbUpdateThread::startUnthreaded()
     emit stateChanged("Getting metadata and adding songs to the database");
     emit progressMessage("Getting metadata and adding songs to the database");
     emit progressMaxChanged(files.size());
-    qInfo() << "Setting sqlite synchronous mode to OFF";
-    query.exec("PRAGMA synchronous=OFF");
-    qInfo() << query.lastError();
-    qInfo() << "Increasing sqlite cache size";
-    query.exec("PRAGMA cache_size=500000");
-    qInfo() << query.lastError();
-    query.exec("PRAGMA temp_store=2");
     qInfo() << "Beginning transaction";
     database.transaction();
     qInfo() << query.lastError();
@@ -0,0 +1,92 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <deque>
+
+// Fixed capacity FIFO for handing work between pipeline stages running on
+// different threads.  Producers block while the queue is full so a fast stage
+// can't run arbitrarily far ahead of a slow one.  Once the producer side calls
+// close() consumers drain the remaining items and then see the end of the queue.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(const size_t capacity) : m_capacity(capacity) {}
+
+    // Blocks while the queue is full, returns false if the queue was closed
+    bool push(T item) {
+        QMutexLocker locker(&m_mutex);
+        while (m_items.size() >= m_capacity && !m_closed)
+            m_notFull.wait(&m_mutex);
+        if (m_closed)
+            return false;
+        m_items.push_back(std::move(item));
+        m_notEmpty.wakeOne();
+        return true;
+    }
+
+    // Moves item into the queue only if there is room for it
+    bool tryPush(T &item) {
+        QMutexLocker locker(&m_mutex);
+        if (m_items.size() >= m_capacity || m_closed)
+            return false;
+        m_items.push_back(std::move(item));
+        m_notEmpty.wakeOne();
+        return true;
+    }
+
+    // Blocks until an item is available, returns false once the queue is closed and drained
+    bool pop(T &item) {
+        QMutexLocker locker(&m_mutex);
+        while (m_items.empty() && !m_closed)
+            m_notEmpty.wait(&m_mutex);
+        if (m_items.empty())
+            return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.wakeOne();
+        return true;
+    }
+
+    bool tryPop(T &item) {
+        QMutexLocker locker(&m_mutex);
+        if (m_items.empty())
+            return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.wakeOne();
+        return true;
+    }
+
+    // Waits up to msecs for an item to arrive, returns true if one is available
+    bool waitForItem(const unsigned long msecs) {
+        QMutexLocker locker(&m_mutex);
+        if (m_items.empty() && !m_closed)
+            m_notEmpty.wait(&m_mutex, msecs);
+        return !m_items.empty();
+    }
+
+    void close() {
+        QMutexLocker locker(&m_mutex);
+        m_closed = true;
+        m_notEmpty.wakeAll();
+        m_notFull.wakeAll();
+    }
+
+    [[nodiscard]] bool isDrained() {
+        QMutexLocker locker(&m_mutex);
+        return m_closed && m_items.empty();
+    }
+
+private:
+    const size_t m_capacity;
+    std::deque<T> m_items;
+    bool m_closed{false};
+    QMutex m_mutex;
+    QWaitCondition m_notEmpty;
+    QWaitCondition m_notFull;
+};
+
+#endif // BOUNDEDQUEUE_H
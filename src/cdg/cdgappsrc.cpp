@@ -1,27 +1,70 @@
 #include "cdgappsrc.h"
 #include <gst/app/gstappsrc.h>
+#include <gst/video/gstvideometa.h>
 #include "cdg/cdgfilereader.h"
 #include <QMutex>
 #include <QDebug>
+#include <QtEndian>
+#include <algorithm>
+#include <array>
+
+namespace {
+
+quint32 toBGRx(const QRgb color)
+{
+    // QRgb is 0xffRRGGBB, which is laid out as B, G, R, x in little endian memory
+    return qToLittleEndian(quint32(color));
+}
+
+quint16 toRGB16(const QRgb color)
+{
+    return quint16(((qRed(color) >> 3) << 11) | ((qGreen(color) >> 2) << 5) | (qBlue(color) >> 3));
+}
+
+// Expands a paletted cdg frame into dst by looking up all 16 colors once and then
+// writing each source pixel scale times per line and duplicating each line scale times.
+template<typename Pixel>
+void expandFrame(const uchar *src, uchar *dst, const int scale, Pixel (*toPixel)(QRgb))
+{
+    const int width = cdg::FRAME_DIM_CROPPED.width();
+    const int height = cdg::FRAME_DIM_CROPPED.height();
+
+    std::array<QRgb, 16> palette;
+    memcpy(palette.data(), src + width * height, sizeof(palette));
+    std::array<Pixel, 16> lut;
+    std::transform(palette.begin(), palette.end(), lut.begin(), toPixel);
+
+    const size_t dstLineBytes = size_t(width) * scale * sizeof(Pixel);
+    for (int y = 0; y < height; y++)
+    {
+        auto pixel = reinterpret_cast<Pixel*>(dst);
+        if (scale == 1)
+        {
+            for (int x = 0; x < width; x++)
+                pixel[x] = lut[src[x] & 0x0F];
+        }
+        else
+        {
+            for (int x = 0; x < width; x++, pixel += scale)
+                std::fill_n(pixel, scale, lut[src[x] & 0x0F]);
+        }
+        for (int i = 1; i < scale; i++)
+            memcpy(dst + i * dstLineBytes, dst, dstLineBytes);
+        src += width;
+        dst += scale * dstLineBytes;
+    }
+}
+
+}
 
 CdgAppSrc::CdgAppSrc()
 {
     m_cdgAppSrc = reinterpret_cast<GstAppSrc*>(gst_element_factory_make("appsrc", "cdgAppSrc"));
     g_object_ref(m_cdgAppSrc);
 
-    auto appSrcCaps = gst_caps_new_simple(
-                "video/x-raw",
-                "format", G_TYPE_STRING, "RGB8P",
-                "width",  G_TYPE_INT, cdg::FRAME_DIM_CROPPED.width(),
-                "height", G_TYPE_INT, cdg::FRAME_DIM_CROPPED.height(),
-                "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
-                NULL);
-
-    g_object_set(m_cdgAppSrc, "caps", appSrcCaps, NULL);
-    gst_caps_unref(appSrcCaps);
+    configureOutput();
 
     g_object_set(m_cdgAppSrc, "stream-type", GST_APP_STREAM_TYPE_SEEKABLE, "format", GST_FORMAT_TIME, NULL);
-    gst_app_src_set_max_bytes(m_cdgAppSrc, cdg::CDG_IMAGE_SIZE * 200);
 
     GstAppSrcCallbacks callbacks;
     callbacks.need_data	  = &CdgAppSrc::cb_need_data;
@@ -34,6 +77,8 @@ CdgAppSrc::~CdgAppSrc()
 {
     reset();
     g_object_unref(m_cdgAppSrc);
+    gst_buffer_pool_set_active(m_bufferPool, false);
+    gst_object_unref(m_bufferPool);
 }
 
 GstElement *CdgAppSrc::getSrcElement()
@@ -54,9 +99,110 @@ void CdgAppSrc::load(const QString filename)
     QMutexLocker locker(&m_cdgFileReaderLock);
     reset();
     m_cdgFileReader = new CdgFileReader(filename);
+    m_frameNumber = 0;
     gst_app_src_set_duration(m_cdgAppSrc, m_cdgFileReader->getTotalDurationMS() * GST_MSECOND);
 }
 
+void CdgAppSrc::load(const QByteArray &cdgData)
+{
+    QMutexLocker locker(&m_cdgFileReaderLock);
+    reset();
+    m_cdgFileReader = new CdgFileReader(cdgData);
+    m_frameNumber = 0;
+    gst_app_src_set_duration(m_cdgAppSrc, m_cdgFileReader->getTotalDurationMS() * GST_MSECOND);
+}
+
+void CdgAppSrc::setOutputFormat(OutputFormat format, int scale)
+{
+    QMutexLocker locker(&m_cdgFileReaderLock);
+    scale = format == OutputFormat::Paletted ? 1 : std::max(1, scale);
+    if (format == m_outputFormat && scale == m_scale)
+        return;
+    m_outputFormat = format;
+    m_scale = scale;
+    configureOutput();
+}
+
+void CdgAppSrc::configureOutput()
+{
+    const char *format = "RGB8P";
+    int bytesPerPixel = 1;
+    switch (m_outputFormat)
+    {
+    case OutputFormat::Paletted:
+        break;
+    case OutputFormat::BGRx:
+        format = "BGRx";
+        bytesPerPixel = 4;
+        break;
+    case OutputFormat::RGB16:
+        format = "RGB16";
+        bytesPerPixel = 2;
+        break;
+    }
+
+    const int width = cdg::FRAME_DIM_CROPPED.width() * m_scale;
+    const int height = cdg::FRAME_DIM_CROPPED.height() * m_scale;
+    guint frameSize = cdg::CDG_IMAGE_SIZE;
+    if (m_outputFormat == OutputFormat::Paletted)
+    {
+        m_palettedFrame = std::vector<uchar>();
+    }
+    else
+    {
+        frameSize = width * height * bytesPerPixel;
+        m_palettedFrame.resize(cdg::CDG_IMAGE_SIZE);
+    }
+
+    auto appSrcCaps = gst_caps_new_simple(
+                "video/x-raw",
+                "format", G_TYPE_STRING, format,
+                "width",  G_TYPE_INT, width,
+                "height", G_TYPE_INT, height,
+                "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+                NULL);
+
+    g_object_set(m_cdgAppSrc, "caps", appSrcCaps, NULL);
+
+    // Buffers still held downstream keep their old pool alive, so start over with a new one
+    if (m_bufferPool)
+    {
+        gst_buffer_pool_set_active(m_bufferPool, false);
+        gst_object_unref(m_bufferPool);
+    }
+    m_bufferPool = gst_buffer_pool_new();
+    auto poolConfig = gst_buffer_pool_get_config(m_bufferPool);
+    gst_buffer_pool_config_set_params(poolConfig, appSrcCaps, frameSize, 4, 0);
+    gst_buffer_pool_set_config(m_bufferPool, poolConfig);
+    gst_buffer_pool_set_active(m_bufferPool, true);
+    gst_caps_unref(appSrcCaps);
+
+    // Queue up to 200 paletted frames worth of data, but always allow a few of the much larger scaled frames
+    gst_app_src_set_max_bytes(m_cdgAppSrc, std::max<guint64>(cdg::CDG_IMAGE_SIZE * 200, guint64(frameSize) * 4));
+
+    qInfo() << "CDG output format:" << format << width << "x" << height;
+}
+
+bool CdgAppSrc::renderNextFrame(uchar *frameBuffer)
+{
+    switch (m_outputFormat)
+    {
+    case OutputFormat::Paletted:
+        return m_cdgFileReader->moveToNextFrame(frameBuffer);
+    case OutputFormat::BGRx:
+        if (!m_cdgFileReader->moveToNextFrame(m_palettedFrame.data()))
+            return false;
+        expandFrame<quint32>(m_palettedFrame.data(), frameBuffer, m_scale, &toBGRx);
+        return true;
+    case OutputFormat::RGB16:
+        if (!m_cdgFileReader->moveToNextFrame(m_palettedFrame.data()))
+            return false;
+        expandFrame<quint16>(m_palettedFrame.data(), frameBuffer, m_scale, &toRGB16);
+        return true;
+    }
+    return false;
+}
+
 int CdgAppSrc::positionOfFinalFrameMS()
 {
     QMutexLocker locker(&m_cdgFileReaderLock);
@@ -74,18 +220,35 @@ void CdgAppSrc::cb_need_data(GstAppSrc *appsrc, [[maybe_unused]]guint unused_siz
 
     while (instance->g_appSrcNeedData)
     {
-        if(instance->m_cdgFileReader->moveToNextFrame())
+        GstBuffer *buffer = nullptr;
+        if (gst_buffer_pool_acquire_buffer(instance->m_bufferPool, &buffer, nullptr) != GST_FLOW_OK)
         {
-            auto buffer = gst_buffer_new_and_alloc(cdg::CDG_IMAGE_SIZE);
-            gst_buffer_fill(buffer,
-                            0,
-                            instance->m_cdgFileReader->currentFrame().data(),
-                            cdg::CDG_IMAGE_SIZE
-                            );
+            qWarning() << "Unable to acquire a buffer for the next cdg frame";
+            break;
+        }
+
+        GstMapInfo map;
+        gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+        bool moreFrames = instance->renderNextFrame(map.data);
+        gst_buffer_unmap(buffer, &map);
 
+        if (moreFrames)
+        {
             GST_BUFFER_PTS(buffer) = instance->m_cdgFileReader->currentFramePositionMS() * GST_MSECOND;
             GST_BUFFER_DURATION(buffer) = instance->m_cdgFileReader->currentFrameDurationMS() * GST_MSECOND;
 
+            // Tell downstream which part of the frame changed. Consecutive offsets let a sink
+            // tell whether it saw the previous frame and the delta is relative to what it shows.
+            GST_BUFFER_OFFSET(buffer) = instance->m_frameNumber++;
+            auto dirty = instance->m_cdgFileReader->currentFrameDirtyRect();
+            if (dirty.size() != cdg::FRAME_DIM_CROPPED)
+            {
+                const int scale = instance->m_scale;
+                gst_buffer_add_video_region_of_interest_meta(buffer, CDG_DIRTY_ROI_TYPE,
+                                                             dirty.x() * scale, dirty.y() * scale,
+                                                             dirty.width() * scale, dirty.height() * scale);
+            }
+
             auto rc = gst_app_src_push_buffer(appsrc, buffer);
 
             if (rc != GST_FLOW_OK)
@@ -96,6 +259,7 @@ void CdgAppSrc::cb_need_data(GstAppSrc *appsrc, [[maybe_unused]]guint unused_siz
         }
         else
         {
+            gst_buffer_unref(buffer);
             gst_app_src_end_of_stream(appsrc);
             return;
         }
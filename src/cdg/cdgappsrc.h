@@ -4,16 +4,37 @@
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include <QMutex>
+#include <vector>
 #include "cdgfilereader.h"
 
+// roi_type of the GstVideoRegionOfInterestMeta marking the part of a frame that changed
+constexpr const char *CDG_DIRTY_ROI_TYPE = "cdg-dirty";
+
 class CdgAppSrc
 {
 
+public:
+    enum class OutputFormat
+    {
+        // 8 bit palette indices followed by the 16 color palette (RGB8P), expanded downstream
+        Paletted,
+        // The palette is looked up in the decoder, downstream gets plain RGB it can use as is
+        BGRx,
+        RGB16
+    };
+
 private:
     GstAppSrc *m_cdgAppSrc { nullptr };
+    // Frames are rendered straight into buffers from this pool, which are recycled once downstream is done with them
+    GstBufferPool *m_bufferPool { nullptr };
 
     CdgFileReader *m_cdgFileReader { nullptr };
     std::atomic<bool> g_appSrcNeedData { false };
+    guint64 m_frameNumber { 0 };
+    OutputFormat m_outputFormat { OutputFormat::Paletted };
+    int m_scale { 1 };
+    // Paletted frame the expanded output is rendered from, unused in Paletted mode
+    std::vector<uchar> m_palettedFrame;
     QMutex m_cdgFileReaderLock { QMutex(QMutex::Recursive) };
 
     // AppSrc callbacks
@@ -21,6 +42,9 @@ private:
     static void cb_enough_data(GstAppSrc *appsrc, gpointer user_data);
     static gboolean cb_seek_data(GstAppSrc *appsrc, guint64 position, gpointer user_data);
 
+    void configureOutput();
+    bool renderNextFrame(uchar *frameBuffer);
+
 public:
     explicit CdgAppSrc();
     ~CdgAppSrc();
@@ -28,6 +52,14 @@ public:
     GstElement* getSrcElement();
     void reset();
     void load(const QString filename);
+    void load(const QByteArray &cdgData);
+
+    /**
+     * Sets the pixel format of the frames and an integer factor they are upscaled by
+     * with nearest neighbour sampling, which keeps the blocky CDG graphics crisp.
+     * The scale only applies to the RGB formats. Must not be called while playing.
+     */
+    void setOutputFormat(OutputFormat format, int scale = 1);
 
     /**
      * Returns the position of the very last frame.
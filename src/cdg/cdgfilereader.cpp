@@ -1,11 +1,13 @@
 #include "cdgfilereader.h"
 #include <QFile>
 #include <QDebug>
+#include <algorithm>
 
 
 constexpr int CDG_PACKAGES_PER_SECOND = 300;
 constexpr int MAXFPS = 60;  // no need to go higher than 60 fps
 constexpr int MIN_PACKAGES_BEFORE_NEW_FRAME = CDG_PACKAGES_PER_SECOND / MAXFPS;
+constexpr int KEYFRAME_INTERVAL = CDG_PACKAGES_PER_SECOND * 10;  // ~65KB per keyframe, so ~2MB for a 5 minute track
 
 CdgFileReader::CdgFileReader(const QString &filename)
 {
@@ -14,9 +16,38 @@ CdgFileReader::CdgFileReader(const QString &filename)
     file.open(QFile::ReadOnly);
     m_cdgData = file.readAll();
 
+    buildKeyframeIndex();
     rewind();
 }
 
+CdgFileReader::CdgFileReader(const QByteArray &cdgData)
+    : m_cdgData(cdgData)
+{
+    buildKeyframeIndex();
+    rewind();
+}
+
+void CdgFileReader::buildKeyframeIndex()
+{
+    const int numberOfPackages = m_cdgData.length() / (int)sizeof(cdg::CDG_SubCode);
+    auto subCodes = reinterpret_cast<const cdg::CDG_SubCode*>(m_cdgData.constData());
+    CdgImageFrame image;
+    int lastImageChangePkgIdx = -1;
+
+    for (int pkgIdx = 0; pkgIdx < numberOfPackages;)
+    {
+        if (pkgIdx > 0 && pkgIdx % KEYFRAME_INTERVAL == 0)
+        {
+            m_keyframes.push_back({ pkgIdx, image, lastImageChangePkgIdx });
+        }
+        if (image.applySubCode(subCodes[pkgIdx++]))
+        {
+            lastImageChangePkgIdx = pkgIdx;
+        }
+    }
+    m_final_image_change_pgk_idx = lastImageChangePkgIdx;
+}
+
 int CdgFileReader::getTotalDurationMS()
 {
     return getDurationOfPackagesInMS(m_cdgData.length() / (int)sizeof (cdg::CDG_SubCode));
@@ -24,10 +55,10 @@ int CdgFileReader::getTotalDurationMS()
 
 int CdgFileReader::positionOfFinalFrameMS()
 {
-    return isEOF() ? getDurationOfPackagesInMS(m_last_image_change_pgk_idx) : -1;
+    return m_final_image_change_pgk_idx >= 0 ? getDurationOfPackagesInMS(m_final_image_change_pgk_idx) : -1;
 }
 
-bool CdgFileReader::moveToNextFrame()
+bool CdgFileReader::moveToNextFrame(uchar *frameBuffer)
 {
     if (m_current_image_pgk_idx == 0)
     {
@@ -35,8 +66,9 @@ bool CdgFileReader::moveToNextFrame()
         while(!isEOF() && !readAndProcessNextPackage());
     }
 
-    // shift m_next_image to current image
-    m_next_image.copyCroppedImagedata(m_current_image_data.data());
+    // m_next_image becomes the current image, render it straight into the caller's buffer
+    m_current_image_dirty = m_next_image.takeDirtyRect();
+    m_next_image.copyCroppedImagedata(frameBuffer);
     m_current_image_pgk_idx = m_next_image_pgk_idx;
 
     bool imageChanged = false;
@@ -85,24 +117,46 @@ bool CdgFileReader::seek(int positionMS)
         return false;
     }
 
-    if (pkgIdx < m_current_image_pgk_idx)
+    // nearest keyframe at or before the target
+    auto keyframe = std::upper_bound(m_keyframes.cbegin(), m_keyframes.cend(), pkgIdx, [] (int idx, const Keyframe &kf) {
+        return idx < kf.pkgIdx;
+    });
+    const Keyframe *nearest = keyframe == m_keyframes.cbegin() ? nullptr : &*(keyframe - 1);
+
+    if (pkgIdx < m_current_image_pgk_idx || (nearest && nearest->pkgIdx > m_next_image_pgk_idx))
     {
-        qDebug() << "CDG: Seek backwards - rewinding";
-        rewind();
+        if (nearest)
+        {
+            restoreKeyframe(*nearest);
+        }
+        else
+        {
+            rewind();
+        }
     }
 
     while (m_next_image_pgk_idx < pkgIdx)
     {
         readAndProcessNextPackage();
     }
+    // frames in flight are flushed on seek, the next one must not be drawn as a delta
+    m_next_image.markAllDirty();
 
     return true;
 }
 
+void CdgFileReader::restoreKeyframe(const Keyframe &keyframe)
+{
+    m_next_image = keyframe.image;
+    m_next_image_pgk_idx = keyframe.pkgIdx;
+    m_current_image_pgk_idx = keyframe.pkgIdx;
+    m_cdgDataPos = keyframe.pkgIdx * (int)sizeof(cdg::CDG_SubCode);
+    m_last_image_change_pgk_idx = keyframe.lastImageChangePkgIdx;
+}
+
 void CdgFileReader::rewind()
 {
     m_cdgDataPos = 0;
-    m_current_image_data.fill(0); // all black frame
     m_current_image_pgk_idx = 0;
     m_next_image = CdgImageFrame();
     m_next_image_pgk_idx = 0;
@@ -135,15 +189,15 @@ void CdgFileReader::saveNextImgToFile()
     m_next_image.getImage().save(fn);
 }
 
-void CdgFileReader::saveCurrentImgToFile()
+void CdgFileReader::saveCurrentImgToFile(const uchar *frameBuffer)
 {
     auto fn = QString("/tmp/cdgimg/cur-%1-%2-%3.png")
             .arg(m_current_image_pgk_idx, 4, 10, QLatin1Char('0'))
             .arg(currentFramePositionMS(), 4, 10, QLatin1Char('0'))
             .arg(currentFrameDurationMS(), 4, 10, QLatin1Char('0'));
-    QImage img = QImage(m_current_image_data.data(), cdg::FRAME_DIM_CROPPED.width(), cdg::FRAME_DIM_CROPPED.height(), QImage::Format_Indexed8);
+    QImage img = QImage(frameBuffer, cdg::FRAME_DIM_CROPPED.width(), cdg::FRAME_DIM_CROPPED.height(), QImage::Format_Indexed8);
     auto colors = QVector<QRgb>(1024 / sizeof(QRgb));
-    memcpy(colors.data(), m_current_image_data.data() + cdg::CDG_IMAGE_SIZE - 1024, 1024);
+    memcpy(colors.data(), frameBuffer + cdg::CDG_IMAGE_SIZE - 1024, 1024);
     img.setColorTable(colors);
     img.save(fn);
 }
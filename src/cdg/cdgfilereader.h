@@ -2,6 +2,7 @@
 #define CDGFILEREADER_H
 
 #include <QString>
+#include <vector>
 #include "cdgimageframe.h"
 #include "libCDG.h"
 
@@ -9,22 +10,27 @@ class CdgFileReader
 {
 public:
     CdgFileReader(const QString &filename);
+    /**
+     * @brief Read from cdg data that is already in memory, e.g. decompressed from a zip archive.
+     */
+    explicit CdgFileReader(const QByteArray &cdgData);
 
     /**
      * @brief Read first/next frame from the data stream.
-     * @note  Replaces currentFrame() with the next frame with visible changes and
-     * sets currentFrameDurationMS() and currentFramePositionMS() as well.
-     * @return true if here are more frames to be read. false if EOF.
+     * @note  Writes the cropped image and palette of the frame to frameBuffer, which must hold
+     * cdg::CDG_IMAGE_SIZE bytes, and sets currentFrameDurationMS() and currentFramePositionMS() as well.
+     * @return true if here are more frames to be read. false if EOF, the frame written is then just a repeat of the previous one.
      */
-    bool moveToNextFrame();
-
-    std::array<uchar, cdg::CDG_IMAGE_SIZE> currentFrame() { return m_current_image_data; }
+    bool moveToNextFrame(uchar *frameBuffer);
     int currentFrameDurationMS();
+    // Area of the current frame that differs from the previous one, in cropped image coordinates
+    QRect currentFrameDirtyRect() { return m_current_image_dirty; }
     int currentFramePositionMS();
 
     /**
      * @brief Set currentFrame() to the frame that should be displayed at a given point in time.
-     * Note: If the position given is less than the position of currentFrame, the file is "rewinded" and read from the start.
+     * Note: If the position given is less than the position of currentFrame, or a keyframe lies between
+     * the current position and the target, reading restarts from the nearest keyframe before the target.
      * @param positionMS The position in milliseconds.
      * @return true is positionMS is within file range.
      */
@@ -40,16 +46,25 @@ public:
      * Returns the position of the very last frame.
      * This can be less than the total duration, beceause: "total duration = position + duration of final frame".
      *
-     * @return The value is not known until all data is read. If so, -1 is returned.
+     * @return -1 if the file contains no visible changes at all.
      */
     int positionOfFinalFrameMS();
 
 #ifdef QT_DEBUG
     void saveNextImgToFile();
-    void saveCurrentImgToFile();
+    void saveCurrentImgToFile(const uchar *frameBuffer);
 #endif
 
 private:
+    struct Keyframe
+    {
+        int pkgIdx;
+        CdgImageFrame image;
+        int lastImageChangePkgIdx;
+    };
+
+    void buildKeyframeIndex();
+    void restoreKeyframe(const Keyframe &keyframe);
     void rewind();
     bool readAndProcessNextPackage();
     inline bool isEOF();
@@ -59,8 +74,8 @@ private:
     QByteArray m_cdgData;
     int m_cdgDataPos;
 
-    std::array<uchar, cdg::CDG_IMAGE_SIZE> m_current_image_data;
     int m_current_image_pgk_idx;
+    QRect m_current_image_dirty;
 
     CdgImageFrame m_next_image;
     int m_next_image_pgk_idx;
@@ -69,6 +84,13 @@ private:
      * Index of the last read package that caused a visible image change.
      */
     int m_last_image_change_pgk_idx;
+
+    /**
+     * Image state after every KEYFRAME_INTERVAL packages, built when the file is loaded.
+     * The images share their pixel data with the frame they were taken from until it's modified.
+     */
+    std::vector<Keyframe> m_keyframes;
+    int m_final_image_change_pgk_idx {-1};
 };
 
 #endif // CDGFILEREADER_H
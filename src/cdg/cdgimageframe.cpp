@@ -1,5 +1,22 @@
 #include "cdgimageframe.h"
 
+namespace {
+
+// Expands a 6 bit tile row into one byte per pixel, 0xFF where the pixel takes color1.
+// The leftmost pixel is the highest bit (0x20).
+constexpr std::array<std::array<uchar, 6>, 64> buildTileRowMasks()
+{
+    std::array<std::array<uchar, 6>, 64> masks{};
+    for (int row = 0; row < 64; row++)
+        for (int x = 0; x < 6; x++)
+            masks[row][x] = (row & (0x20 >> x)) ? 0xFF : 0x00;
+    return masks;
+}
+
+constexpr auto TILE_ROW_MASKS = buildTileRowMasks();
+
+}
+
 
 CdgImageFrame::CdgImageFrame()
 {
@@ -16,6 +33,7 @@ CdgImageFrame::CdgImageFrame()
     m_borderRBytesOffset = 294 * m_bytesPerPixel;
     m_image.setColorTable(palette);
     m_image.fill(0);
+    markAllDirty();
 }
 
 bool CdgImageFrame::applySubCode(const cdg::CDG_SubCode &subCode)
@@ -69,7 +87,8 @@ bool CdgImageFrame::applySubCode(const cdg::CDG_SubCode &subCode)
 
 void CdgImageFrame::copyCroppedImagedata(uchar *destbuffer)
 {
-    uchar* src = m_image.bits();
+    // constBits() so a frame sharing its pixels with a keyframe isn't detached just to be read
+    const uchar* src = m_image.constBits();
     uchar* destpos = destbuffer;
 
     for (auto y=0; y < cdg::FRAME_DIM_CROPPED.height(); y++)
@@ -86,11 +105,19 @@ void CdgImageFrame::copyCroppedImagedata(uchar *destbuffer)
 
 }
 
+QRect CdgImageFrame::takeDirtyRect()
+{
+    auto dirty = m_dirty.translated(-(m_borderLRBytes / m_bytesPerPixel + m_curHOffset), -(12 + m_curVOffset));
+    m_dirty = QRect();
+    return dirty.intersected(QRect(QPoint(0, 0), cdg::FRAME_DIM_CROPPED));
+}
+
 void CdgImageFrame::cmdBorderPreset(const cdg::CdgBorderPresetData &borderPreset)
 {
     // Is there a safer C++ way to do these memory copies?
     if (borderPreset.color >= 16)
         return;
+    markAllDirty();
     for (auto line=0; line < 216; line++)
     {
         if (line < 12 || line > 202)
@@ -115,6 +142,8 @@ bool CdgImageFrame::cmdColors(const cdg::CdgColorsData &data, const cdg::CdgColo
         }
         curColor++;
     });
+    if (changed)
+        markAllDirty();
     return changed;
 }
 
@@ -129,46 +158,48 @@ bool CdgImageFrame::cmdMemoryPreset(const cdg::CdgMemoryPresetData &memoryPreset
         return false;
     }
     m_image.fill(memoryPreset.color);
+    markAllDirty();
     return true;
 }
 
 
 void CdgImageFrame::cmdTileBlock(const cdg::CdgTileBlockData &tileBlockPacket, const cdg::TileBlockType &type)
 {
-    constexpr static std::array<char,6> MASKS{0x20,0x10,0x08,0x04,0x02,0x01};
-
     // reject corrupted CDG packets w/ invalid row/column
     if (tileBlockPacket.row >= 18 || tileBlockPacket.column >= 50 || tileBlockPacket.color0 >= 16 || tileBlockPacket.color1 >= 16)
         return;
 
-    // There's probably a better way to do this, needs research
-    for (auto y = 0; y < 12; y++)
-    {
-        auto ptr = m_image.scanLine(y + tileBlockPacket.top);
-        auto rowData = tileBlockPacket.tilePixels[y];
-        switch (type) {
-        case cdg::TileBlockXOR:
-            *(ptr + (tileBlockPacket.left * m_bytesPerPixel))       ^= (rowData & MASKS[0]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 1) * m_bytesPerPixel)) ^= (rowData & MASKS[1]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 2) * m_bytesPerPixel)) ^= (rowData & MASKS[2]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 3) * m_bytesPerPixel)) ^= (rowData & MASKS[3]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 4) * m_bytesPerPixel)) ^= (rowData & MASKS[4]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 5) * m_bytesPerPixel)) ^= (rowData & MASKS[5]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            break;
-        case cdg::TileBlockNormal:
-            *(ptr + (tileBlockPacket.left * m_bytesPerPixel))       = (rowData & MASKS[0]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 1) * m_bytesPerPixel)) = (rowData & MASKS[1]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 2) * m_bytesPerPixel)) = (rowData & MASKS[2]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 3) * m_bytesPerPixel)) = (rowData & MASKS[3]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 4) * m_bytesPerPixel)) = (rowData & MASKS[4]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            *(ptr + ((tileBlockPacket.left + 5) * m_bytesPerPixel)) = (rowData & MASKS[5]) ? tileBlockPacket.color1 : tileBlockPacket.color0;
-            break;
+    // Each pixel is color0 ^ ((color0 ^ color1) & mask), which picks color1 where the mask is set without branching
+    m_dirty |= QRect(tileBlockPacket.left, tileBlockPacket.top, 6, 12);
+
+    const uchar color0 = tileBlockPacket.color0;
+    const uchar colorDiff = color0 ^ tileBlockPacket.color1;
+    const auto bytesPerLine = m_image.bytesPerLine();
+    uchar *ptr = m_image.bits() + tileBlockPacket.top * bytesPerLine + tileBlockPacket.left * m_bytesPerPixel;
+
+    switch (type) {
+    case cdg::TileBlockXOR:
+        for (auto y = 0; y < 12; y++, ptr += bytesPerLine)
+        {
+            const auto &mask = TILE_ROW_MASKS[tileBlockPacket.tilePixels[y] & 0x3F];
+            for (auto x = 0; x < 6; x++)
+                ptr[x] ^= color0 ^ (colorDiff & mask[x]);
+        }
+        break;
+    case cdg::TileBlockNormal:
+        for (auto y = 0; y < 12; y++, ptr += bytesPerLine)
+        {
+            const auto &mask = TILE_ROW_MASKS[tileBlockPacket.tilePixels[y] & 0x3F];
+            for (auto x = 0; x < 6; x++)
+                ptr[x] = color0 ^ (colorDiff & mask[x]);
         }
+        break;
     }
 }
 
 void CdgImageFrame::cmdScroll(const cdg::CdgScrollCmdData &scrollCmdData, const cdg::ScrollType type)
 {
+    markAllDirty();
     // Todo: add range checks for corrupted CDG packets to prevent crashes
 
     if (scrollCmdData.hSCmd == 2)
@@ -14,6 +14,10 @@ public:
 
     void copyCroppedImagedata(uchar *destbuffer);
 
+    // Area of the cropped image changed since the last call, palette changes and scrolling mark all of it.
+    QRect takeDirtyRect();
+    void markAllDirty() { m_dirty = QRect(QPoint(0, 0), cdg::FRAME_DIM_FULL); }
+
     QImage getImage() { return m_image; }
 
 private:
@@ -27,6 +31,8 @@ private:
     int m_curHOffset;
 
     bool m_lastCmdWasMempreset {false};
+    // In full frame coordinates
+    QRect m_dirty;
 
     void cmdScroll(const cdg::CdgScrollCmdData &scrollCmdData, const cdg::ScrollType type);
     void cmdTileBlock(const cdg::CdgTileBlockData &tileBlockPacket, const cdg::TileBlockType &type);
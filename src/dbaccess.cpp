@@ -0,0 +1,108 @@
+#include "dbaccess.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QSqlError>
+#include <QThread>
+#include <memory>
+
+// Sql built from values ends up in here if someone misuses the cache, don't let it grow without bound
+constexpr int MAX_CACHED_STATEMENTS = 256;
+// How much of the database file each connection maps into memory instead of reading it through syscalls
+constexpr qint64 MMAP_SIZE = 256ll * 1024 * 1024;
+
+namespace {
+std::unique_ptr<PreparedStatements> defaultStatements;
+}
+
+std::shared_ptr<QSqlQuery> PreparedStatements::get(const QString &sql)
+{
+    auto it = m_queries.find(sql);
+    if (it == m_queries.end())
+    {
+        auto query = std::make_shared<QSqlQuery>(m_db);
+        if (!query->prepare(sql))
+        {
+            // Not cached, the caller's exec() reports the error
+            qWarning() << "PreparedStatements - unable to prepare" << sql << ":" << query->lastError();
+            return query;
+        }
+        if (m_queries.size() >= MAX_CACHED_STATEMENTS)
+            evictUnused();
+        it = m_queries.insert(sql, query);
+    }
+    // Only releases the result set of the last use.  The values bound back then stay, every
+    // user binds all of the placeholders again before calling exec().
+    (*it)->finish();
+    return *it;
+}
+
+void PreparedStatements::clear()
+{
+    m_queries.clear();
+}
+
+void PreparedStatements::evictUnused()
+{
+    // A query somebody still holds a handle to stays, dropping it wouldn't free anything anyway
+    for (auto it = m_queries.begin(); it != m_queries.end();)
+    {
+        if (it->use_count() == 1)
+            it = m_queries.erase(it);
+        else
+            ++it;
+    }
+}
+
+void DbAccess::enableWal(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    if (query.exec("PRAGMA journal_mode=WAL") && query.next())
+        qInfo() << "DbAccess - journal mode:" << query.value(0).toString();
+    else
+        qWarning() << "DbAccess - unable to enable write-ahead logging:" << query.lastError();
+}
+
+void DbAccess::configureConnection(QSqlDatabase db)
+{
+    QSqlQuery query(db);
+    // In WAL mode NORMAL only syncs on checkpoints, a crash can lose the last commits but never corrupts the file
+    query.exec("PRAGMA synchronous=NORMAL");
+    query.exec("PRAGMA cache_size=300000");
+    query.exec("PRAGMA temp_store=2");
+    query.exec(QString("PRAGMA mmap_size=%1").arg(MMAP_SIZE));
+}
+
+bool DbAccess::open(QSqlDatabase db)
+{
+    if (!db.open())
+    {
+        qWarning() << "DbAccess - unable to open" << db.connectionName() << ":" << db.lastError();
+        return false;
+    }
+    configureConnection(db);
+    return true;
+}
+
+QSqlDatabase DbAccess::readOnlyClone(const QString &connectionName)
+{
+    auto db = QSqlDatabase::cloneDatabase(QSqlDatabase::database(), connectionName);
+    auto options = db.connectOptions();
+    if (!options.isEmpty())
+        options += ';';
+    db.setConnectOptions(options + "QSQLITE_OPEN_READONLY");
+    return db;
+}
+
+CachedQuery DbAccess::prepared(const QString &sql)
+{
+    Q_ASSERT(QThread::currentThread() == QCoreApplication::instance()->thread());
+    if (!defaultStatements)
+        defaultStatements = std::make_unique<PreparedStatements>(QSqlDatabase::database());
+    return CachedQuery(defaultStatements->get(sql));
+}
+
+void DbAccess::releasePrepared()
+{
+    defaultStatements.reset();
+}
@@ -0,0 +1,67 @@
+#ifndef DBACCESS_H
+#define DBACCESS_H
+
+#include <QHash>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QString>
+#include <memory>
+
+// Statements prepared once against a connection and reused afterwards, keyed by
+// their sql.  Only meant for fixed sql with placeholders, sql built from values
+// would just fill the cache with queries that never get used again.  A cached
+// query is shared by everyone asking for the same sql, so read its results
+// before asking for it again.  The returned handle keeps the query alive even
+// if the cache drops it.  Must be used from the thread that owns the connection.
+class PreparedStatements
+{
+public:
+    explicit PreparedStatements(QSqlDatabase db) : m_db(db) {}
+    std::shared_ptr<QSqlQuery> get(const QString &sql);
+    void clear();
+
+private:
+    QSqlDatabase m_db;
+    QHash<QString, std::shared_ptr<QSqlQuery>> m_queries;
+    void evictUnused();
+};
+
+// One use of a cached statement.  Finishes the query when it goes out of scope,
+// a select that isn't read to the end would otherwise keep its snapshot of the
+// database and stop the write-ahead log from being checkpointed.
+class CachedQuery
+{
+public:
+    explicit CachedQuery(std::shared_ptr<QSqlQuery> query) : m_query(std::move(query)) {}
+    CachedQuery(const CachedQuery &) = delete;
+    CachedQuery &operator=(const CachedQuery &) = delete;
+    ~CachedQuery() { m_query->finish(); }
+    QSqlQuery *operator->() const { return m_query.get(); }
+    QSqlQuery &operator*() const { return *m_query; }
+
+private:
+    std::shared_ptr<QSqlQuery> m_query;
+};
+
+// Common setup for the connections to the song database
+class DbAccess
+{
+public:
+    // Switches the database file to write-ahead logging.  This is persistent, so
+    // it only has to be done once, but it's harmless to repeat.  Readers then work
+    // from a snapshot and neither block nor get blocked by the writing connection.
+    static void enableWal(QSqlDatabase db);
+    // Per connection pragmas, applied to every connection right after opening it
+    static void configureConnection(QSqlDatabase db);
+    // Opens db and configures it, returns false if it couldn't be opened
+    static bool open(QSqlDatabase db);
+    // A read-only copy of the default connection for a background reader.  Call it
+    // on the gui thread and open() the result on the thread that uses it.
+    static QSqlDatabase readOnlyClone(const QString &connectionName);
+    // The statement cache of the default connection, gui thread only
+    static CachedQuery prepared(const QString &sql);
+    // Drops the cached statements of the default connection before it goes away
+    static void releasePrepared();
+};
+
+#endif // DBACCESS_H
@@ -26,17 +26,160 @@
 #include <QDebug>
 #include <QStandardPaths>
 #include <QApplication>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QThreadPool>
+#include <QVector>
 #include "src/models/tablemodelkaraokesourcedirs.h"
 #include <QtConcurrent>
 #include "mzarchive.h"
 #include "tagreader.h"
 #include "karaokefileinfo.h"
+#include "dbaccess.h"
 
 SourceDir::NamingPattern g_pattern;
 int g_customPatternId, g_artistCaptureGrp, g_titleCaptureGrp, g_songIdCaptureGrp;
 QString g_artistRegex, g_titleRegex, g_songIdRegex;
 QStringList errors;
 
+namespace {
+
+const int scanQueueDepth = 1024;
+// New and moved songs are committed in batches of this size, or once the first write of a
+// batch is this old.  Slow validation on network or usb storage would otherwise hold the
+// write lock for minutes and leave the ui's writes waiting behind it.
+const int scanBatchSize = 500;
+const qint64 scanBatchMs = 250;
+
+struct ScanJob
+{
+    QString path;
+    bool dropped{false};
+};
+
+struct ScanResult
+{
+    enum Status {Ok, Skipped, Failed};
+    Status status{Ok};
+    QString path;
+    QString fileName;
+    QString artist;
+    QString title;
+    QString discid;
+    int duration{0};
+    bool dropped{false};
+    QString error;
+};
+
+struct ScanOptions
+{
+    SourceDir::NamingPattern pattern;
+    QString sourceDir;
+    bool skipValidation;
+    bool lazyDurations;
+    const KaraokeFileInfo *customPattern;
+};
+
+// Several missing songs can share a file name (track 01 of every disc for example), prefer
+// the one whose old path has the longest common tail with the new location
+int bestMoveCandidate(const QStringList &candidates, const QString &newPath)
+{
+    int best = 0;
+    int bestLength = -1;
+    for (int i = 0; i < candidates.size(); i++)
+    {
+        const QString &candidate = candidates.at(i);
+        int length = 0;
+        while (length < candidate.size() && length < newPath.size() && candidate.at(candidate.size() - length - 1) == newPath.at(newPath.size() - length - 1))
+            length++;
+        if (length > bestLength)
+        {
+            best = i;
+            bestLength = length;
+        }
+    }
+    return best;
+}
+
+bool hasKaraokeExtension(const QString &fn)
+{
+    return fn.endsWith(".zip", Qt::CaseInsensitive) || fn.endsWith(".cdg", Qt::CaseInsensitive) || fn.endsWith(".mkv", Qt::CaseInsensitive) || fn.endsWith(".avi", Qt::CaseInsensitive) || fn.endsWith(".wmv", Qt::CaseInsensitive) || fn.endsWith(".mp4", Qt::CaseInsensitive) || fn.endsWith(".m4v", Qt::CaseInsensitive) || fn.endsWith(".mpg", Qt::CaseInsensitive) || fn.endsWith(".mpeg", Qt::CaseInsensitive);
+}
+
+// Runs on the scan worker threads, must not touch the database
+ScanResult scanKaraokeFile(const ScanJob &job, const ScanOptions &options, MzArchive &archive, KaraokeFileInfo &parser)
+{
+    ScanResult result;
+    result.path = job.path;
+    result.dropped = job.dropped;
+    const QString &fileName = job.path;
+#ifdef Q_OS_WIN
+    if (fileName.contains("*") || fileName.contains("?") || fileName.contains("<") || fileName.contains(">") || fileName.contains("|"))
+    {
+        // illegal character
+        result.status = ScanResult::Failed;
+        result.error = "Illegal character in filename: " + fileName;
+        return result;
+    }
+#endif
+    if (fileName.endsWith(".cdg", Qt::CaseInsensitive) && DbUpdateThread::findMatchingAudioFile(fileName) == "")
+    {
+        result.status = ScanResult::Skipped;
+        return result;
+    }
+    const bool isZip = fileName.endsWith(".zip", Qt::CaseInsensitive);
+    if (isZip && !job.dropped)
+    {
+        archive.setArchiveFile(fileName);
+        if (!options.skipValidation && !archive.isValidKaraokeFile())
+        {
+            result.status = ScanResult::Failed;
+            result.error = archive.getLastError() + ": " + fileName;
+            return result;
+        }
+        if (options.lazyDurations)
+            result.duration = -2;
+        else
+            result.duration = archive.getSongDuration();
+    }
+    parser.setFileName(fileName);
+    parser.setPattern(options.pattern, options.sourceDir);
+    if (options.pattern == SourceDir::CUSTOM)
+        parser.copyCustomPattern(*options.customPattern);
+    result.artist = parser.getArtist();
+    result.title = parser.getTitle();
+    result.discid = parser.getSongId();
+    if (job.dropped)
+        result.duration = parser.getDuration();
+    else if (!isZip)
+    {
+        if (options.lazyDurations)
+            result.duration = -3;
+        else
+            result.duration = parser.getDuration();
+    }
+    QFileInfo file(fileName);
+    if (result.artist == "" && result.title == "" && result.discid == "")
+    {
+        // Something went wrong, no metadata found. File is probably named wrong. If we didn't try media tags, give it a shot
+        if (options.pattern != SourceDir::METADATA)
+        {
+            parser.setPattern(SourceDir::METADATA, options.sourceDir);
+            result.artist = parser.getArtist();
+            result.title = parser.getTitle();
+            result.discid = parser.getSongId();
+        }
+        // If we still don't have any metadata, just throw filename into the title field
+        if (result.artist == "" && result.title == "" && result.discid == "")
+            result.title = file.completeBaseName();
+    }
+    result.fileName = file.completeBaseName();
+    return result;
+}
+
+}
+
 bool DbUpdateThread::dbEntryExists(QString filepath)
 {
 //    qInfo() << "DbUpdateThread::dbEntryExists(" << filepath << ") called";
@@ -129,115 +272,95 @@ QString DbUpdateThread::getPath() const
     return path;
 }
 
-QStringList DbUpdateThread::findKaraokeFiles(QString directory)
+void DbUpdateThread::findKaraokeFiles(const QString &directory, const DirManifest &previous, DirManifest &current, BoundedQueue<QString> &files)
 {
     qInfo() << "DbUpdateThread::findKaraokeFiles(" << directory << ") called";
-    QStringList files;
-    emit progressMessage("Finding karaoke files in " + directory);
-    files.clear();
-    files.reserve(200000);
-    QDir dir(directory);
-    QDirIterator iterator(dir.absolutePath(), QDirIterator::Subdirectories);
-
-    int existing = 0;
-    int notInDb = 0;
-    int total = 0;
-    qInfo() << "Creating query";
-    QSqlQuery query;
-    qInfo() << "Created";
-    bool alreadyInDb = false;
-    query.prepare("SELECT songid FROM dbsongs WHERE path = :filepath AND discid != '!!DROPPED!!' LIMIT 1");
-    int loops = 0;
-    while (iterator.hasNext()) {
-        QApplication::processEvents();
-        iterator.next();
-        if (!iterator.fileInfo().isDir()) {
-            total++;
-            query.bindValue(":filepath", iterator.filePath());
-            query.exec();
-            //qInfo() << query.lastError();
-            if (query.first())
-            {
-                alreadyInDb = true;
-            }
-            else
-            {
-                alreadyInDb = false;
-            }
-            if (alreadyInDb)
+    QVector<QPair<QString, QString>> pendingDirs;
+    pendingDirs.append(qMakePair(QDir(directory).absolutePath(), QString()));
+    int found = 0;
+    int unchanged = 0;
+    bool canceled = false;
+    while (!pendingDirs.isEmpty() && !canceled)
+    {
+        const auto dir = pendingDirs.takeLast();
+        DirManifest::Entry entry;
+        if (!DirManifest::statDir(dir.first, entry))
+            continue;
+        current.insert(dir.first, dir.second, entry);
+        if (previous.isUnchanged(dir.first, entry))
+        {
+            // Nothing was added or removed directly in here, only the subdirectories need a look
+            for (const auto &subdir : previous.subdirs(dir.first))
+                pendingDirs.append(qMakePair(subdir, dir.first));
+            unchanged++;
+            continue;
+        }
+        QDirIterator iterator(dir.first, QDir::AllEntries | QDir::NoDotAndDotDot);
+        while (iterator.hasNext())
+        {
+            iterator.next();
+            if (iterator.fileInfo().isDir())
             {
-                existing++;
-                if (loops >= 5)
-                {
-                    emit stateChanged("Finding potential karaoke files... " + QString::number(total) + " found. " + QString::number(notInDb) + " new/" + QString::number(existing) + " existing");
-                    loops = 0;
-                }
+                if (!iterator.fileInfo().isSymLink())
+                    pendingDirs.append(qMakePair(iterator.filePath(), dir.first));
                 continue;
             }
             QString fn = iterator.filePath();
-            if (fn.endsWith(".zip",Qt::CaseInsensitive))
-                files.append(fn);
-            else if (fn.endsWith(".cdg", Qt::CaseInsensitive))
+            if (!hasKaraokeExtension(fn))
+                continue;
+            // Blocks while the rest of the pipeline catches up, fails only if the scan was torn down
+            if (!files.push(fn))
             {
-                if (findMatchingAudioFile(fn) != "")
-                    files.append(fn);
+                canceled = true;
+                break;
             }
-            else if (fn.endsWith(".mkv", Qt::CaseInsensitive) || fn.endsWith(".avi", Qt::CaseInsensitive) || fn.endsWith(".wmv", Qt::CaseInsensitive) || fn.endsWith(".mp4", Qt::CaseInsensitive) || fn.endsWith(".m4v", Qt::CaseInsensitive) || fn.endsWith(".mpg", Qt::CaseInsensitive) || fn.endsWith(".mpeg", Qt::CaseInsensitive))
-                files.append(fn);
-            notInDb++;
-        }
-        if (loops >= 5)
-        {
-            emit stateChanged("Finding potential karaoke files... " + QString::number(total) + " found. " + QString::number(notInDb) + " new/" + QString::number(existing) + " existing");
-            loops = 0;
+            found++;
         }
-        loops++;
     }
-    emit stateChanged("Finding potential karaoke files... " + QString::number(total) + " found. " + QString::number(notInDb) + " new/" + QString::number(existing) + " existing");
-    qInfo() << "File search results - Potential files: " << files.size() << " - Already in DB: " << existing << " - New: " << notInDb;
-    emit progressMessage("Done searching for files.");
-    qInfo() << "DbUpdateThread::findKaraokeFiles(" << directory << ") ended";
-    return files;
+    qInfo() << "DbUpdateThread::findKaraokeFiles(" << directory << ") ended, found " << found << " potential karaoke files, " << unchanged << " of " << current.size() << " directories unchanged since the last scan";
 }
 
-QStringList DbUpdateThread::getMissingDbFiles()
+QStringList DbUpdateThread::getMissingDbFiles(QSqlDatabase db, const DirManifest &manifest)
 {
     qInfo() << "DbUpdateThread::getMissingDbFiles() called";
-//    qInfo() << "Creating thread db connection";
-//    QSqlDatabase database = genUniqueDbConn();
-////    database.setDatabaseName(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QDir::separator() + "openkj.sqlite");
-//    database.open();
-//    qInfo() << "Created";
     QStringList files;
-    QSqlQuery query;
+    // Nothing can have been deleted from a directory whose stat still matches the manifest,
+    // so each directory is stat'ed once instead of every song file in it
+    QHash<QString, bool> unchangedDirs;
+    int skipped = 0;
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
     query.exec("SELECT path from dbsongs");
     while (query.next())
     {
-        QString path = query.value("path").toString();
+        QString path = query.value(0).toString();
+        const QString dir = path.left(path.lastIndexOf('/'));
+        auto it = unchangedDirs.constFind(dir);
+        if (it == unchangedDirs.constEnd())
+        {
+            DirManifest::Entry entry;
+            it = unchangedDirs.insert(dir, DirManifest::statDir(dir, entry) && manifest.isUnchanged(dir, entry));
+        }
+        if (it.value())
+        {
+            skipped++;
+            continue;
+        }
         if (!QFile(path).exists())
         {
             files.append(path);
         }
     }
     query.clear();
-//    database.close();
-//    qInfo() << "Removing thread db connection";
-//    QSqlDatabase::removeDatabase(database.connectionName());
-//    qInfo() << "Removed";
-//    qInfo() << "DbUpdateThread::getMissingDbFiles() ended";
+    qInfo() << "DbUpdateThread::getMissingDbFiles() ended - " << files.size() << " missing, " << skipped << " skipped in unchanged directories";
     return files;
 }
 
-QStringList DbUpdateThread::getDragDropFiles()
+QStringList DbUpdateThread::getDragDropFiles(QSqlDatabase db)
 {
     qInfo() << "DbUpdateThread::getDragDropFiles() called";
-//    qInfo() << "Creating thread db connection";
-//    QSqlDatabase database = genUniqueDbConn();
-////    database.setDatabaseName(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QDir::separator() + "openkj.sqlite");
-//    database.open();
-//    qInfo() << "Created";
     QStringList files;
-    QSqlQuery query;
+    QSqlQuery query(db);
     query.exec("SELECT path from dbsongs WHERE discid = '!!DROPPED!!'");
     while (query.next())
     {
@@ -353,252 +476,267 @@ int DbUpdateThread::addDroppedFile(QString path)
     }
 }
 
-void DbUpdateThread::startUnthreaded()
+void DbUpdateThread::scanDirectory(QSqlDatabase db)
 {
     emit progressChanged(0);
     emit progressMaxChanged(0);
     emit stateChanged("Verifing that files in DB are present on disk");
-    emit stateChanged("Finding potential karaoke files...");
-    QStringList missingFiles = getMissingDbFiles();
-    QStringList newSongs = findKaraokeFiles(path);
-    QStringList dragDropFiles = getDragDropFiles();
-    qInfo() << "Creating QSqlQuery";
-    QSqlQuery query;
-    qInfo() << "Created";
-
-    // Try to find out if any of the new files found have been moved and fix the db entry
-    emit stateChanged("Detecting and updating moved files...");
-    emit progressMaxChanged(missingFiles.size());
-    int count = 0;
-    qInfo() << "Looking for missing files";
-    database.transaction();
-    for (int f=0; f<missingFiles.size(); f++)
+    DirManifest previousManifest;
+    DirManifest currentManifest;
+    if (m_incremental)
     {
-        QApplication::processEvents();
-        emit progressMessage("Looking for matches to missing db song: " + missingFiles.at(f));
-        qInfo() << "Looking for match for missing file: " << missingFiles.at(f);
-        bool matchfound = false;
-        QString newFile;
-        QString missingFile;
-        query.prepare("UPDATE dbsongs SET path = :newpath WHERE path = :oldpath");
-        for (int i=0; i < newSongs.size(); i++)
-        {
-            QApplication::processEvents();
-            missingFile = missingFiles.at(f);
-            newFile = newSongs.at(i);
-            if (QFileInfo(newSongs.at(i)).fileName() == QFileInfo(missingFiles.at(f)).fileName())
-            {
-//                query.prepare("UPDATE dbsongs SET path = :newpath WHERE path = :oldpath");
-                query.bindValue(":newpath", newFile);
-                query.bindValue(":oldpath", missingFile);
-                query.exec();
-                qInfo() << "Missing file found at new location";
-                qInfo() << "  old: " << missingFile;
-                qInfo() << "  new: " << newFile;
-                newSongs.removeAt(i);
-                emit progressMessage("Found match! Modifying existing song.");
-                matchfound = true;
-                break;
-            }
-        }
-        if (!matchfound)
-            emit progressMessage("No match found");
-
-        count++;
-        emit progressChanged(count);
+        QSqlQuery countQuery(db);
+        countQuery.exec("SELECT COUNT(*) FROM dbsongs");
+        // A cleared song db has to be rebuilt from a full walk no matter what the manifest says
+        if (countQuery.first() && countQuery.value(0).toInt() > 0)
+            previousManifest.load(db);
     }
-    qInfo() << "Committing transaction";
-    database.commit();
-    qInfo() << "Processing dragged/dropped files";
-    for (int f=0; f < dragDropFiles.size(); f++)
+    // Missing songs keyed by file name, a new file with the same name is taken to be the song's new location
+    QHash<QString, QStringList> missingByName;
+    for (const auto &missing : getMissingDbFiles(db, previousManifest))
+        missingByName[QFileInfo(missing).fileName()].append(missing);
+    QVariantList movedFrom;
+    QVariantList movedTo;
+    QSet<QString> dragDropFiles;
+    for (const auto &file : getDragDropFiles(db))
+        dragDropFiles.insert(file);
+
+    ScanOptions options{g_pattern, path, settings->dbSkipValidation(), settings->dbLazyLoadDurations(), nullptr};
+    // Custom pattern regexes live in the database, load them once here since the workers have no connection
+    KaraokeFileInfo customPattern;
+    if (g_pattern == SourceDir::CUSTOM)
     {
-        QApplication::processEvents();
-        QString dropFile = dragDropFiles.at(f);
-        qInfo() << "Looking for matches for drop file: " << dropFile;
-        query.prepare("UPDATE dbsongs SET discid = :discid, artist = :artist, title = :title, filename = :filename, duration = :duration, searchstring = :searchstring WHERE path = :path");
-        QString artist;
-        QString title;
-        QString discid;
-        QString filePath;
-        QString fileName;
-        int duration = 0;
-        QString searchString;
-
-        for (int i=0; i < newSongs.size(); i++)
+        customPattern.setPattern(SourceDir::CUSTOM, path);
+        if (!customPattern.loadCustomPattern(db))
         {
-            QApplication::processEvents();
-            if (newSongs.at(i) == dropFile)
-            {
-                qInfo() << "Found match for drop file: " << dropFile;
-                QFileInfo file(dropFile);
-                filePath = file.filePath();
-                fileName = file.completeBaseName();
-                KaraokeFileInfo parser;
-                parser.setFileName(dropFile);
-                parser.setPattern(g_pattern, path);
-                artist = parser.getArtist();
-                title = parser.getTitle();
-                discid = parser.getSongId();
-                duration = parser.getDuration();
-
-                if (artist == "" && title == "" && discid == "")
-                {
-                    // Something went wrong, no metadata found. File is probably named wrong. If we didn't try media tags, give it a shot
-                    if (g_pattern != SourceDir::METADATA)
-                    {
-                        parser.setPattern(SourceDir::METADATA, path);
-                        artist = parser.getArtist();
-                        title = parser.getTitle();
-                        discid = parser.getSongId();
-                    }
-                    // If we still don't have any metadata, just throw filename into the title field
-                    if (artist == "" && title == "" && discid == "")
-                        title = file.completeBaseName();
-                }
-                searchString = QString(file.completeBaseName() + " " + artist + " " + title + " " + discid);
-                query.bindValue(":discid", discid);
-                query.bindValue(":artist", artist);
-                query.bindValue(":title", title);
-                query.bindValue(":path", filePath);
-                query.bindValue(":filename", fileName);
-                query.bindValue(":duration", duration);
-                query.bindValue(":searchstring", searchString);
-                query.exec();
-                newSongs.removeAt(i);
-                break;
-            }
+            // Every file would just end up titled after its file name, leave the source dir alone
+            errorMutex.lock();
+            errors.append("Unable to load the custom naming pattern, not scanned: " + path);
+            errorMutex.unlock();
+            emit progressMessage("Unable to load the custom naming pattern for " + path + ", scan skipped.");
+            emit errorsGenerated(errors);
+            return;
         }
     }
-    qInfo() << "Adding new songs";
-    emit progressMaxChanged(newSongs.size());
-    emit progressMessage("Found " + QString::number(newSongs.size()) + " potential karaoke files.");
-    QString fName;
-    QString filePath;
-    QString discid;
-    QString artist;
-    QString title;
-    QString searchString;
-    int duration = 0;
-    qInfo() << "Setting sqlite synchronous mode to OFF";
-    query.exec("PRAGMA synchronous=OFF");
-    qInfo() << query.lastError();
-    qInfo() << "Increasing sqlite cache size";
-    query.exec("PRAGMA cache_size=500000");
-    qInfo() << query.lastError();
-    query.exec("PRAGMA temp_store=2");
-    qInfo() << "Beginning transaction";
-    database.transaction();
-    emit progressMessage("Checking if files are valid and getting durations...");
-    emit stateChanged("Validating karaoke files and getting song durations...");
-    qInfo() << "Preparing statement";
-    query.prepare("INSERT OR IGNORE INTO dbSongs (discid,artist,title,path,filename,duration,searchstring) VALUES(:discid, :artist, :title, :path, :filename, :duration, :searchstring)");
-    qInfo() << "Statement prepared";
-    qInfo() << "Creating MzArchive instance";
-    MzArchive archive;
-    KaraokeFileInfo parser;
-    qInfo() << "looping over songs";
-    int loops = 0;
-    for (int i=0; i < newSongs.count(); i++)
+    options.customPattern = &customPattern;
+
+    QSqlQuery query(db);
+    // Load every known path up front so checking a walked file is a hash lookup instead of a query
+    QElapsedTimer preloadTimer;
+    preloadTimer.start();
+    QSet<QString> knownPaths;
+    query.setForwardOnly(true);
+    query.exec("SELECT COUNT(*) FROM dbsongs");
+    if (query.first())
+        knownPaths.reserve(query.value(0).toInt());
+    query.exec("SELECT path FROM dbsongs WHERE discid != '!!DROPPED!!'");
+    while (query.next())
+        knownPaths.insert(query.value(0).toString());
+    query.finish();
+    qInfo() << "Loaded " << knownPaths.size() << " known song paths in " << preloadTimer.elapsed() << "ms";
+    QSqlQuery movedQuery(db);
+    movedQuery.prepare("UPDATE dbsongs SET path = :newpath WHERE path = :oldpath");
+    QSqlQuery droppedQuery(db);
+    droppedQuery.prepare("UPDATE dbsongs SET discid = :discid, artist = :artist, title = :title, filename = :filename, duration = :duration, searchstring = :searchstring WHERE path = :path");
+    QSqlQuery insertQuery(db);
+    insertQuery.prepare("INSERT OR IGNORE INTO dbSongs (discid,artist,title,path,filename,duration,searchstring) VALUES(:discid, :artist, :title, :path, :filename, :duration, :searchstring)");
+
+    // Walker -> worker pool -> this thread as the only db writer.  The queues between the
+    // stages are bounded so the walker can't race ahead of archive validation on a big share.
+    BoundedQueue<QString> walkedFiles(scanQueueDepth);
+    BoundedQueue<ScanJob> jobs(scanQueueDepth);
+    BoundedQueue<ScanResult> results(scanQueueDepth);
+    const int workerCount = qMax(4, QThread::idealThreadCount());
+    QAtomicInt runningWorkers(workerCount);
+    QThreadPool pool;
+    pool.setMaxThreadCount(workerCount + 1);
+    const QString directory = path;
+    QtConcurrent::run(&pool, [&walkedFiles, &previousManifest, &currentManifest, directory]() {
+        findKaraokeFiles(directory, previousManifest, currentManifest, walkedFiles);
+        walkedFiles.close();
+    });
+    for (int i = 0; i < workerCount; i++)
     {
-        QApplication::processEvents();
-        QString fileName = newSongs.at(i);
-        //qInfo() << "Beginning processing file: " << fileName;
-        QFileInfo file(fileName);
-        //emit progressMessage("Processing file: " + file.completeBaseName());
-#ifdef Q_OS_WIN
-        if (fileName.contains("*") || fileName.contains("?") || fileName.contains("<") || fileName.contains(">") || fileName.contains("|"))
+        QtConcurrent::run(&pool, [&jobs, &results, &options, &runningWorkers]() {
+            MzArchive archive;
+            KaraokeFileInfo parser;
+            ScanJob job;
+            while (jobs.pop(job))
+                results.push(scanKaraokeFile(job, options, archive, parser));
+            if (!runningWorkers.deref())
+                results.close();
+        });
+    }
+
+    const bool onGuiThread = (QThread::currentThread() == QCoreApplication::instance()->thread());
+    int found = 0;
+    int existing = 0;
+    int moved = 0;
+    int queued = 0;
+    int processed = 0;
+    int added = 0;
+    int pendingWrites = 0;
+    QElapsedTimer batchAge;
+    QElapsedTimer elapsed;
+    elapsed.start();
+    qint64 lastReport = 0;
+    double filesPerSecond = 0.0;
+    auto reportProgress = [&]() {
+        filesPerSecond = (elapsed.elapsed() > 0) ? processed * 1000.0 / elapsed.elapsed() : 0.0;
+        emit progressMaxChanged(queued);
+        emit progressChanged(processed);
+        emit stateChanged("Processing karaoke files... " + QString::number(found) + " found, " + QString::number(existing) + " existing, " + QString::number(moved) + " moved, " + QString::number(processed) + " of " + QString::number(queued) + " new files processed (" + QString::number(filesPerSecond, 'f', 1) + " files/s)");
+        if (onGuiThread)
+            QApplication::processEvents();
+    };
+
+    emit stateChanged("Finding potential karaoke files...");
+    db.transaction();
+    bool walking = true;
+    bool jobPending = false;
+    ScanJob pendingJob;
+    while (true)
+    {
+        bool idle = true;
+        ScanResult result;
+        while (results.tryPop(result))
         {
-            // illegal character
-            errorMutex.lock();
-            errors.append("Illegal character in filename: " + fileName);
-            errorMutex.unlock();
-            emit progressMessage("Illegal character in filename: " + fileName);
-            emit progressChanged(i + 1);
-            continue;
+            idle = false;
+            processed++;
+            if (result.status == ScanResult::Failed)
+            {
+                errorMutex.lock();
+                errors.append(result.error);
+                errorMutex.unlock();
+                emit progressMessage(result.error);
+                continue;
+            }
+            if (result.status == ScanResult::Skipped)
+                continue;
+            // The drop file update and the insert take the same parameters
+            QSqlQuery &writeQuery = result.dropped ? droppedQuery : insertQuery;
+            writeQuery.bindValue(":discid", result.discid);
+            writeQuery.bindValue(":artist", result.artist);
+            writeQuery.bindValue(":title", result.title);
+            writeQuery.bindValue(":path", result.path);
+            writeQuery.bindValue(":filename", result.fileName);
+            writeQuery.bindValue(":duration", result.duration);
+            writeQuery.bindValue(":searchstring", QString(result.fileName + " " + result.artist + " " + result.title + " " + result.discid));
+            writeQuery.exec();
+            if (!result.dropped)
+                added++;
+            if (pendingWrites++ == 0)
+                batchAge.start();
         }
-#endif
-        if (fileName.endsWith(".zip", Qt::CaseInsensitive))
+        for (int i = 0; walking && i < scanQueueDepth; i++)
         {
-            archive.setArchiveFile(fileName);
-            if (!settings->dbSkipValidation())
+            if (!jobPending)
             {
-                if (!archive.isValidKaraokeFile())
+                QString file;
+                if (!walkedFiles.tryPop(file))
                 {
-                    errorMutex.lock();
-                    errors.append(archive.getLastError() + ": " + fileName);
-                    errorMutex.unlock();
-                    //emit progressMessage(archive.getLastError() + ": " + fileName);
-                    if (loops >= 5)
+                    if (walkedFiles.isDrained())
                     {
-                        emit stateChanged("Validating karaoke files and getting song durations... " + QString::number(i + 1) + " of " + QString::number(newSongs.size()));
-                        emit progressChanged(i + 1);
-                        loops = 0;
+                        walking = false;
+                        jobs.close();
                     }
+                    break;
+                }
+                idle = false;
+                found++;
+                if (knownPaths.contains(file))
+                {
+                    existing++;
+                    continue;
+                }
+                // Drop files are already in the db, they only need their metadata filled in
+                pendingJob.dropped = dragDropFiles.contains(file);
+                // Try to find out if the new file is one that went missing and fix its db entry
+                auto candidates = pendingJob.dropped ? missingByName.end() : missingByName.find(QFileInfo(file).fileName());
+                if (candidates != missingByName.end())
+                {
+                    const int match = bestMoveCandidate(candidates.value(), file);
+                    qInfo() << "Missing file found at new location";
+                    qInfo() << "  old: " << candidates->at(match);
+                    qInfo() << "  new: " << file;
+                    emit progressMessage("Found moved file: " + file);
+                    movedFrom.append(candidates->at(match));
+                    movedTo.append(file);
+                    candidates->removeAt(match);
+                    if (candidates->isEmpty())
+                        missingByName.erase(candidates);
+                    moved++;
                     continue;
                 }
+                pendingJob.path = file;
+                jobPending = true;
+                queued++;
             }
-            if (settings->dbLazyLoadDurations())
-                duration = -2;
-            else
-                duration = archive.getSongDuration();
+            if (!jobs.tryPush(pendingJob))
+                break;
+            jobPending = false;
         }
-        parser.setFileName(fileName);
-        parser.setPattern(g_pattern, path);
-        artist = parser.getArtist();
-        title = parser.getTitle();
-        discid = parser.getSongId();
-        if (!fileName.endsWith(".zip", Qt::CaseInsensitive))
+        if (pendingWrites >= scanBatchSize || (pendingWrites > 0 && batchAge.elapsed() >= scanBatchMs))
         {
-            if (settings->dbLazyLoadDurations())
-                duration = -3;
-            else
-                duration = parser.getDuration();
+            db.commit();
+            db.transaction();
+            pendingWrites = 0;
         }
-        if (artist == "" && title == "" && discid == "")
+        if (!walking && results.isDrained())
+            break;
+        if (idle)
+            results.waitForItem(20);
+        if (elapsed.elapsed() - lastReport >= 250)
         {
-            // Something went wrong, no metadata found. File is probably named wrong. If we didn't try media tags, give it a shot
-            if (g_pattern != SourceDir::METADATA)
-            {
-                parser.setPattern(SourceDir::METADATA, path);
-                artist = parser.getArtist();
-                title = parser.getTitle();
-                discid = parser.getSongId();
-            }
-            // If we still don't have any metadata, just throw filename into the title field
-            if (artist == "" && title == "" && discid == "")
-                title = file.completeBaseName();
+            lastReport = elapsed.elapsed();
+            reportProgress();
         }
-        fName = file.completeBaseName();
-        filePath = fileName;
-        searchString = QString(fName + " " + artist + " " + title + " " + discid);
-        query.bindValue(":discid", discid);
-        query.bindValue(":artist", artist);
-        query.bindValue(":title", title);
-        query.bindValue(":path", filePath);
-        query.bindValue(":filename", fName);
-        query.bindValue(":duration", duration);
-        query.bindValue(":searchstring", searchString);
-        query.exec();
-        if (loops >= 5)
+    }
+    pool.waitForDone();
+    qInfo() << "Committing transaction";
+    db.commit();
+    if (!movedFrom.isEmpty())
+    {
+        qInfo() << "Updating paths of " << movedFrom.size() << " moved songs";
+        db.transaction();
+        movedQuery.bindValue(":newpath", movedTo);
+        movedQuery.bindValue(":oldpath", movedFrom);
+        if (!movedQuery.execBatch())
+            qInfo() << "Error updating moved songs: " << movedQuery.lastError();
+        db.commit();
+    }
+    // Whatever is still missing wasn't found anywhere else.  Scans never delete songs, the rows
+    // keep their plays and queue entries in case the files come back.  A live rescan reports the
+    // songs whose directory it could list and that changed since the last scan, a directory that
+    // is gone or unreadable (an unmounted share, for example) says nothing about what's in it.
+    m_missingFiles.clear();
+    if (m_incremental)
+    {
+        for (const auto &paths : qAsConst(missingByName))
         {
-            emit progressChanged(i + 1);
-            emit stateChanged("Validating karaoke files and getting song durations... " + QString::number(i + 1) + " of " + QString::number(newSongs.size()));
-            loops = 0;
+            for (const auto &missing : paths)
+            {
+                const QString dir = missing.left(missing.lastIndexOf('/'));
+                if (previousManifest.contains(dir) && currentManifest.contains(dir) && QDir(dir).isReadable())
+                    m_missingFiles.append(missing);
+            }
         }
-        //qInfo() << "Done processing file: " << fileName;
-        loops++;
     }
-    qInfo() << "Done looping";
-    qInfo() << "Committing transaction";
-    database.commit();
-    qInfo() << "QSqlDatabase last error: " << database.lastError();
-    qInfo() << "QSqlQuery last error: " << query.lastError();
+    currentManifest.save(db, path);
+    m_scannedDirs = currentManifest.dirs();
+    reportProgress();
+    qInfo() << "Scan of " << path << " done in " << elapsed.elapsed() << "ms - Potential files: " << found << " - Already in DB: " << existing << " - Moved: " << moved << " - Missing: " << m_missingFiles.size() << " - Added: " << added << " - " << filesPerSecond << " files/s";
+    qInfo() << "QSqlDatabase last error: " << db.lastError();
     emit progressMessage("Done processing new files.");
     if (errors.size() > 0)
     {
         emit errorsGenerated(errors);
     }
-    //emit databaseUpdateComplete();
+}
+
+void DbUpdateThread::startUnthreaded()
+{
+    scanDirectory(QSqlDatabase::database());
 }
 
 void DbUpdateThread::setPath(const QString &value)
@@ -610,254 +748,8 @@ void DbUpdateThread::setPath(const QString &value)
 void DbUpdateThread::run()
 {
     emit databaseAboutToUpdate();
-
-    database.open();
-    emit progressChanged(0);
-    emit progressMaxChanged(0);
-    emit stateChanged("Verifing that files in DB are present on disk");
-    emit stateChanged("Finding potential karaoke files...");
-    QStringList missingFiles = getMissingDbFiles();
-    QStringList newSongs = findKaraokeFiles(path);
-    QStringList dragDropFiles = getDragDropFiles();
-
-//    qInfo() << "Creating thread db connection";
-//    QSqlDatabase database = genUniqueDbConn();
-////    database.setDatabaseName(QStandardPaths::writableLocation(QStandardPaths::DataLocation) + QDir::separator() + "openkj.sqlite");
-//    database.open();
-//    qInfo() << "Created";
-    qInfo() << "Creating QSqlQuery";
-    QSqlQuery query(database);
-    qInfo() << "Created";
-
-    // Try to find out if any of the new files found have been moved and fix the db entry
-    emit stateChanged("Detecting and updating moved files...");
-    emit progressMaxChanged(missingFiles.size());
-    int count = 0;
-    qInfo() << "Looking for missing files";
-    query.exec("BEGIN TRANSACTION");
-    for (int f=0; f<missingFiles.size(); f++)
-    {
-        emit progressMessage("Looking for matches to missing db song: " + missingFiles.at(f));
-        qInfo() << "Looking for match for missing file: " << missingFiles.at(f);
-        bool matchfound = false;
-        QString newFile;
-        QString missingFile;
-        query.prepare("UPDATE dbsongs SET path = :newpath WHERE path = :oldpath");
-        for (int i=0; i < newSongs.size(); i++)
-        {
-            missingFile = missingFiles.at(f);
-            newFile = newSongs.at(i);
-            if (QFileInfo(newSongs.at(i)).fileName() == QFileInfo(missingFiles.at(f)).fileName())
-            {
-//                query.prepare("UPDATE dbsongs SET path = :newpath WHERE path = :oldpath");
-                query.bindValue(":newpath", newFile);
-                query.bindValue(":oldpath", missingFile);
-                query.exec();
-                qInfo() << "Missing file found at new location";
-                qInfo() << "  old: " << missingFile;
-                qInfo() << "  new: " << newFile;
-                newSongs.removeAt(i);
-                emit progressMessage("Found match! Modifying existing song.");
-                matchfound = true;
-                break;
-            }
-        }
-        if (!matchfound)
-            emit progressMessage("No match found");
-
-        count++;
-        emit progressChanged(count);
-    }
-    qInfo() << "Committing transaction";
-    query.exec("COMMIT TRANSACTION");
-    qInfo() << "Processing dragged/dropped files";
-    for (int f=0; f < dragDropFiles.size(); f++)
-    {
-        QString dropFile = dragDropFiles.at(f);
-        qInfo() << "Looking for matches for drop file: " << dropFile;
-        query.prepare("UPDATE dbsongs SET discid = :discid, artist = :artist, title = :title, filename = :filename, duration = :duration, searchstring = :searchstring WHERE path = :path");
-        QString artist;
-        QString title;
-        QString discid;
-        QString filePath;
-        QString fileName;
-        int duration = 0;
-        QString searchString;
-
-        for (int i=0; i < newSongs.size(); i++)
-        {
-            if (newSongs.at(i) == dropFile)
-            {
-                qInfo() << "Found match for drop file: " << dropFile;
-                QFileInfo file(dropFile);
-                filePath = file.filePath();
-                fileName = file.completeBaseName();
-//                int duration = 0;
-//                query.prepare("UPDATE dbsongs SET discid = :discid, artist = :artist, title = :title, filename = :filename, duration = :duration, searchstring = :searchstring WHERE path = :path");
-//                QString artist;
-//                QString title;
-//                QString discid;
-                KaraokeFileInfo parser;
-                parser.setFileName(dropFile);
-                parser.setPattern(g_pattern, path);
-                artist = parser.getArtist();
-                title = parser.getTitle();
-                discid = parser.getSongId();
-                duration = parser.getDuration();
-
-                if (artist == "" && title == "" && discid == "")
-                {
-                    // Something went wrong, no metadata found. File is probably named wrong. If we didn't try media tags, give it a shot
-                    if (g_pattern != SourceDir::METADATA)
-                    {
-                        parser.setPattern(SourceDir::METADATA, path);
-                        artist = parser.getArtist();
-                        title = parser.getTitle();
-                        discid = parser.getSongId();
-                    }
-                    // If we still don't have any metadata, just throw filename into the title field
-                    if (artist == "" && title == "" && discid == "")
-                        title = file.completeBaseName();
-                }
-                searchString = QString(file.completeBaseName() + " " + artist + " " + title + " " + discid);
-                query.bindValue(":discid", discid);
-                query.bindValue(":artist", artist);
-                query.bindValue(":title", title);
-                query.bindValue(":path", filePath);
-                query.bindValue(":filename", fileName);
-                query.bindValue(":duration", duration);
-                query.bindValue(":searchstring", searchString);
-                query.exec();
-                newSongs.removeAt(i);
-                break;
-            }
-        }
-    }
-    qInfo() << "Adding new songs";
-    // Add new songs to the database
-    emit progressMaxChanged(newSongs.size());
-    emit progressMessage("Found " + QString::number(newSongs.size()) + " potential karaoke files.");
-    QString fName;
-    QString filePath;
-    QString discid;
-    QString artist;
-    QString title;
-    QString searchString;
-    int duration = 0;
-    qInfo() << "Setting sqlite synchronous mode to OFF";
-    query.exec("PRAGMA synchronous=OFF");
-    qInfo() << query.lastError();
-    qInfo() << "Increasing sqlite cache size";
-    query.exec("PRAGMA cache_size=500000");
-    qInfo() << query.lastError();
-    query.exec("PRAGMA temp_store=2");
-    qInfo() << "Beginning transaction";
-    query.exec("BEGIN TRANSACTION");
-    //database.transaction();
-    emit progressMessage("Checking if files are valid and getting durations...");
-    emit stateChanged("Validating karaoke files and getting song durations...");
-    qInfo() << "Preparing statement";
-    query.prepare("INSERT OR IGNORE INTO dbSongs (discid,artist,title,path,filename,duration,searchstring) VALUES(:discid, :artist, :title, :path, :filename, :duration, :searchstring)");
-    qInfo() << "Statement prepared";
-//    qInfo() << "Creating QProcess";
-//    QProcess *process = new QProcess(this);
-    qInfo() << "Creating MzArchive instance";
-    MzArchive archive;
-    KaraokeFileInfo parser;
-    qInfo() << "looping over songs";
-    for (int i=0; i < newSongs.count(); i++)
-    {
-        QString fileName = newSongs.at(i);
-        QFileInfo file(fileName);
-        emit progressMessage("Processing file: " + file.completeBaseName());
-#ifdef Q_OS_WIN
-        if (fileName.contains("*") || fileName.contains("?") || fileName.contains("<") || fileName.contains(">") || fileName.contains("|"))
-        {
-            // illegal character
-            errorMutex.lock();
-            errors.append("Illegal character in filename: " + fileName);
-            errorMutex.unlock();
-            emit progressMessage("Illegal character in filename: " + fileName);
-            emit progressChanged(i + 1);
-            continue;
-        }
-#endif
-        if (fileName.endsWith(".zip", Qt::CaseInsensitive))
-        {
-            //MzArchive *archive = new MzArchive(process);
-            archive.setArchiveFile(fileName);
-
-            if (!archive.isValidKaraokeFile())
-            {
-                errorMutex.lock();
-                errors.append(archive.getLastError() + ": " + fileName);
-                errorMutex.unlock();
-                emit progressMessage(archive.getLastError() + ": " + fileName);
-                emit progressChanged(i + 1);
-                continue;
-            }
-
-            duration = archive.getSongDuration();
-        }
-
-//        KaraokeFileInfo parser;
-        parser.setFileName(fileName);
-
-        parser.setPattern(g_pattern, path);
-        artist = parser.getArtist();
-        title = parser.getTitle();
-        discid = parser.getSongId();
-        if (!fileName.endsWith(".zip", Qt::CaseInsensitive))
-            duration = parser.getDuration();
-
-        if (artist == "" && title == "" && discid == "")
-        {
-            // Something went wrong, no metadata found. File is probably named wrong. If we didn't try media tags, give it a shot
-            if (g_pattern != SourceDir::METADATA)
-            {
-                parser.setPattern(SourceDir::METADATA, path);
-                artist = parser.getArtist();
-                title = parser.getTitle();
-                discid = parser.getSongId();
-            }
-            // If we still don't have any metadata, just throw filename into the title field
-            if (artist == "" && title == "" && discid == "")
-                title = file.completeBaseName();
-        }
-        fName = file.completeBaseName();
-        filePath = fileName;
-        searchString = QString(fName + " " + artist + " " + title + " " + discid);
-        query.bindValue(":discid", discid);
-        query.bindValue(":artist", artist);
-        query.bindValue(":title", title);
-        query.bindValue(":path", filePath);
-        query.bindValue(":filename", fName);
-        query.bindValue(":duration", duration);
-        query.bindValue(":searchstring", searchString);
-        query.exec();
-        //qInfo() << query.lastError();
-        emit progressChanged(i + 1);
-        emit stateChanged("Validating karaoke files and getting song durations... " + QString::number(i + 1) + " of " + QString::number(newSongs.size()));
-       // msleep(60);
-
-    }
-    qInfo() << "Done looping";
-//    delete process;
-//    delete archive;
-    qInfo() << "Committing transaction";
-    //database.commit();
-    query.exec("COMMIT TRANSACTION");
-    qInfo() << "QSqlDatabase last error: " << database.lastError();
-    qInfo() << "QSqlQuery last error: " << query.lastError();
-    emit progressMessage("Done processing new files.");
-    if (errors.size() > 0)
-    {
-        emit errorsGenerated(errors);
-    }
+    DbAccess::open(database);
+    scanDirectory(database);
     database.close();
     emit databaseUpdateComplete();
-//    qInfo() << "Removing thread db connection";
-//    query.clear();
-//    QSqlDatabase::removeDatabase(database.connectionName());
-//    qInfo() << "Removed";
 }
@@ -26,6 +26,8 @@
 #include <QtSql>
 #include "src/models/tablemodelkaraokesourcedirs.h"
 #include "settings.h"
+#include "boundedqueue.h"
+#include "dirmanifest.h"
 
 class DbUpdateThread : public QThread
 {
@@ -37,6 +39,10 @@ private:
     //QSqlDatabase database;
     QSqlDatabase database;
     Settings *settings;
+    bool m_incremental{false};
+    QStringList m_scannedDirs;
+    QStringList m_missingFiles;
+    void scanDirectory(QSqlDatabase db);
 
 
 public:
@@ -46,15 +52,23 @@ public:
     void setPath(const QString &value);
     int getPattern() const;
     void setPattern(SourceDir::NamingPattern value);
-    QStringList findKaraokeFiles(QString directory);
-    QStringList getMissingDbFiles();
-    QStringList getDragDropFiles();
+    static void findKaraokeFiles(const QString &directory, const DirManifest &previous, DirManifest &current, BoundedQueue<QString> &files);
+    QStringList getMissingDbFiles(QSqlDatabase db, const DirManifest &manifest);
+    QStringList getDragDropFiles(QSqlDatabase db);
     QStringList getErrors();
     void addSingleTrack(QString path);
     int addDroppedFile(QString path);
     void startUnthreaded();
     bool dbEntryExists(QString filepath);
     static QString findMatchingAudioFile(QString cdgFilePath);
+    // Incremental scans skip directories that haven't changed since the last scan.  Not every
+    // filesystem updates a directory's mtime, so only the live rescans use them.
+    void setIncremental(bool incremental) { m_incremental = incremental; }
+    // Directories below the source dir seen by the last scan
+    QStringList scannedDirs() const { return m_scannedDirs; }
+    // Songs a live rescan found to be gone from disk.  Their rows are left alone, only
+    // directories that were listed fine and changed since the last scan are trusted.
+    QStringList missingFiles() const { return m_missingFiles; }
 
 signals:
     void threadFinished();
@@ -0,0 +1,243 @@
+#include "dbwriter.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <algorithm>
+
+// A commit goes out once the first queued write is this old or this many statements are waiting
+constexpr unsigned long BATCH_WINDOW_MS = 250;
+constexpr size_t MAX_BATCH_STATEMENTS = 500;
+// A batch that finds the database locked is rolled back and tried again this many times.  Each
+// statement already waits out sqlite's busy timeout before it reports the lock.
+constexpr int MAX_BUSY_RETRIES = 20;
+constexpr unsigned long BUSY_RETRY_DELAY_MS = 100;
+
+namespace {
+
+// SQLITE_BUSY or SQLITE_LOCKED, another connection holds the write lock
+bool isBusy(const QSqlError &error)
+{
+    return error.nativeErrorCode() == QLatin1String("5") || error.nativeErrorCode() == QLatin1String("6");
+}
+
+}
+
+DbWriter::~DbWriter()
+{
+    stopWriting();
+}
+
+void DbWriter::startWriting(QSqlDatabase db)
+{
+    if (isRunning())
+        return;
+    m_db = db;
+    QMutexLocker locker(&m_mutex);
+    m_running = true;
+    m_stopping = false;
+    start();
+}
+
+void DbWriter::stopWriting()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_running)
+            return;
+        m_stopping = true;
+        m_queued.wakeAll();
+    }
+    wait();
+    QMutexLocker locker(&m_mutex);
+    m_running = false;
+    qInfo() << "DbWriter - stopped, all writes committed";
+}
+
+void DbWriter::enqueue(const QString &sql, const QVariantList &values)
+{
+    enqueue(std::vector<Statement>{Statement{sql, values}});
+}
+
+void DbWriter::enqueue(std::vector<Statement> statements)
+{
+    if (statements.empty())
+        return;
+    QMutexLocker locker(&m_mutex);
+    if (!m_running)
+    {
+        locker.unlock();
+        auto db = QSqlDatabase::database();
+        PreparedStatements prepared(db);
+        if (statements.size() > 1)
+            db.transaction();
+        const auto result = execute(prepared, db, statements);
+        if (statements.size() > 1 && !db.commit())
+        {
+            qCritical() << "DbWriter - commit failed:" << db.lastError();
+            db.rollback();
+        }
+        if (result != Result::Ok)
+            emit writeFailed(tr("Changes could not be saved to the database."));
+        return;
+    }
+    m_pendingStatements += statements.size();
+    m_pending.push_back(Pending{++m_queuedSeq, std::move(statements)});
+    m_queued.wakeAll();
+}
+
+bool DbWriter::waitForWrites()
+{
+    QMutexLocker locker(&m_mutex);
+    const auto target = m_queuedSeq;
+    const auto from = m_doneSeq;
+    if (!m_running || m_doneSeq >= target)
+        return true;
+    m_flushRequested = true;
+    m_queued.wakeAll();
+    while (m_doneSeq < target)
+        m_committed.wait(&m_mutex);
+    return m_failedSeq <= from;
+}
+
+void DbWriter::afterWrites(QObject *context, std::function<void()> callback)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_running || m_doneSeq >= m_queuedSeq)
+    {
+        locker.unlock();
+        callback();
+        return;
+    }
+    m_callbacks.push_back(Callback{m_queuedSeq, context, std::move(callback)});
+}
+
+void DbWriter::run()
+{
+    DbAccess::open(m_db);
+    // The same few statements are written over and over during a show
+    PreparedStatements prepared(m_db);
+    QElapsedTimer batchAge;
+    QMutexLocker locker(&m_mutex);
+    while (true)
+    {
+        while (m_pending.empty() && !m_stopping)
+            m_queued.wait(&m_mutex);
+        if (m_pending.empty())
+            break;
+
+        // Give the rest of a burst the chance to arrive and share the commit
+        batchAge.start();
+        while (!m_stopping && !m_flushRequested && m_pendingStatements < MAX_BATCH_STATEMENTS)
+        {
+            const auto elapsed = static_cast<unsigned long>(batchAge.elapsed());
+            if (elapsed >= BATCH_WINDOW_MS)
+                break;
+            m_queued.wait(&m_mutex, BATCH_WINDOW_MS - elapsed);
+        }
+
+        std::deque<Pending> batch;
+        batch.swap(m_pending);
+        const auto statementCount = m_pendingStatements;
+        const auto seq = batch.back().seq;
+        m_pendingStatements = 0;
+        m_flushRequested = false;
+        locker.unlock();
+
+        QElapsedTimer timer;
+        timer.start();
+        bool committed = false;
+        quint64 failedSeq = 0;
+        for (int attempt = 0; ; attempt++)
+        {
+            failedSeq = 0;
+            bool busy = false;
+            m_db.transaction();
+            for (const auto &pending : batch)
+            {
+                const auto result = execute(prepared, m_db, pending.statements);
+                if (result == Result::Busy)
+                {
+                    busy = true;
+                    break;
+                }
+                if (result == Result::Failed)
+                    failedSeq = pending.seq;
+            }
+            if (!busy && m_db.commit())
+            {
+                committed = true;
+                break;
+            }
+            const auto error = m_db.lastError();
+            busy = busy || isBusy(error);
+            m_db.rollback();
+            if (!busy || attempt >= MAX_BUSY_RETRIES)
+            {
+                qCritical() << "DbWriter - dropping" << statementCount << "statements, the batch could not be committed:" << error;
+                failedSeq = seq;
+                break;
+            }
+            qWarning() << "DbWriter - database is locked, retrying the batch";
+            QThread::msleep(BUSY_RETRY_DELAY_MS);
+        }
+        if (committed)
+            qDebug() << "DbWriter - committed" << statementCount << "statements in" << timer.elapsed() << "ms";
+        if (failedSeq)
+            emit writeFailed(tr("Changes could not be saved to the database."));
+
+        locker.relock();
+        if (committed)
+            m_committedSeq = seq;
+        if (failedSeq)
+            m_failedSeq = failedSeq;
+        m_doneSeq = seq;
+        m_committed.wakeAll();
+        auto it = std::stable_partition(m_callbacks.begin(), m_callbacks.end(), [seq] (const Callback &callback) {
+            return callback.seq > seq;
+        });
+        std::for_each(it, m_callbacks.end(), [] (Callback &callback) {
+            if (callback.context)
+                QMetaObject::invokeMethod(callback.context, callback.callback, Qt::QueuedConnection);
+        });
+        m_callbacks.erase(it, m_callbacks.end());
+    }
+    locker.unlock();
+    prepared.clear();
+    m_db.close();
+}
+
+DbWriter::Result DbWriter::execute(PreparedStatements &prepared, QSqlDatabase db, const std::vector<Statement> &statements)
+{
+    auto result = Result::Ok;
+    for (const auto &statement : statements)
+    {
+        bool ok;
+        QSqlError error;
+        // Statements without values have their ids built into the sql and are unlikely to repeat
+        if (statement.values.isEmpty())
+        {
+            QSqlQuery query(db);
+            ok = query.exec(statement.sql);
+            error = query.lastError();
+        }
+        else
+        {
+            auto query = prepared.get(statement.sql);
+            for (const auto &value : statement.values)
+                query->addBindValue(value);
+            ok = query->exec();
+            error = query->lastError();
+            query->finish();
+        }
+        if (ok)
+            continue;
+        // The whole batch is retried, there's no point in running the rest of it
+        if (isBusy(error))
+            return Result::Busy;
+        qCritical() << "DbWriter - error executing" << statement.sql << ":" << error;
+        result = Result::Failed;
+    }
+    return result;
+}
@@ -0,0 +1,90 @@
+#ifndef DBWRITER_H
+#define DBWRITER_H
+
+#include <QMutex>
+#include <QPointer>
+#include <QSqlDatabase>
+#include <QThread>
+#include <QVariantList>
+#include <QWaitCondition>
+#include "dbaccess.h"
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Performs the database writes that originate from the ui on a thread and
+// connection of its own, so the gui never waits for the disk during a show.
+// Writes queued within a short window share one transaction, which is retried
+// while another connection holds the write lock.  Before
+// startWriting() and after stopWriting() statements are executed right away on
+// the default connection instead, which is only valid from the gui thread.
+class DbWriter : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Statement
+    {
+        QString sql;
+        // Bound to the positional placeholders in order
+        QVariantList values;
+    };
+
+    explicit DbWriter(QObject *parent = nullptr) : QThread(parent) {}
+    ~DbWriter() override;
+    void startWriting(QSqlDatabase db);
+    // Commits everything still queued and stops the thread
+    void stopWriting();
+    void enqueue(const QString &sql, const QVariantList &values = QVariantList());
+    // The statements are committed together in a single transaction
+    void enqueue(std::vector<Statement> statements);
+    // Blocks until everything queued so far is committed, for reads that must see it.
+    // Returns false if any of those writes failed and were dropped.
+    bool waitForWrites();
+    // Runs callback on context's thread once everything queued so far is done with,
+    // whether it was committed or failed
+    void afterWrites(QObject *context, std::function<void()> callback);
+
+signals:
+    // Emitted from the writer thread when writes had to be dropped
+    void writeFailed(const QString &error);
+
+protected:
+    void run() override;
+
+private:
+    struct Pending
+    {
+        quint64 seq;
+        std::vector<Statement> statements;
+    };
+    struct Callback
+    {
+        quint64 seq;
+        QPointer<QObject> context;
+        std::function<void()> callback;
+    };
+
+    QSqlDatabase m_db;
+    QMutex m_mutex;
+    QWaitCondition m_queued;
+    QWaitCondition m_committed;
+    std::deque<Pending> m_pending;
+    std::vector<Callback> m_callbacks;
+    size_t m_pendingStatements{0};
+    quint64 m_queuedSeq{0};
+    // Last group that made it to the database
+    quint64 m_committedSeq{0};
+    // Last group that is done with, committed or dropped
+    quint64 m_doneSeq{0};
+    // Last group with a statement that failed or that was dropped with its batch
+    quint64 m_failedSeq{0};
+    bool m_running{false};
+    bool m_stopping{false};
+    bool m_flushRequested{false};
+
+    enum class Result { Ok, Failed, Busy };
+    static Result execute(PreparedStatements &prepared, QSqlDatabase db, const std::vector<Statement> &statements);
+};
+
+#endif // DBWRITER_H
@@ -0,0 +1,108 @@
+#include "dirmanifest.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariantList>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+bool DirManifest::statDir(const QString &dir, Entry &entry)
+{
+#ifdef Q_OS_UNIX
+    struct stat buf{};
+    if (::stat(QFile::encodeName(dir).constData(), &buf) != 0 || !S_ISDIR(buf.st_mode))
+        return false;
+#ifdef Q_OS_MACOS
+    entry.mtime = qint64(buf.st_mtimespec.tv_sec) * 1000000000 + buf.st_mtimespec.tv_nsec;
+#else
+    entry.mtime = qint64(buf.st_mtim.tv_sec) * 1000000000 + buf.st_mtim.tv_nsec;
+#endif
+    entry.size = qint64(buf.st_size);
+    entry.inode = quint64(buf.st_ino);
+    return true;
+#else
+    QFileInfo info(dir);
+    if (!info.isDir())
+        return false;
+    entry.mtime = info.lastModified().toMSecsSinceEpoch();
+    entry.size = info.size();
+    entry.inode = 0;
+    return true;
+#endif
+}
+
+void DirManifest::load(QSqlDatabase db)
+{
+    m_entries.clear();
+    m_parents.clear();
+    m_subdirs.clear();
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.exec("SELECT path, parent, mtime, size, inode FROM sourceDirManifest");
+    while (query.next())
+    {
+        const QString dir = query.value(0).toString();
+        insert(dir, query.value(1).toString(), Entry{query.value(2).toLongLong(), query.value(3).toLongLong(), quint64(query.value(4).toLongLong())});
+    }
+}
+
+void DirManifest::save(QSqlDatabase db, const QString &sourceDir) const
+{
+    QVariantList paths;
+    QVariantList sourceDirs;
+    QVariantList parents;
+    QVariantList mtimes;
+    QVariantList sizes;
+    QVariantList inodes;
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it)
+    {
+        paths.append(it.key());
+        sourceDirs.append(sourceDir);
+        parents.append(m_parents.value(it.key()));
+        mtimes.append(it.value().mtime);
+        sizes.append(it.value().size);
+        inodes.append(qint64(it.value().inode));
+    }
+    db.transaction();
+    remove(db, sourceDir);
+    QSqlQuery query(db);
+    query.prepare("INSERT OR REPLACE INTO sourceDirManifest (path, sourcedir, parent, mtime, size, inode) VALUES(:path, :sourcedir, :parent, :mtime, :size, :inode)");
+    query.bindValue(":path", paths);
+    query.bindValue(":sourcedir", sourceDirs);
+    query.bindValue(":parent", parents);
+    query.bindValue(":mtime", mtimes);
+    query.bindValue(":size", sizes);
+    query.bindValue(":inode", inodes);
+    if (!query.execBatch())
+        qInfo() << "Error saving directory manifest for " << sourceDir << ": " << query.lastError();
+    db.commit();
+}
+
+void DirManifest::remove(QSqlDatabase db, const QString &sourceDir)
+{
+    QSqlQuery query(db);
+    query.prepare("DELETE FROM sourceDirManifest WHERE sourcedir = :sourcedir");
+    query.bindValue(":sourcedir", sourceDir);
+    query.exec();
+}
+
+void DirManifest::insert(const QString &dir, const QString &parent, const Entry &entry)
+{
+    m_entries.insert(dir, entry);
+    if (parent.isEmpty())
+        return;
+    m_parents.insert(dir, parent);
+    m_subdirs[parent].append(dir);
+}
+
+bool DirManifest::isUnchanged(const QString &dir, const Entry &current) const
+{
+    auto it = m_entries.constFind(dir);
+    return it != m_entries.constEnd() && it.value() == current;
+}
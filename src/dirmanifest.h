@@ -0,0 +1,49 @@
+#ifndef DIRMANIFEST_H
+#define DIRMANIFEST_H
+
+#include <QHash>
+#include <QSqlDatabase>
+#include <QString>
+#include <QStringList>
+
+// Snapshot of the directory tree below the karaoke source dirs as of the last
+// completed scan.  A directory's mtime changes whenever an entry is added, removed
+// or renamed directly inside it, so a directory whose stat still matches the
+// manifest holds the same files and subdirectories as last time and a rescan can
+// skip listing it.
+class DirManifest
+{
+public:
+    struct Entry
+    {
+        qint64 mtime{0};
+        qint64 size{0};
+        quint64 inode{0};
+        bool operator==(const Entry &other) const
+        {
+            return mtime == other.mtime && size == other.size && inode == other.inode;
+        }
+        bool operator!=(const Entry &other) const { return !(*this == other); }
+    };
+
+    static bool statDir(const QString &dir, Entry &entry);
+    // Loads the manifests of all source dirs
+    void load(QSqlDatabase db);
+    // Replaces the stored manifest of sourceDir with this one
+    void save(QSqlDatabase db, const QString &sourceDir) const;
+    static void remove(QSqlDatabase db, const QString &sourceDir);
+    void insert(const QString &dir, const QString &parent, const Entry &entry);
+    [[nodiscard]] bool isUnchanged(const QString &dir, const Entry &current) const;
+    [[nodiscard]] bool contains(const QString &dir) const { return m_entries.contains(dir); }
+    [[nodiscard]] QStringList subdirs(const QString &dir) const { return m_subdirs.value(dir); }
+    [[nodiscard]] QStringList dirs() const { return m_entries.keys(); }
+    [[nodiscard]] bool isEmpty() const { return m_entries.isEmpty(); }
+    [[nodiscard]] int size() const { return m_entries.size(); }
+
+private:
+    QHash<QString, Entry> m_entries;
+    QHash<QString, QString> m_parents;
+    QHash<QString, QStringList> m_subdirs;
+};
+
+#endif // DIRMANIFEST_H
@@ -26,11 +26,14 @@
 #include <QSqlQuery>
 #include <QMessageBox>
 #include "dbupdatethread.h"
+#include "dbwriter.h"
+#include "dirmanifest.h"
 #include "settings.h"
 #include <QStandardPaths>
 #include <QFileSystemWatcher>
 
 extern Settings settings;
+extern DbWriter dbWriter;
 
 DlgDatabase::DlgDatabase(QSqlDatabase db, QWidget *parent) :
     QDialog(parent),
@@ -46,8 +49,15 @@ DlgDatabase::DlgDatabase(QSqlDatabase db, QWidget *parent) :
     selectedRow = -1;
     customPatternsDlg = new DlgCustomPatterns(this);
     dbUpdateDlg = new DlgDbUpdate(this);
+    liveScanTimer.setSingleShot(true);
+    liveScanTimer.setInterval(2000);
+    connect(&liveScanTimer, &QTimer::timeout, this, &DlgDatabase::startLiveScan);
     if (settings.dbDirectoryWatchEnabled())
     {
+        // The manifest of the last scan already lists every directory, only walk the tree if there is none yet
+        DirManifest manifest;
+        manifest.load(db);
+        QStringList dirs = manifest.dirs();
         QStringList sourceDirs = sourcedirmodel->getSourceDirs();
         QString path;
         foreach (path, sourceDirs)
@@ -55,24 +65,29 @@ DlgDatabase::DlgDatabase(QSqlDatabase db, QWidget *parent) :
             QFileInfo finfo(path);
             if (finfo.isDir() && finfo.isReadable())
             {
-                fsWatcher.addPath(path);
+                dirs.append(path);
                 qInfo() << "Adding watch to path: " << path;
+                if (!manifest.isEmpty())
+                    continue;
                 QDirIterator it(path, QDirIterator::Subdirectories);
                 while (it.hasNext()) {
                     QString subPath = it.next();
                     if (!it.fileInfo().isDir() || subPath.endsWith("/.") || subPath.endsWith("/.."))
                         continue;
-                    qInfo() << "Adding watch to subpath: " << subPath;
-                    fsWatcher.addPath(subPath);
+                    dirs.append(subPath);
                 }
             }
         }
+        watchDirs(dirs);
+        qInfo() << "Watching " << fsWatcher.directories().size() << " directories for changes";
         connect(&fsWatcher, SIGNAL(directoryChanged(QString)), this, SLOT(directoryChanged(QString)));
     }
 }
 
 DlgDatabase::~DlgDatabase()
 {
+    if (liveScanThread)
+        liveScanThread->wait();
     fsWatcher.removePaths(fsWatcher.directories());
     delete sourcedirmodel;
     delete ui;
@@ -183,7 +198,9 @@ void DlgDatabase::on_buttonUpdate_clicked()
         updateThread->setPath(sourcedirmodel->getDirByIndex(selectedRow).getPath());
         updateThread->setPattern(sourcedirmodel->getDirByIndex(selectedRow).getPattern());
         QApplication::processEvents();
+        beginManualScan();
         updateThread->startUnthreaded();
+        endManualScan();
 //        while (updateThread->isRunning())
 //        {
 //            QApplication::processEvents();
@@ -215,6 +232,7 @@ void DlgDatabase::on_buttonUpdateAll_clicked()
     //msgBox.setStandardButtons(0);
     //msgBox.setText("Updating Database, please wait...");
     //msgBox.show();
+    beginManualScan();
     for (int i=0; i < sourcedirmodel->size(); i++)
     {
         //msgBox.setInformativeText("Processing path: " + sourcedirmodel->getDirByIndex(i)->getPath());
@@ -227,6 +245,7 @@ void DlgDatabase::on_buttonUpdateAll_clicked()
 //            QApplication::processEvents();
 //        }
     }
+    endManualScan();
 //    msgBox.setInformativeText("Reloading song database into cache");
     emit databaseUpdateComplete();
 //    msgBox.hide();
@@ -247,8 +266,10 @@ void DlgDatabase::on_btnClearDatabase_clicked()
     QPushButton *yesButton = msgBox.addButton(QMessageBox::Yes);
     msgBox.exec();
     if (msgBox.clickedButton() == yesButton) {
+        dbWriter.waitForWrites();
         QSqlQuery query;
         query.exec("DELETE FROM dbSongs");
+        query.exec("DELETE FROM sourceDirManifest");
         query.exec("DELETE FROM regularsongs");
         query.exec("DELETE FROM regularsingers");
         query.exec("DELETE FROM queuesongs");
@@ -313,29 +334,104 @@ void DlgDatabase::directoryChanged(QString dirPath)
 {
     if (!settings.dbDirectoryWatchEnabled())
         return;
-    DbUpdateThread *dbthread = new DbUpdateThread(db, this);
     qInfo() << "Directory changed fired for dir: " << dirPath;
-    QDirIterator it(dirPath);
-    while (it.hasNext()) {
-        QString file = it.next();
-        QFileInfo fi(file);
-        if (fi.isDir())
-            continue;
-        if (file == dirPath + "/." || file == dirPath + "/..")
-            continue;
-        if (fi.suffix().toLower() != "zip" && fi.suffix().toLower() != "cdg")
+    // Changes usually come in bursts while files are copied, collect them per source dir
+    // and pick them all up with one incremental rescan once things settle down
+    QStringList sourceDirs = sourcedirmodel->getSourceDirs();
+    QString sourceDir;
+    foreach (sourceDir, sourceDirs)
+    {
+        if (dirPath == sourceDir || dirPath.startsWith(sourceDir + "/"))
         {
-            continue;
+            liveScanPending.insert(sourceDir);
+            liveScanTimer.start();
+            return;
         }
-        if (dbthread->dbEntryExists(file))
+    }
+}
+
+void DlgDatabase::watchDirs(const QStringList &dirs)
+{
+    QSet<QString> watched;
+    for (const auto &dir : fsWatcher.directories())
+        watched.insert(dir);
+    QStringList newDirs;
+    for (const auto &dir : dirs)
+    {
+        if (!watched.contains(dir))
         {
-            continue;
+            watched.insert(dir);
+            newDirs.append(dir);
         }
-        qInfo() << "Detected new file: " << file;
-        qInfo() << "Adding file to the database";
-        dbthread->addSingleTrack(file);
-        emit databaseUpdateComplete();
     }
-    delete(dbthread);
+    if (!newDirs.isEmpty())
+        fsWatcher.addPaths(newDirs);
+}
+
+void DlgDatabase::beginManualScan()
+{
+    manualScanRunning = true;
+    if (!liveScanThread)
+        return;
+    // Let a live rescan that is already underway finish first, two scans must not write the song tables at once
+    qInfo() << "Waiting for the live rescan to finish before updating";
+    disconnect(liveScanThread, &QThread::finished, this, &DlgDatabase::liveScanFinished);
+    liveScanThread->wait();
+    liveScanFinished();
+}
+
+void DlgDatabase::endManualScan()
+{
+    manualScanRunning = false;
+    if (!liveScanPending.isEmpty())
+        liveScanTimer.start();
+}
+
+void DlgDatabase::startLiveScan()
+{
+    if (manualScanRunning || liveScanThread || liveScanPending.isEmpty())
+        return;
+    const QString sourceDir = *liveScanPending.begin();
+    liveScanPending.erase(liveScanPending.begin());
+    for (int i=0; i < sourcedirmodel->size(); i++)
+    {
+        if (sourcedirmodel->getDirByIndex(i).getPath() != sourceDir)
+            continue;
+        qInfo() << "Starting live rescan of " << sourceDir;
+        // One connection serves every live rescan, the thread opens and closes it
+        if (!QSqlDatabase::contains("livescandb"))
+            QSqlDatabase::cloneDatabase(QSqlDatabase::database(), "livescandb");
+        liveScanThread = new DbUpdateThread(QSqlDatabase::database("livescandb", false), this);
+        liveScanThread->setIncremental(true);
+        liveScanThread->setPath(sourceDir);
+        liveScanThread->setPattern(sourcedirmodel->getDirByIndex(i).getPattern());
+        connect(liveScanThread, &QThread::finished, this, &DlgDatabase::liveScanFinished);
+        liveScanThread->start();
+        return;
+    }
+}
 
+void DlgDatabase::liveScanFinished()
+{
+    // A finished signal that was already queued when beginManualScan() took the thread over
+    if (!liveScanThread)
+        return;
+    qInfo() << "Live rescan finished";
+    // Start watching any directories created since the last scan
+    watchDirs(liveScanThread->scannedDirs());
+    QStringList errors = liveScanThread->getErrors();
+    QString error;
+    foreach (error, errors)
+        qInfo() << "Live rescan skipped file: " << error;
+    const QStringList missing = liveScanThread->missingFiles();
+    liveScanThread->deleteLater();
+    liveScanThread = nullptr;
+    emit databaseUpdateComplete();
+    if (!missing.isEmpty())
+    {
+        qInfo() << "Live rescan found " << missing.size() << " songs missing from disk";
+        emit songsMissing(missing);
+    }
+    if (!liveScanPending.isEmpty() && !manualScanRunning)
+        liveScanTimer.start();
 }
@@ -29,11 +29,15 @@
 #include <QSqlDatabase>
 #include "dlgdbupdate.h"
 #include <QFileSystemWatcher>
+#include <QSet>
+#include <QTimer>
 
 namespace Ui {
 class DlgDatabase;
 }
 
+class DbUpdateThread;
+
 class DlgDatabase : public QDialog
 {
     Q_OBJECT
@@ -46,6 +50,15 @@ private:
     int selectedRow;
     QSqlDatabase db;
     QFileSystemWatcher fsWatcher;
+    // Source dirs with changes waiting for a live rescan
+    QSet<QString> liveScanPending;
+    QTimer liveScanTimer;
+    DbUpdateThread *liveScanThread{nullptr};
+    // Live rescans hold off while an update started from the dialog runs on the gui connection
+    bool manualScanRunning{false};
+    void watchDirs(const QStringList &dirs);
+    void beginManualScan();
+    void endManualScan();
 
 public:
     explicit DlgDatabase(QSqlDatabase db, QWidget *parent = 0);
@@ -56,6 +69,8 @@ signals:
     void databaseUpdateComplete();
     void databaseCleared();
     void databaseSongAdded();
+    // Songs deleted from disk while the app runs, they stay in the database
+    void songsMissing(const QStringList &paths);
 
 public slots:
     void singleSongAdd(const QString &path);
@@ -74,6 +89,8 @@ private slots:
     void on_btnCustomPatterns_clicked();
     void on_btnExport_clicked();
     void directoryChanged(QString dirPath);
+    void startLiveScan();
+    void liveScanFinished();
 };
 
 #endif // DATABASEDIALOG_H
@@ -62,6 +62,8 @@ DlgSettings::DlgSettings(MediaBackend *AudioBackend, MediaBackend *BmAudioBacken
     ui->groupBoxShowDuration->setChecked(settings.cdgRemainEnabled());
     ui->cbxRotShowNextSong->setChecked(settings.rotationShowNextSong());
     ui->checkBoxCdgPrescaling->setChecked(settings.cdgPrescalingEnabled());
+    ui->checkBoxSoftwareSinkScaling->setChecked(settings.videoScaleInSoftwareSink());
+    ui->checkBoxSoftwareSinkScaling->setEnabled(!settings.hardwareAccelEnabled());
     ui->checkBoxCurrentSingerTop->setChecked(settings.rotationAltSortOrder());
     audioOutputDevices = kAudioBackend->getOutputDevices();
     ui->comboBoxKAudioDevices->addItems(audioOutputDevices);
@@ -874,6 +876,7 @@ void DlgSettings::on_lineEditTickerMessage_returnPressed() {
 }
 
 void DlgSettings::on_checkBoxHardwareAccel_toggled(bool checked) {
+    ui->checkBoxSoftwareSinkScaling->setEnabled(!checked);
     if (!m_pageSetupDone)
         return;
     settings.setHardwareAccelEnabled(checked);
@@ -888,6 +891,12 @@ void DlgSettings::on_checkBoxCdgPrescaling_stateChanged(int arg1) {
         settings.setCdgPrescalingEnabled(true);
 }
 
+void DlgSettings::on_checkBoxSoftwareSinkScaling_toggled(bool checked) {
+    if (!m_pageSetupDone)
+        return;
+    settings.setVideoScaleInSoftwareSink(checked);
+}
+
 void DlgSettings::on_checkBoxCurrentSingerTop_toggled(bool checked) {
     if (!m_pageSetupDone)
         return;
@@ -27,20 +27,15 @@ DlgVideoPreview::DlgVideoPreview(const QString &mediaFilePath, QWidget *parent)
         {
             if (archive.checkAudio())
             {
-                if (!archive.extractAudio(tmpDir.path(), "tmp" + archive.audioExtension()))
-                {
-                    // We're not gonna use it, but we extract it just to catch bad files during preview
-                    QMessageBox::warning(this, tr("Bad karaoke file"), tr("Failed to extract audio file."),QMessageBox::Ok);
-                    return;
-                }
-                if (!archive.extractCdg(tmpDir.path(), "tmp.cdg"))
+                // The preview is silent, only the cdg is decompressed (in memory)
+                QByteArray cdgData = archive.getCDGData();
+                if (cdgData.isEmpty())
                 {
                     QMessageBox::warning(this, tr("Bad karaoke file"), tr("Failed to extract CDG file."),QMessageBox::Ok);
                     return;
                 }
-                playCdg(tmpDir.path() + QDir::separator() + "tmp.cdg");
-                //m_mediaBackend.setMediaCdg(tmpDir.path() + QDir::separator() + "tmp.cdg", tmpDir.path() + QDir::separator() + "tmp" + archive.audioExtension());
-                //m_mediaBackend.play();
+                m_mediaBackend.setMediaCdg(m_mediaFilename, cdgData, QByteArray());
+                m_mediaBackend.play();
             }
         }
         else
@@ -51,7 +46,6 @@ DlgVideoPreview::DlgVideoPreview(const QString &mediaFilePath, QWidget *parent)
     }
     else if (m_mediaFilename.endsWith(".cdg", Qt::CaseInsensitive))
     {
-        QString cdgTmpFile = "tmp.cdg";
         QFile cdgFile(m_mediaFilename);
         if (!cdgFile.exists())
         {
@@ -75,8 +69,7 @@ DlgVideoPreview::DlgVideoPreview(const QString &mediaFilePath, QWidget *parent)
             QMessageBox::warning(this, tr("Bad karaoke file"), tr("Audio file contains no data"),QMessageBox::Ok);
             return;
         }
-        cdgFile.copy(tmpDir.path() + QDir::separator() + "tmp.cdg");
-        playCdg(tmpDir.path() + QDir::separator() + "tmp.cdg");
+        playCdg(m_mediaFilename);
 
     }
     else
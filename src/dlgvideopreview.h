@@ -2,7 +2,6 @@
 #define DLGVIDEOPREVIEW_H
 
 #include <QDialog>
-#include <QTemporaryDir>
 #include <mediabackend.h>
 #include <gst/gst.h>
 
@@ -22,7 +21,6 @@ private:
     Ui::DlgVideoPreview *ui;
     MediaBackend m_mediaBackend { this, "PREVIEW", MediaBackend::VideoPreview };
     QString m_mediaFilename;
-    QTemporaryDir tmpDir;
     guint64 position{0};
     void playCdg(const QString &filename);
     void playVideo(const QString &filename);
@@ -5,7 +5,34 @@
 #include <QDebug>
 #include "mzarchive.h"
 #include "karaokefileinfo.h"
+#include "dbaccess.h"
+#include "dbwriter.h"
 
+extern DbWriter dbWriter;
+
+QStringList LazyDurationUpdateWorker::getSongsRequiringUpdate()
+{
+    qInfo() << "Finding songs that need durations";
+    QStringList files;
+    if (!DbAccess::open(database))
+        return files;
+    {
+        QSqlQuery query(database);
+        query.exec("SELECT path FROM dbsongs WHERE duration < 1 ORDER BY artist, title");
+        while (query.next())
+        {
+            files.append(query.value(0).toString());
+        }
+    }
+    database.close();
+    qInfo() << "Done, found " << files.size() << " songs that need durations";
+    return files;
+}
+
+void LazyDurationUpdateWorker::updateDurations()
+{
+    getDurations(getSongsRequiringUpdate());
+}
 
 void LazyDurationUpdateWorker::getDurations(const QStringList files) {
     MzArchive archive;
@@ -32,11 +59,11 @@ void LazyDurationUpdateWorker::getDurations(const QStringList files) {
 }
 
 LazyDurationUpdateController::LazyDurationUpdateController(QObject *parent) : QObject(parent) {
-    LazyDurationUpdateWorker *worker = new LazyDurationUpdateWorker;
+    LazyDurationUpdateWorker *worker = new LazyDurationUpdateWorker(DbAccess::readOnlyClone("durationupdater"));
     workerThread.setObjectName("DurationUpdater");
     worker->moveToThread(&workerThread);
     connect(&workerThread, &QThread::finished, worker, &QObject::deleteLater);
-    connect(this, &LazyDurationUpdateController::operate, worker, &LazyDurationUpdateWorker::getDurations);
+    connect(this, &LazyDurationUpdateController::operate, worker, &LazyDurationUpdateWorker::updateDurations);
     connect(worker, &LazyDurationUpdateWorker::gotDuration, this, &LazyDurationUpdateController::updateDbDuration);
     workerThread.start();
     //getDurations();
@@ -47,20 +74,6 @@ LazyDurationUpdateController::~LazyDurationUpdateController() {
     workerThread.wait();
 }
 
-void LazyDurationUpdateController::getSongsRequiringUpdate()
-{
-    qInfo() << "Finding songs that need durations";
-    files.clear();
-    QSqlQuery query;
-    query.exec("SELECT path FROM dbsongs WHERE duration < 1 ORDER BY artist, title");
-    files.reserve(query.size());
-    while (query.next())
-    {
-        files.append(query.value(0).toString());
-    }
-    qInfo() << "Done, found " << files.size() << " songs that need durations";
-}
-
 void LazyDurationUpdateController::stopWork()
 {
     qInfo() << "LazyDurationUpdateController stoWork() called";
@@ -69,16 +82,11 @@ void LazyDurationUpdateController::stopWork()
 
 void LazyDurationUpdateController::updateDbDuration(QString file, int duration)
 {
-    QSqlQuery query;
-    query.prepare("UPDATE dbsongs SET duration = :duration WHERE path = :path");
-    query.bindValue(":path", file);
-    query.bindValue(":duration", duration);
-    query.exec();
+    dbWriter.enqueue("UPDATE dbsongs SET duration = ? WHERE path = ?", {duration, file});
     emit gotDuration(file, duration);
 }
 
 void LazyDurationUpdateController::getDurations()
 {
-    getSongsRequiringUpdate();
-    emit operate(files);
+    emit operate();
 }
@@ -2,12 +2,19 @@
 #define DURATIONLAZYUPDATER_H
 
 #include <QObject>
+#include <QSqlDatabase>
 #include <QThread>
 
 class LazyDurationUpdateWorker : public QObject
 {
     Q_OBJECT
+    // Read-only, so the search for songs without a duration never holds up the gui's writes
+    QSqlDatabase database;
+public:
+    explicit LazyDurationUpdateWorker(QSqlDatabase db) : database(db) {}
+    QStringList getSongsRequiringUpdate();
 public slots:
+    void updateDurations();
     void getDurations(const QStringList files);
 signals:
     void gotDuration(QString, int);
@@ -18,17 +25,15 @@ class LazyDurationUpdateController : public QObject
 {
     Q_OBJECT
     QThread workerThread;
-    QStringList files;
 public:
     LazyDurationUpdateController(QObject *parent = 0);
     ~LazyDurationUpdateController();
-    void getSongsRequiringUpdate();
     void stopWork();
 public slots:
     void updateDbDuration(QString file, int duration);
     void getDurations();
 signals:
-    void operate(const QStringList);
+    void operate();
     void gotDuration(QString &path, int duration);
     void gotStopWork();
 };
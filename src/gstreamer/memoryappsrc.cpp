@@ -0,0 +1,131 @@
+#include "memoryappsrc.h"
+#include <QDebug>
+#include <algorithm>
+
+constexpr guint MIN_CHUNK_SIZE = 64 * 1024;
+
+void MemoryAppSrc::setData(const QByteArray &data)
+{
+    QMutexLocker locker(&m_dataLock);
+    m_stream.reset();
+    m_data = data;
+    m_streamed = m_data.size();
+    m_offset = 0;
+}
+
+void MemoryAppSrc::setStream(std::unique_ptr<QIODevice> stream)
+{
+    QMutexLocker locker(&m_dataLock);
+    m_data = QByteArray(int(stream->size()), Qt::Uninitialized);
+    m_stream = std::move(stream);
+    m_streamed = 0;
+    m_offset = 0;
+}
+
+void MemoryAppSrc::fillTo(qint64 end)
+{
+    while (m_stream && m_streamed < end)
+    {
+        const auto bytesRead = m_stream->read(m_data.data() + m_streamed, end - m_streamed);
+        if (bytesRead <= 0)
+        {
+            // Play what made it in, the stream ends early instead of the pipeline erroring out
+            qWarning() << "Media stream ended after" << m_streamed << "of" << m_data.size() << "bytes";
+            m_data.resize(int(m_streamed));
+            break;
+        }
+        m_streamed += bytesRead;
+    }
+    if (m_streamed >= m_data.size())
+        m_stream.reset();
+}
+
+void MemoryAppSrc::clear()
+{
+    setData(QByteArray());
+}
+
+bool MemoryAppSrc::isEmpty()
+{
+    QMutexLocker locker(&m_dataLock);
+    return m_data.isEmpty();
+}
+
+void MemoryAppSrc::attach(GstAppSrc *appsrc)
+{
+    QMutexLocker locker(&m_dataLock);
+    m_offset = 0;
+    // A streamed file is pushed from the start, in pull mode the demuxers would read its
+    // end first (id3v1 tags and such) and have it all read before playback starts
+    auto streamType = m_stream ? GST_APP_STREAM_TYPE_SEEKABLE : GST_APP_STREAM_TYPE_RANDOM_ACCESS;
+    g_object_set(appsrc, "stream-type", streamType, "format", GST_FORMAT_BYTES, NULL);
+    gst_app_src_set_size(appsrc, m_data.size());
+
+    GstAppSrcCallbacks callbacks {};
+    callbacks.need_data = &MemoryAppSrc::cb_need_data;
+    callbacks.seek_data = &MemoryAppSrc::cb_seek_data;
+    gst_app_src_set_callbacks(appsrc, &callbacks, this, nullptr);
+}
+
+void MemoryAppSrc::cb_need_data(GstAppSrc *appsrc, guint length, gpointer user_data)
+{
+    auto instance = reinterpret_cast<MemoryAppSrc *>(user_data);
+
+    QMutexLocker locker(&instance->m_dataLock);
+    if (instance->m_stream)
+    {
+        const auto wanted = instance->m_offset + std::max(length, MIN_CHUNK_SIZE);
+        instance->fillTo(qint64(std::min<guint64>(wanted, guint64(instance->m_data.size()))));
+    }
+    const auto size = guint64(instance->m_data.size());
+    if (instance->m_offset >= size)
+    {
+        gst_app_src_end_of_stream(appsrc);
+        return;
+    }
+
+    const auto chunkSize = std::min<guint64>(std::max(length, MIN_CHUNK_SIZE), size - instance->m_offset);
+    GstBuffer *buffer;
+    if (instance->m_stream)
+    {
+        // Sharing m_data now would make the next read into it detach a copy of the whole thing
+        buffer = gst_buffer_new_allocate(nullptr, chunkSize, nullptr);
+        gst_buffer_fill(buffer, 0, instance->m_data.constData() + instance->m_offset, chunkSize);
+    }
+    else
+    {
+        // The buffer holds its own reference to the data so it stays valid even if
+        // setData() is called while the buffer is still queued downstream.
+        buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+                                             const_cast<char *>(instance->m_data.constData()),
+                                             size,
+                                             instance->m_offset,
+                                             chunkSize,
+                                             new QByteArray(instance->m_data),
+                                             &MemoryAppSrc::releaseData);
+    }
+    GST_BUFFER_OFFSET(buffer) = instance->m_offset;
+    GST_BUFFER_OFFSET_END(buffer) = instance->m_offset + chunkSize;
+    instance->m_offset += chunkSize;
+    locker.unlock();
+
+    auto rc = gst_app_src_push_buffer(appsrc, buffer);
+    if (rc != GST_FLOW_OK && rc != GST_FLOW_FLUSHING)
+        qWarning() << "push buffer returned non-OK status: " << rc;
+}
+
+gboolean MemoryAppSrc::cb_seek_data([[maybe_unused]]GstAppSrc *appsrc, guint64 offset, gpointer user_data)
+{
+    auto instance = reinterpret_cast<MemoryAppSrc *>(user_data);
+
+    QMutexLocker locker(&instance->m_dataLock);
+    if (offset > guint64(instance->m_data.size()))
+        return false;
+    instance->m_offset = offset;
+    return true;
+}
+
+void MemoryAppSrc::releaseData(gpointer data)
+{
+    delete static_cast<QByteArray *>(data);
+}
@@ -0,0 +1,54 @@
+#ifndef MEMORYAPPSRC_H
+#define MEMORYAPPSRC_H
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <QByteArray>
+#include <QIODevice>
+#include <QMutex>
+#include <memory>
+
+/**
+ * Feeds a media file held in memory, e.g. an audio track decompressed straight
+ * out of a zip archive, to an appsrc as a random access byte stream.
+ * Buffers wrap the data without copying it and keep it alive until they are freed.
+ *
+ * With setStream() the data is read from a device as the pipeline asks for it
+ * and kept, so seeking back doesn't have to read it again.  Until the device
+ * is exhausted buffers hold copies of the chunks, the data is still being
+ * written to.
+ */
+class MemoryAppSrc
+{
+
+private:
+    QByteArray m_data;
+    guint64 m_offset { 0 };
+    QMutex m_dataLock;
+    // Device the tail of m_data still has to be read from, m_streamed bytes are in already
+    std::unique_ptr<QIODevice> m_stream;
+    qint64 m_streamed { 0 };
+
+    // Reads from the device until at least the first end bytes of m_data are in
+    void fillTo(qint64 end);
+
+    // AppSrc callbacks
+    static void cb_need_data(GstAppSrc *appsrc, guint length, gpointer user_data);
+    static gboolean cb_seek_data(GstAppSrc *appsrc, guint64 offset, gpointer user_data);
+    static void releaseData(gpointer data);
+
+public:
+    void setData(const QByteArray &data);
+    // stream has to be open already and know its size
+    void setStream(std::unique_ptr<QIODevice> stream);
+    void clear();
+    bool isEmpty();
+
+    /**
+     * Configures appsrc, usually handed out by uridecodebin's "source-setup"
+     * signal for an "appsrc://" uri, to read from the current data.
+     */
+    void attach(GstAppSrc *appsrc);
+};
+
+#endif // MEMORYAPPSRC_H
@@ -0,0 +1,211 @@
+#include "videofanout.h"
+#include <gst/video/video.h>
+#include <QDebug>
+#include <algorithm>
+
+// Previews are downsampled by at most 2^MAX_MIP_LEVEL in each direction
+constexpr int MAX_MIP_LEVEL = 3;
+constexpr qint64 STATS_INTERVAL_MS = 30000;
+
+void VideoFanout::build(GstBin *bin, GstElement *src)
+{
+    m_bin = bin;
+    m_convert = gst_element_factory_make("videoconvert", "fanoutConvert");
+    m_nativeTee = gst_element_factory_make("tee", "fanoutNativeTee");
+    gst_bin_add_many(m_bin, m_convert, m_nativeTee, nullptr);
+    gst_element_link_many(src, m_convert, m_nativeTee, nullptr);
+
+    auto pad = gst_element_get_static_pad(m_convert, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, &VideoFanout::entryProbe_cb, this, nullptr);
+    gst_object_unref(pad);
+
+    m_convertStats = addStats("conversion");
+    timeStage(m_convert, m_nativeTee, m_convertStats);
+    m_statsTimer.start();
+}
+
+void VideoFanout::addOutput(const QString &name, GstElement *first, GstElement *last, bool preview)
+{
+    if (preview && !m_previewTee)
+        buildPreviewBranch();
+
+    auto queue = gst_element_factory_make("queue", QString("fanoutQueue%1").arg(++m_outputCount).toLocal8Bit());
+    gst_bin_add(m_bin, queue);
+    gst_element_link_many(preview ? m_previewTee : m_nativeTee, queue, first, nullptr);
+
+    auto stats = addStats(preview ? name + " (preview)" : name);
+    auto pad = gst_element_get_static_pad(last, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, &VideoFanout::sinkProbe_cb, stats, nullptr);
+    gst_object_unref(pad);
+    if (first != last)
+        timeStage(first, last, stats);
+}
+
+void VideoFanout::setPreviewTargetSize(const QSize &size)
+{
+    m_previewTargetWidth = size.width();
+    m_previewTargetHeight = size.height();
+}
+
+void VideoFanout::logStats(const QString &objName)
+{
+    if (m_statsTimer.elapsed() < STATS_INTERVAL_MS)
+        return;
+    m_statsTimer.restart();
+
+    for (auto &stats : m_stats)
+    {
+        auto frames = stats->frames.exchange(0);
+        auto latencyUsSum = stats->latencyUsSum.exchange(0);
+        auto latencyUsMax = stats->latencyUsMax.exchange(0);
+        auto scaledFrames = stats->scaledFrames.exchange(0);
+        auto scaleUsSum = stats->scaleUsSum.exchange(0);
+        if (frames == 0 && scaledFrames == 0)
+            continue;
+
+        auto log = qInfo();
+        log << objName << "- video" << stats->name << "-";
+        if (frames > 0)
+            log << frames << "frames, latency avg:" << latencyUsSum / frames / 1000.0 << "ms max:" << latencyUsMax / 1000.0 << "ms";
+        if (scaledFrames > 0)
+            log << "processing:" << scaleUsSum / scaledFrames << "us/frame";
+    }
+}
+
+VideoFanout::Stats *VideoFanout::addStats(const QString &name)
+{
+    m_stats.push_back(std::make_unique<Stats>());
+    auto stats = m_stats.back().get();
+    stats->name = name;
+    stats->fanout = this;
+    return stats;
+}
+
+void VideoFanout::buildPreviewBranch()
+{
+    auto queue = gst_element_factory_make("queue", "fanoutPreviewQueue");
+    m_previewScale = gst_element_factory_make("videoscale", "fanoutPreviewScale");
+    m_previewCapsFilter = gst_element_factory_make("capsfilter", "fanoutPreviewCapsFilter");
+    m_previewTee = gst_element_factory_make("tee", "fanoutPreviewTee");
+    gst_bin_add_many(m_bin, queue, m_previewScale, m_previewCapsFilter, m_previewTee, nullptr);
+    gst_element_link_many(m_nativeTee, queue, m_previewScale, m_previewCapsFilter, m_previewTee, nullptr);
+
+    // The mip level depends on the size of the incoming frames, pick it whenever that changes
+    auto pad = gst_element_get_static_pad(m_previewScale, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, &VideoFanout::previewCapsProbe_cb, this, nullptr);
+    gst_object_unref(pad);
+
+    m_previewStats = addStats("preview mip level");
+    timeStage(m_previewScale, m_previewTee, m_previewStats);
+}
+
+void VideoFanout::timeStage(GstElement *first, GstElement *end, Stats *stats)
+{
+    // All elements of a stage process a buffer synchronously on the same streaming thread,
+    // so the time between entering the first and reaching the end is the cpu time spent on it
+    auto pad = gst_element_get_static_pad(first, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, &VideoFanout::stageStartProbe_cb, stats, nullptr);
+    gst_object_unref(pad);
+    pad = gst_element_get_static_pad(end, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, &VideoFanout::stageEndProbe_cb, stats, nullptr);
+    gst_object_unref(pad);
+}
+
+void VideoFanout::recordEntry(GstClockTime pts)
+{
+    QMutexLocker locker(&m_entryLock);
+    m_entryTimes[m_nextEntry] = {pts, g_get_monotonic_time()};
+    m_nextEntry = (m_nextEntry + 1) % m_entryTimes.size();
+}
+
+gint64 VideoFanout::entryTime(GstClockTime pts)
+{
+    QMutexLocker locker(&m_entryLock);
+    auto it = std::find_if(m_entryTimes.begin(), m_entryTimes.end(), [pts] (const auto &entry) { return entry.first == pts; });
+    return it == m_entryTimes.end() ? -1 : it->second;
+}
+
+GstPadProbeReturn VideoFanout::entryProbe_cb([[maybe_unused]]GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    auto pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    if (GST_CLOCK_TIME_IS_VALID(pts))
+        reinterpret_cast<VideoFanout *>(user_data)->recordEntry(pts);
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn VideoFanout::sinkProbe_cb([[maybe_unused]]GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    auto stats = reinterpret_cast<Stats *>(user_data);
+    auto pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    if (!GST_CLOCK_TIME_IS_VALID(pts))
+        return GST_PAD_PROBE_OK;
+    auto entered = stats->fanout->entryTime(pts);
+    if (entered < 0)
+        return GST_PAD_PROBE_OK;
+
+    gint64 latency = g_get_monotonic_time() - entered;
+    stats->frames++;
+    stats->latencyUsSum += latency;
+    auto max = stats->latencyUsMax.load();
+    while (latency > max && !stats->latencyUsMax.compare_exchange_weak(max, latency)) {}
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn VideoFanout::stageStartProbe_cb([[maybe_unused]]GstPad *pad, [[maybe_unused]]GstPadProbeInfo *info, gpointer user_data)
+{
+    reinterpret_cast<Stats *>(user_data)->stageStartUs = g_get_monotonic_time();
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn VideoFanout::stageEndProbe_cb([[maybe_unused]]GstPad *pad, [[maybe_unused]]GstPadProbeInfo *info, gpointer user_data)
+{
+    auto stats = reinterpret_cast<Stats *>(user_data);
+    if (stats->stageStartUs == 0)
+        return GST_PAD_PROBE_OK;
+    stats->scaleUsSum += g_get_monotonic_time() - stats->stageStartUs;
+    stats->scaledFrames++;
+    stats->stageStartUs = 0;
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn VideoFanout::previewCapsProbe_cb([[maybe_unused]]GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    auto event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CAPS)
+        return GST_PAD_PROBE_OK;
+
+    auto instance = reinterpret_cast<VideoFanout *>(user_data);
+    GstCaps *caps = nullptr;
+    gst_event_parse_caps(event, &caps);
+    GstVideoInfo videoInfo;
+    if (!gst_video_info_from_caps(&videoInfo, caps))
+        return GST_PAD_PROBE_OK;
+
+    // Smallest power of two reduction that still covers the largest preview
+    const int targetWidth = instance->m_previewTargetWidth;
+    const int targetHeight = instance->m_previewTargetHeight;
+    int level = 0;
+    if (targetWidth > 0 && targetHeight > 0)
+    {
+        while (level < MAX_MIP_LEVEL &&
+               (videoInfo.width >> (level + 1)) >= targetWidth &&
+               (videoInfo.height >> (level + 1)) >= targetHeight)
+        {
+            level++;
+        }
+    }
+
+    const int width = std::max(1, videoInfo.width >> level);
+    const int height = std::max(1, videoInfo.height >> level);
+    auto filterCaps = gst_caps_new_simple(
+                "video/x-raw",
+                "width", G_TYPE_INT, width,
+                "height", G_TYPE_INT, height,
+                "pixel-aspect-ratio", GST_TYPE_FRACTION, videoInfo.par_n, videoInfo.par_d,
+                NULL);
+    g_object_set(instance->m_previewCapsFilter, "caps", filterCaps, nullptr);
+    gst_caps_unref(filterCaps);
+    qDebug() << "Video preview mip level" << level << "-" << videoInfo.width << "x" << videoInfo.height << "->" << width << "x" << height;
+
+    return GST_PAD_PROBE_OK;
+}
@@ -0,0 +1,93 @@
+#ifndef VIDEOFANOUT_H
+#define VIDEOFANOUT_H
+
+#include <gst/gst.h>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * Distributes the decoded video to all output sinks of a media backend.
+ *
+ * Frames are converted once, then handed to every display output at their native
+ * size through a tee, so the buffers are shared instead of converted and scaled per
+ * output.  Preview outputs, whose exact resolution doesn't matter, share a single
+ * downsampled copy at the smallest power of two reduction ("mip level") still
+ * covering the largest preview.
+ *
+ * Per output it keeps track of the latency from entering the fan-out to reaching
+ * the sink and of the time spent scaling for it, see logStats().
+ */
+class VideoFanout
+{
+
+public:
+    // Builds the shared conversion stage inside bin and links src to it
+    void build(GstBin *bin, GstElement *src);
+
+    /**
+     * Links an output into the fan-out. first is the first element of the output's
+     * chain and last its sink, they may be the same. Elements between first and last,
+     * if any, are timed as the output's own scaling.
+     */
+    void addOutput(const QString &name, GstElement *first, GstElement *last, bool preview);
+
+    // Size the preview mip level has to cover. Thread safe, applied on the next caps change.
+    void setPreviewTargetSize(const QSize &size);
+
+    // Logs and resets the statistics every 30 seconds, meant to be called from a periodic timer
+    void logStats(const QString &objName);
+
+private:
+    struct Stats
+    {
+        QString name;
+        std::atomic<quint64> frames { 0 };
+        std::atomic<gint64> latencyUsSum { 0 };
+        std::atomic<gint64> latencyUsMax { 0 };
+        std::atomic<gint64> scaleUsSum { 0 };
+        std::atomic<quint64> scaledFrames { 0 };
+        // Only touched on the streaming thread of the timed stage
+        gint64 stageStartUs { 0 };
+        VideoFanout *fanout { nullptr };
+    };
+
+    GstBin *m_bin { nullptr };
+    GstElement *m_convert { nullptr };
+    GstElement *m_nativeTee { nullptr };
+    GstElement *m_previewScale { nullptr };
+    GstElement *m_previewCapsFilter { nullptr };
+    GstElement *m_previewTee { nullptr };
+    std::atomic<int> m_previewTargetWidth { 0 };
+    std::atomic<int> m_previewTargetHeight { 0 };
+    int m_outputCount { 0 };
+
+    std::vector<std::unique_ptr<Stats>> m_stats;
+    Stats *m_convertStats { nullptr };
+    Stats *m_previewStats { nullptr };
+    QElapsedTimer m_statsTimer;
+
+    // When each recent frame entered the fan-out, keyed by pts
+    QMutex m_entryLock;
+    std::array<std::pair<GstClockTime, gint64>, 64> m_entryTimes {};
+    size_t m_nextEntry { 0 };
+
+    Stats *addStats(const QString &name);
+    void buildPreviewBranch();
+    void timeStage(GstElement *first, GstElement *last, Stats *stats);
+    void recordEntry(GstClockTime pts);
+    gint64 entryTime(GstClockTime pts);
+
+    static GstPadProbeReturn entryProbe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn sinkProbe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn stageStartProbe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn stageEndProbe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+    static GstPadProbeReturn previewCapsProbe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+};
+
+#endif // VIDEOFANOUT_H
@@ -92,6 +92,8 @@ void KaraokeFileInfo::setPattern(SourceDir::NamingPattern pattern, QString path)
     artist = "";
     title = "";
     songId = "";
+    if (path != this->path)
+        customPatternLoaded = false;
     this->path = path;
     this->pattern = pattern;
 //    switch (pattern)
@@ -247,7 +249,6 @@ void KaraokeFileInfo::getMetadata()
 {
     if (artist != "" || title != "" || songId != "")
         return;
-    int customPatternId = 0;
     QString baseNameFiltered = fileBaseName;
     baseNameFiltered.replace("_", " ");
     QStringList parts = baseNameFiltered.split(" - ");
@@ -336,24 +337,8 @@ void KaraokeFileInfo::getMetadata()
         songId = tagSongid;
         break;
     case SourceDir::CUSTOM:
-        QSqlQuery query;
-        query.exec("SELECT custompattern FROM sourcedirs WHERE path == \"" + path + "\"" );
-        if (query.first())
-        {
-            customPatternId = query.value(0).toInt();
-        }
-        if (customPatternId < 1)
-        {
-            qCritical() << "Custom pattern set for path, but pattern ID is invalid!  Bailing out!";
+        if (!customPatternLoaded)
             return;
-        }
-        query.exec("SELECT * FROM custompatterns WHERE patternid == " + QString::number(customPatternId));
-        if (query.first())
-        {
-            setArtistRegEx(query.value("artistregex").toString(), query.value("artistcapturegrp").toInt());
-            setTitleRegEx(query.value("titleregex").toString(), query.value("titlecapturegrp").toInt());
-            setSongIdRegEx(query.value("discidregex").toString(), query.value("discidcapturegrp").toInt());
-        }
         QRegularExpression r;
         QRegularExpressionMatch match;
         r.setPattern(artistPattern);
@@ -368,3 +353,38 @@ void KaraokeFileInfo::getMetadata()
         break;
     }
 }
+
+bool KaraokeFileInfo::loadCustomPattern(QSqlDatabase db)
+{
+    int customPatternId = 0;
+    QSqlQuery query(db);
+    query.exec("SELECT custompattern FROM sourcedirs WHERE path == \"" + path + "\"" );
+    if (query.first())
+    {
+        customPatternId = query.value(0).toInt();
+    }
+    if (customPatternId < 1)
+    {
+        qCritical() << "Custom pattern set for path, but pattern ID is invalid!  Bailing out!";
+        return false;
+    }
+    query.exec("SELECT * FROM custompatterns WHERE patternid == " + QString::number(customPatternId));
+    if (!query.first())
+    {
+        qCritical() << "Custom pattern " << customPatternId << " not found in the database!  Bailing out!";
+        return false;
+    }
+    setArtistRegEx(query.value("artistregex").toString(), query.value("artistcapturegrp").toInt());
+    setTitleRegEx(query.value("titleregex").toString(), query.value("titlecapturegrp").toInt());
+    setSongIdRegEx(query.value("discidregex").toString(), query.value("discidcapturegrp").toInt());
+    customPatternLoaded = true;
+    return true;
+}
+
+void KaraokeFileInfo::copyCustomPattern(const KaraokeFileInfo &other)
+{
+    setArtistRegEx(other.artistPattern, other.artistCaptureGroup);
+    setTitleRegEx(other.titlePattern, other.titleCaptureGroup);
+    setSongIdRegEx(other.songIdPattern, other.songIdCaptureGroup);
+    customPatternLoaded = other.customPatternLoaded;
+}
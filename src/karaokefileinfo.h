@@ -2,6 +2,7 @@
 #define FILENAMEPARSER_H
 
 #include <QObject>
+#include <QSqlDatabase>
 #include "src/models/tablemodelkaraokesourcedirs.h"
 #include "tagreader.h"
 
@@ -14,6 +15,7 @@ class KaraokeFileInfo : public QObject
     int titleCaptureGroup{0};
     QString songIdPattern;
     int songIdCaptureGroup{0};
+    bool customPatternLoaded{false};
     QString fileName;
     QString fileBaseName;
     bool useMetadata{false};
@@ -41,6 +43,12 @@ public:
     QString testPattern(QString regex, QString filename, int captureGroup = 0);
     const int& getDuration();
     void getMetadata();
+    // Reads the CUSTOM pattern regexes for the source dir from db, which has to belong to the
+    // calling thread.  getMetadata() never touches the database, a parser without a loaded
+    // pattern leaves the fields empty.  Parsers on worker threads get the regexes from one
+    // that already loaded them via copyCustomPattern().
+    bool loadCustomPattern(QSqlDatabase db);
+    void copyCustomPattern(const KaraokeFileInfo &other);
 
 signals:
 
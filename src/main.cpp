@@ -29,6 +29,7 @@
 #include <QMessageBox>
 #include <QCommandLineParser>
 #include "settings.h"
+#include "dbwriter.h"
 #include "idledetect.h"
 #include "runguard/runguard.h"
 #include "okjversion.h"
@@ -49,6 +50,7 @@ QDataStream &operator>>(QDataStream &in, SfxEntry &obj)
 
 QString altDataDir{};
 Settings settings;
+DbWriter dbWriter;
 
 IdleDetect *filter;
 
@@ -35,6 +35,8 @@
 #include "src/models/tableviewtooltipfilter.h"
 #include <tickernew.h>
 #include "dbupdatethread.h"
+#include "dbaccess.h"
+#include "dbwriter.h"
 #include "okjutil.h"
 #include <algorithm>
 #include "dlgaddsong.h"
@@ -48,6 +50,7 @@
 
 extern QString altDataDir;
 extern Settings settings;
+extern DbWriter dbWriter;
 OKJSongbookAPI *songbookApi;
 
 // for some reason clang-tidy is choking on this function
@@ -140,27 +143,9 @@ void MainWindow::setupShortcuts() {
                                           Qt::ApplicationShortcut);
 
     connect(scutKSelectNextSinger, &QShortcut::activated, [&]() {
-        int nextSinger{-1};
         QString nextSongPath;
-        bool empty{false};
-        int curSingerId{rotModel.currentSinger()};
-        int curPos{rotModel.getSingerPosition(curSingerId)};
-        if (curSingerId == -1)
-            curPos = rotModel.rowCount() - 1;
-        int loops = 0;
-        while ((nextSongPath == "") && (!empty)) {
-            if (loops > rotModel.rowCount()) {
-                empty = true;
-            } else {
-                if (++curPos >= rotModel.rowCount()) {
-                    curPos = 0;
-                }
-                nextSinger = rotModel.singerIdAtPosition(curPos);
-                nextSongPath = rotModel.nextSongPath(nextSinger);
-                loops++;
-            }
-        }
-        if (empty) {
+        int nextSinger = nextSingerWithSong(nextSongPath);
+        if (nextSinger == -1) {
             QMessageBox::information(this, "Unable to select next",
                                      "Sorry, no unsung karaoke songs are currently in any singer's queue");
             return;
@@ -194,27 +179,9 @@ void MainWindow::setupShortcuts() {
             }
             kMediaBackend.stop();
         }
-        int nextSinger{-1};
         QString nextSongPath;
-        bool empty{false};
-        int curSingerId{rotModel.currentSinger()};
-        int curPos{rotModel.getSingerPosition(curSingerId)};
-        if (curSingerId == -1)
-            curPos = rotModel.rowCount() - 1;
-        int loops = 0;
-        while ((nextSongPath == "") && (!empty)) {
-            if (loops > rotModel.rowCount()) {
-                empty = true;
-            } else {
-                if (++curPos >= rotModel.rowCount()) {
-                    curPos = 0;
-                }
-                nextSinger = rotModel.singerIdAtPosition(curPos);
-                nextSongPath = rotModel.nextSongPath(nextSinger);
-                loops++;
-            }
-        }
-        if (empty) {
+        int nextSinger = nextSingerWithSong(nextSongPath);
+        if (nextSinger == -1) {
             QMessageBox::information(this, "Unable to play next",
                                      "Sorry, no unsung karaoke songs are currently in any singer's queue");
             return;
@@ -635,6 +602,15 @@ MainWindow::MainWindow(QWidget *parent) :
         settings.restoreWindowState(this);
     });
     dbInit(okjDataDir);
+    dbWriter.startWriting(QSqlDatabase::cloneDatabase(database, "dbwriter"));
+    connect(&dbWriter, &DbWriter::writeFailed, this, [this] (const QString &error) {
+        // A failing disk fails every batch, one warning on screen at a time is plenty
+        if (m_dbWriteWarningShown)
+            return;
+        m_dbWriteWarningShown = true;
+        QMessageBox::warning(this, tr("Database error"), error + "\n\n" + tr("See the debug log for details."), QMessageBox::Ok);
+        m_dbWriteWarningShown = false;
+    });
     setupShortcuts();
     karaokeSongsModel.loadData();
     rotModel.loadData();
@@ -681,7 +657,6 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->labelNoSinger->setVisible(true);
     autosizeQueue();
     ui->tabWidgetQueue->setVisible(false);
-    khTmpDir = new QTemporaryDir();
     dbDialog = new DlgDatabase(database, this);
     dlgKeyChange = new DlgKeyChange(&qModel, this);
     requestsDialog = new DlgRequests(&rotModel);
@@ -716,6 +691,7 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(dbDialog, &DlgDatabase::databaseSongAdded, &karaokeSongsModel, &TableModelKaraokeSongs::loadData);
     connect(dbDialog, &DlgDatabase::databaseSongAdded, requestsDialog, &DlgRequests::databaseSongAdded);
     connect(dbDialog, &DlgDatabase::databaseCleared, this, &MainWindow::databaseCleared);
+    connect(dbDialog, &DlgDatabase::songsMissing, &karaokeSongsModel, &TableModelKaraokeSongs::hideMissingSongs);
     connect(&kMediaBackend, &MediaBackend::volumeChanged, ui->sliderVolume, &QSlider::setValue);
     connect(&kMediaBackend, &MediaBackend::positionChanged, this, &MainWindow::karaokeMediaBackend_positionChanged);
     connect(&kMediaBackend, &MediaBackend::durationChanged, this, &MainWindow::karaokeMediaBackend_durationChanged);
@@ -907,10 +883,35 @@ MainWindow::MainWindow(QWidget *parent) :
     rotDelegate.setCurrentSinger(settings.currentRotationPosition());
     updateRotationDuration();
     connect(&m_timerSlowUiUpdate, &QTimer::timeout, this, &MainWindow::updateRotationDuration);
+    connect(&m_timerSlowUiUpdate, &QTimer::timeout, [&]() {
+        // The next singer's wait counts down with the current song
+        if (settings.tickerCustomString().contains("%nextWait"))
+            updateTicker(true);
+    });
     m_timerSlowUiUpdate.start(10000);
-    connect(&qModel, &TableModelQueueSongs::queueModified, [&]() {
+    connect(&qModel, &TableModelQueueSongs::queueModified, [&](const int singerId) {
+        if (singerId == qModel.getSingerId())
+            rotModel.setSingerQueue(singerId, qModel.songs());
+        else
+            rotModel.refreshSingerQueue(singerId);
         updateRotationDuration();
-        rotModel.layoutChanged();
+        m_timerPreload.start();
+    });
+    m_timerPreload.setSingleShot(true);
+    m_timerPreload.setInterval(1000);
+    connect(&m_timerPreload, &QTimer::timeout, this, &MainWindow::preloadNextSong);
+    connect(&kMediaBackend, &MediaBackend::firstVideoFrame, [&](const qint64 backendMs) {
+        if (!m_playTimer.isValid())
+            return;
+        auto totalMs = m_playTimer.elapsed();
+        m_playTimer.invalidate();
+        if (m_playPreloaded)
+            m_lastPreloadedStartMs = totalMs;
+        else
+            m_lastColdStartMs = totalMs;
+        qInfo() << "Time to first frame: " << totalMs << "ms (" << (m_playPreloaded ? "preloaded" : "cold")
+                << ", " << backendMs << "ms in media backend) - last cold start: " << m_lastColdStartMs
+                << "ms, last preloaded start: " << m_lastPreloadedStartMs << "ms";
     });
     connect(&settings, &Settings::rotationDurationSettingsModified, this, &MainWindow::updateRotationDuration);
     lazyDurationUpdater = new LazyDurationUpdateController(this);
@@ -1050,9 +1051,8 @@ MainWindow::MainWindow(QWidget *parent) :
         ui->tableViewRotation->selectionModel()->select(QItemSelection(topLeft, bottomRight),
                                                         QItemSelectionModel::Select);
     });
-    std::vector<QWidget *> videoWidgets{cdgWindow->getVideoDisplay(), ui->videoPreview};
-    bmMediaBackend.setVideoOutputWidgets({cdgWindow->getVideoDisplayBm(), ui->videoPreviewBm});
-    kMediaBackend.setVideoOutputWidgets(videoWidgets);
+    bmMediaBackend.setVideoOutputWidgets({cdgWindow->getVideoDisplayBm()}, {ui->videoPreviewBm});
+    kMediaBackend.setVideoOutputWidgets({cdgWindow->getVideoDisplay()}, {ui->videoPreview});
     settings.setStartupOk(true);
     m_initialUiSetupDone = true;
     bmMediaBackend.stop(true);
@@ -1084,7 +1084,8 @@ void MainWindow::dbInit(const QDir &okjDataDir) {
         auto dataDir = QDir(altDataDir);
         database.setDatabaseName(dataDir.absolutePath() + QDir::separator() + "openkj.sqlite");
     }
-    database.open();
+    DbAccess::open(database);
+    DbAccess::enableWal(database);
     QSqlQuery query(
             "CREATE TABLE IF NOT EXISTS dbSongs ( songid INTEGER PRIMARY KEY AUTOINCREMENT, Artist COLLATE NOCASE, Title COLLATE NOCASE, DiscId COLLATE NOCASE, 'Duration' INTEGER, path VARCHAR(700) NOT NULL UNIQUE, filename COLLATE NOCASE, searchstring TEXT)");
     query.exec(
@@ -1103,9 +1104,6 @@ void MainWindow::dbInit(const QDir &okjDataDir) {
     query.exec(
             "CREATE TABLE IF NOT EXISTS bmplsongs ( plsongid INTEGER PRIMARY KEY AUTOINCREMENT, playlist INT, position INT, Artist INT, Title INT, Filename INT, Duration INT, path INT)");
     query.exec("CREATE TABLE IF NOT EXISTS bmsrcdirs ( path NOT NULL)");
-    query.exec("PRAGMA synchronous=OFF");
-    query.exec("PRAGMA cache_size=300000");
-    query.exec("PRAGMA temp_store=2");
 
     int schemaVersion = 0;
     query.exec("PRAGMA user_version");
@@ -1185,13 +1183,43 @@ void MainWindow::dbInit(const QDir &okjDataDir) {
             qInfo() << "Import complete for singer: " << singersQuery.value("name").toString();
         }
     }
+    if (schemaVersion < 107) {
+        qInfo() << "Updating database schema to version 107";
+        query.exec(
+                "CREATE TABLE sourceDirManifest ( path TEXT PRIMARY KEY, sourcedir TEXT NOT NULL, parent TEXT, mtime INTEGER, size INTEGER, inode INTEGER)");
+        query.exec("CREATE INDEX idx_manifest_sourcedir ON sourceDirManifest(sourcedir)");
+        query.exec("PRAGMA user_version = 107");
+        qInfo() << "DB Schema update to v107 completed";
+    }
 
 }
 
+int MainWindow::nextSingerWithSong(QString &songPath) {
+    int curSingerId{rotModel.currentSinger()};
+    int curPos{rotModel.getSingerPosition(curSingerId)};
+    if (curSingerId == -1)
+        curPos = rotModel.rowCount() - 1;
+    for (int loops = 0; loops <= rotModel.rowCount(); loops++) {
+        if (++curPos >= rotModel.rowCount())
+            curPos = 0;
+        int singerId = rotModel.singerIdAtPosition(curPos);
+        songPath = rotModel.nextSongPath(singerId);
+        if (!songPath.isEmpty())
+            return singerId;
+    }
+    songPath.clear();
+    return -1;
+}
+
+void MainWindow::preloadNextSong() {
+    if (m_shuttingDown)
+        return;
+    QString nextSongPath;
+    nextSingerWithSong(nextSongPath);
+    m_songPreloader.preload(nextSongPath);
+}
+
 void MainWindow::play(const QString &karaokeFilePath, const bool &k2k) {
-    khTmpDir->remove();
-    delete khTmpDir;
-    khTmpDir = new QTemporaryDir();
     if (kMediaBackend.state() != MediaBackend::PausedState) {
         qInfo() << "Playing file: " << karaokeFilePath;
         if (kMediaBackend.state() == MediaBackend::PlayingState) {
@@ -1204,30 +1232,47 @@ void MainWindow::play(const QString &karaokeFilePath, const bool &k2k) {
                 rotModel.singerMove(0, rotModel.rowCount() - 1);
             ui->spinBoxTempo->setValue(100);
         }
-        if (karaokeFilePath.endsWith(".zip", Qt::CaseInsensitive)) {
+        m_playTimer.start();
+        PreloadedSong preloaded;
+        m_playPreloaded = m_songPreloader.take(karaokeFilePath, preloaded);
+        if (m_playPreloaded) {
+            qInfo() << "Using preloaded data for: " << karaokeFilePath;
+            kMediaBackend.setMediaCdg(karaokeFilePath, preloaded.cdgData, preloaded.audioData);
+            if (!k2k)
+                bmMediaBackend.fadeOut(!settings.bmKCrossFade());
+            QApplication::setOverrideCursor(Qt::WaitCursor);
+            kMediaBackend.play();
+            QApplication::restoreOverrideCursor();
+            kMediaBackend.fadeInImmediate();
+        } else if (karaokeFilePath.endsWith(".zip", Qt::CaseInsensitive)) {
             MzArchive archive(karaokeFilePath);
             if ((archive.checkCDG()) && (archive.checkAudio())) {
                 if (archive.checkAudio()) {
-                    if (!archive.extractAudio(khTmpDir->path(), "tmp" + archive.audioExtension())) {
-                        m_timerTest.stop();
-                        QMessageBox::warning(this, tr("Bad karaoke file"), tr("Failed to extract audio file."),
-                                             QMessageBox::Ok);
-                        return;
-                    }
-                    if (!archive.extractCdg(khTmpDir->path(), "tmp.cdg")) {
+                    // The cdg is decompressed into memory and the audio inflated while it plays,
+                    // nothing is written to disk
+                    QByteArray cdgData = archive.getCDGData();
+                    if (cdgData.isEmpty()) {
                         m_timerTest.stop();
                         QMessageBox::warning(this, tr("Bad karaoke file"), tr("Failed to extract CDG file."),
                                              QMessageBox::Ok);
                         return;
                     }
-                    QString audioFile = khTmpDir->path() + QDir::separator() + "tmp" + archive.audioExtension();
-                    QString cdgFile = khTmpDir->path() + QDir::separator() + "tmp.cdg";
-                    qInfo() << "Extracted audio file size: " << QFileInfo(audioFile).size();
-                    qInfo() << "Setting karaoke backend source file to: " << audioFile;
-                    kMediaBackend.setMediaCdg(cdgFile, audioFile);
+                    auto audioStream = archive.openAudioStream();
+                    if (audioStream) {
+                        kMediaBackend.setMediaCdg(karaokeFilePath, cdgData, std::move(audioStream));
+                    } else {
+                        QByteArray audioData = archive.getAudioData();
+                        if (audioData.isEmpty()) {
+                            m_timerTest.stop();
+                            QMessageBox::warning(this, tr("Bad karaoke file"), tr("Failed to extract audio file."),
+                                                 QMessageBox::Ok);
+                            return;
+                        }
+                        kMediaBackend.setMediaCdg(karaokeFilePath, cdgData, audioData);
+                    }
                     if (!k2k)
                         bmMediaBackend.fadeOut(!settings.bmKCrossFade());
-                    qInfo() << "Beginning playback of file: " << audioFile;
+                    qInfo() << "Beginning playback of file: " << karaokeFilePath;
                     QApplication::setOverrideCursor(Qt::WaitCursor);
                     kMediaBackend.play();
                     QApplication::restoreOverrideCursor();
@@ -1240,8 +1285,6 @@ void MainWindow::play(const QString &karaokeFilePath, const bool &k2k) {
                 return;
             }
         } else if (karaokeFilePath.endsWith(".cdg", Qt::CaseInsensitive)) {
-            QString cdgTmpFile = "tmp.cdg";
-            QString audTmpFile = "tmp.mp3";
             QFile cdgFile(karaokeFilePath);
             if (!cdgFile.exists()) {
                 m_timerTest.stop();
@@ -1264,10 +1307,7 @@ void MainWindow::play(const QString &karaokeFilePath, const bool &k2k) {
                 QMessageBox::warning(this, tr("Bad karaoke file"), tr("Audio file contains no data"), QMessageBox::Ok);
                 return;
             }
-            cdgFile.copy(khTmpDir->path() + QDir::separator() + cdgTmpFile);
-            QFile::copy(audiofn, khTmpDir->path() + QDir::separator() + audTmpFile);
-            kMediaBackend.setMediaCdg(khTmpDir->path() + QDir::separator() + cdgTmpFile,
-                                      khTmpDir->path() + QDir::separator() + audTmpFile);
+            kMediaBackend.setMediaCdg(karaokeFilePath, audiofn);
             if (!k2k)
                 bmMediaBackend.fadeOut(!settings.bmKCrossFade());
             QApplication::setOverrideCursor(Qt::WaitCursor);
@@ -1277,10 +1317,7 @@ void MainWindow::play(const QString &karaokeFilePath, const bool &k2k) {
         } else {
             // Close CDG if open to avoid double video playback
             qInfo() << "Playing non-CDG video file: " << karaokeFilePath;
-            QString tmpFileName = khTmpDir->path() + QDir::separator() + "tmpvid." + karaokeFilePath.right(4);
-            QFile::copy(karaokeFilePath, tmpFileName);
-            qInfo() << "Playing temporary copy to avoid bad filename stuff w/ gstreamer: " << tmpFileName;
-            kMediaBackend.setMedia(tmpFileName);
+            kMediaBackend.setMedia(karaokeFilePath);
             if (!k2k)
                 bmMediaBackend.fadeOut();
             kMediaBackend.play();
@@ -1292,7 +1329,8 @@ void MainWindow::play(const QString &karaokeFilePath, const bool &k2k) {
             QString timeStamp = QDateTime::currentDateTime().toString("yyyy-MM-dd-hhmm");
             audioRecorder.record(curSinger + " - " + curArtist + " - " + curTitle + " - " + timeStamp);
         }
-
+        // The rotation moves on once the caller has updated the current singer, look ahead after that
+        m_timerPreload.start();
 
     } else if (kMediaBackend.state() == MediaBackend::PausedState) {
         if (settings.recordingEnabled())
@@ -1312,6 +1350,10 @@ MainWindow::~MainWindow() {
     timeEndPeriod(1);
 #endif
     lazyDurationUpdater->stopWork();
+    dbWriter.stopWriting();
+    // Pending model commits are written synchronously from here on, don't report back to a window that is going away
+    dbWriter.disconnect(this);
+    DbAccess::releasePrepared();
     settings.bmSetVolume(ui->sliderBmVolume->value());
     settings.setAudioVolume(ui->sliderVolume->value());
     qInfo() << "Saving volumes - K: " << settings.audioVolume() << " BM: " << settings.bmVolume();
@@ -1334,7 +1376,6 @@ MainWindow::~MainWindow() {
     settings.sync();
     qInfo() << "Deleting non-owned objects";
     delete ui;
-    delete khTmpDir;
     delete dlgSongShop;
     delete requestsDialog;
     qInfo() << "OpenKJ mainwindow destructor complete";
@@ -1955,11 +1996,16 @@ void MainWindow::rotationDataChanged() {
     if (settings.rotationShowNextSong())
         resizeRotation();
     updateRotationDuration();
-    QString sep = "•";
+    m_timerPreload.start();
     requestsDialog->rotationChanged();
     QString statusBarText = "Singers: ";
     statusBarText += QString::number(rotModel.rowCount());
     labelSingerCount.setText(statusBarText);
+    updateTicker();
+}
+
+void MainWindow::updateTicker(const bool onlyIfChanged) {
+    QString sep = "•";
     QString tickerText;
     if (settings.tickerCustomString() != "") {
         tickerText += settings.tickerCustomString() + " " + sep + " ";
@@ -1973,12 +2019,14 @@ void MainWindow::rotationDataChanged() {
         } else
             nsPos = rotModel.getSingerPosition(rotModel.currentSinger());
         QString ns = "[nobody]";
+        int nsWaitMins{0};
         if (rotModel.rowCount() > 0) {
             if (nsPos + 1 < rotModel.rowCount())
                 nsPos++;
             else
                 nsPos = 0;
             ns = rotModel.getSingerName(rotModel.singerIdAtPosition(nsPos));
+            nsWaitMins = (rotModel.estimatedWaitSecs(rotModel.singerIdAtPosition(nsPos)) + 59) / 60;
         }
         tickerText.replace("%cs", cs);
         tickerText.replace("%ns", ns);
@@ -1991,6 +2039,7 @@ void MainWindow::rotationDataChanged() {
         tickerText.replace("%curTitle", ui->labelTitle->text());
         tickerText.replace("%curSinger", cs);
         tickerText.replace("%nextSinger", ns);
+        tickerText.replace("%nextWait", QString::number(nsWaitMins) + " min");
 
     }
     if (settings.tickerShowRotationInfo()) {
@@ -2033,6 +2082,9 @@ void MainWindow::rotationDataChanged() {
         }
         // tickerText += "|";
     }
+    if (onlyIfChanged && tickerText == m_lastTickerText)
+        return;
+    m_lastTickerText = tickerText;
     cdgWindow->setTickerText(tickerText);
 }
 
@@ -4006,25 +4058,18 @@ void MainWindow::on_actionCDG_Decode_Torture_triggered() {
             MzArchive archive(karaokeFilePath);
             if ((archive.checkCDG()) && (archive.checkAudio())) {
                 if (archive.checkAudio()) {
-                    if (!archive.extractAudio(khTmpDir->path(), "tmp" + archive.audioExtension())) {
-                        return;
-                    }
-                    if (!archive.extractCdg(khTmpDir->path(), "tmp.cdg")) {
+                    QByteArray audioData = archive.getAudioData();
+                    QByteArray cdgData = archive.getCDGData();
+                    if (audioData.isEmpty() || cdgData.isEmpty()) {
                         return;
                     }
-                    QString audioFile = khTmpDir->path() + QDir::separator() + "tmp" + archive.audioExtension();
-                    QString cdgFile = khTmpDir->path() + QDir::separator() + "tmp.cdg";
-                    qInfo() << "Extracted audio file size: " << QFileInfo(audioFile).size();
-                    qInfo() << "Setting karaoke backend source file to: " << audioFile;
-                    kMediaBackend.setMediaCdg(cdgFile, audioFile);
+                    kMediaBackend.setMediaCdg(karaokeFilePath, cdgData, audioData);
                     //kMediaBackend.testCdgDecode(); // todo: andth
                 }
             } else {
                 return;
             }
         } else if (karaokeFilePath.endsWith(".cdg", Qt::CaseInsensitive)) {
-            QString cdgTmpFile = "tmp.cdg";
-            QString audTmpFile = "tmp.mp3";
             QFile cdgFile(karaokeFilePath);
             if (!cdgFile.exists() || cdgFile.size() == 0) {
                 return;
@@ -4037,10 +4082,7 @@ void MainWindow::on_actionCDG_Decode_Torture_triggered() {
             if (audioFile.size() == 0) {
                 return;
             }
-            cdgFile.copy(khTmpDir->path() + QDir::separator() + cdgTmpFile);
-            QFile::copy(audiofn, khTmpDir->path() + QDir::separator() + audTmpFile);
-            kMediaBackend.setMediaCdg(khTmpDir->path() + QDir::separator() + cdgTmpFile,
-                                      khTmpDir->path() + QDir::separator() + audTmpFile);
+            kMediaBackend.setMediaCdg(karaokeFilePath, audiofn);
             // kMediaBackend.testCdgDecode(); // todo: andth
         }
         ui->labelSinger->setText("Torture run (" + QString::number(++runs) + ")");
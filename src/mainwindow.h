@@ -54,6 +54,7 @@
 #include "dlgaddsinger.h"
 #include "dlgsongshop.h"
 #include "songshop.h"
+#include "songpreloader.h"
 #include "durationlazyupdater.h"
 #include "dlgdebugoutput.h"
 #include "dlgvideopreview.h"
@@ -97,12 +98,20 @@ private:
     bool sliderPositionPressed{false};
     bool sliderBmPositionPressed{false};
     bool m_shuttingDown{false};
+    bool m_dbWriteWarningShown{false};
     bool m_regSingersDlgShown{false};
     void play(const QString &karaokeFilePath, const bool &k2k = false);
+    int nextSingerWithSong(QString &songPath);
+    void preloadNextSong();
+    SongPreloader m_songPreloader{this};
+    QTimer m_timerPreload;
+    QElapsedTimer m_playTimer;
+    bool m_playPreloaded{false};
+    qint64 m_lastColdStartMs{-1};
+    qint64 m_lastPreloadedStartMs{-1};
     int m_rtClickQueueSongId{-1};
     int m_rtClickRotationSingerId{-1};
     int m_curSingerOriginalPosition{0};
-    QTemporaryDir *khTmpDir;
     QString dbRtClickFile;
     QString curSinger;
     QString curArtist;
@@ -126,6 +135,7 @@ private:
     QTimer m_timerKaraokeAA;
     UpdateChecker *checker;
     QTimer m_timerSlowUiUpdate;
+    QString m_lastTickerText;
     QTimer m_timerButtonFlash;
     bool kNeedAutoSize{false};
     bool bNeedAutoSize{true};
@@ -203,6 +213,7 @@ private slots:
     void hasActiveVideoChanged();
     void on_buttonRegulars_clicked();
     void rotationDataChanged();
+    void updateTicker(const bool onlyIfChanged = false);
     void silenceDetectedKar();
     void silenceDetectedBm();
     void on_tableViewDB_customContextMenuRequested(const QPoint &pos);
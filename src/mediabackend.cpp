@@ -22,7 +22,10 @@
 #include <QApplication>
 #include <QDebug>
 #include <cmath>
+#include <algorithm>
 #include <QFile>
+#include <QUrl>
+#include <QWidget>
 #include <gst/audio/streamvolume.h>
 #include <gst/gstdebugutils.h>
 #include "settings.h"
@@ -137,7 +140,9 @@ void MediaBackend::setEnforceAspectRatio(const bool &enforce)
     {
         if (vs.softwareRenderVideoSink)
         {
-            g_object_set(vs.videoScale, "add-borders", enforce, nullptr);
+            if (vs.videoScale)
+                g_object_set(vs.videoScale, "add-borders", enforce, nullptr);
+            vs.softwareRenderVideoSink->setKeepAspectRatio(enforce);
         }
         else
         {
@@ -240,7 +245,7 @@ void MediaBackend::play()
     if (m_cdgMode)
     {
         // Check if cdg file exists
-        if (!QFile::exists(m_cdgFilename))
+        if (!m_mediaInMemory && !QFile::exists(m_cdgFilename))
         {
             qInfo() << " - play - CDG file doesn't exist, bailing out";
             emit stateChanged(PlayingState);
@@ -249,14 +254,15 @@ void MediaBackend::play()
             return;
         }
 
-        if (settings.cdgPrescalingEnabled() && settings.hardwareAccelEnabled())
-        {
-            gst_element_unlink(m_queueMainVideo, m_videoTee);
-            gst_element_link_many(m_queueMainVideo, m_prescalerVideoConvert, m_prescaler, m_prescalerCapsFilter, m_videoTee, nullptr);
-        } else {
-            gst_element_unlink_many(m_queueMainVideo, m_prescalerVideoConvert, m_prescaler, m_prescalerCapsFilter, m_videoTee, nullptr);
-            gst_element_link(m_queueMainVideo, m_videoTee);
-        }
+        // With prescaling the decoder expands the palette and does the upscaling itself, so
+        // the frames reach the sinks without a generic videoconvert/videoscale pass.
+        // The software sink scales to the surface anyway, it only gets the cheaper RGB16.
+        if (!settings.cdgPrescalingEnabled())
+            m_cdgSrc->setOutputFormat(CdgAppSrc::OutputFormat::Paletted);
+        else if (m_videoAccelEnabled)
+            m_cdgSrc->setOutputFormat(CdgAppSrc::OutputFormat::BGRx, cdgPrescaleFactor());
+        else
+            m_cdgSrc->setOutputFormat(CdgAppSrc::OutputFormat::RGB16);
 
         // Use m_cdgAppSrc as source for video. m_decoder will still be used for audio file
         gst_bin_add(reinterpret_cast<GstBin*>(m_pipeline), m_cdgSrc->getSrcElement());
@@ -265,15 +271,15 @@ void MediaBackend::play()
 
         allowMissingAudio = m_type == VideoPreview;
 
-        m_cdgSrc->load(m_cdgFilename);
+        if (m_mediaInMemory)
+            m_cdgSrc->load(m_cdgData);
+        else
+            m_cdgSrc->load(m_cdgFilename);
 
         qInfo() << m_objName << " - play - playing cdg:   " << m_cdgFilename;
-    } else {
-        gst_element_unlink_many(m_queueMainVideo, m_prescalerVideoConvert, m_prescaler, m_prescalerCapsFilter, m_videoTee, nullptr);
-        gst_element_link(m_queueMainVideo, m_videoTee);
     }
 
-    if (!QFile::exists(m_filename))
+    if (m_mediaInMemory ? m_audioMemSrc.isEmpty() : !QFile::exists(m_filename))
     {
         if (!allowMissingAudio)
         {
@@ -287,14 +293,35 @@ void MediaBackend::play()
     else
     {
         gst_bin_add(reinterpret_cast<GstBin*>(m_pipeline), m_decoder);
-        qInfo() << m_objName << " - play - playing media: " << m_filename;
-        auto uri = gst_filename_to_uri(m_filename.toLocal8Bit(), nullptr);
-        g_object_set(m_decoder, "uri", uri, nullptr);
-        g_free(uri);
+        if (m_mediaInMemory)
+        {
+            // The appsrc is hooked up to m_audioMemSrc in sourceSetup_cb
+            qInfo() << m_objName << " - play - playing media from memory: " << m_filename;
+            g_object_set(m_decoder, "uri", "appsrc://", nullptr);
+        }
+        else
+        {
+            qInfo() << m_objName << " - play - playing media: " << m_filename;
+            // QUrl percent encodes the path as utf-8, which gstreamer handles on every platform
+            g_object_set(m_decoder, "uri", QUrl::fromLocalFile(m_filename).toEncoded().constData(), nullptr);
+        }
     }
 
     resetVideoSinks();
 
+    QSize previewSize;
+    for (auto &vd : m_videoSinks)
+    {
+        if (vd.preview)
+            previewSize = previewSize.expandedTo(vd.surface->size() * vd.surface->devicePixelRatioF());
+    }
+    m_videoFanout.setPreviewTargetSize(previewSize);
+
+    m_firstFrameTimer.start();
+    auto queuePad = gst_element_get_static_pad(m_queueMainVideo, "sink");
+    m_firstFrameProbeId = gst_pad_add_probe(queuePad, GST_PAD_PROBE_TYPE_BUFFER, &MediaBackend::firstFrameProbe_cb, this, nullptr);
+    gst_object_unref(queuePad);
+
     gst_element_set_state(m_pipeline, GST_STATE_PLAYING);
     setEnforceAspectRatio(settings.enforceAspectRatio());
     forceVideoExpose();
@@ -312,6 +339,8 @@ void MediaBackend::resetPipeline()
 
     gsthlp_bin_try_remove(m_pipelineAsBin, {m_cdgSrc->getSrcElement(), m_decoder, m_audioBin, m_videoBin});
 
+    removeFirstFrameProbe();
+
     m_cdgSrc->reset();
 
     delete m_audioSrcPad; delete m_videoSrcPad; m_audioSrcPad = m_videoSrcPad = nullptr;
@@ -384,6 +413,9 @@ void MediaBackend::setMedia(const QString &filename)
 {
     m_cdgMode = false;
     m_filename = filename;
+    m_mediaInMemory = false;
+    m_cdgData.clear();
+    m_audioMemSrc.clear();
 }
 
 void MediaBackend::setMediaCdg(const QString &cdgFilename, const QString &audioFilename)
@@ -391,6 +423,29 @@ void MediaBackend::setMediaCdg(const QString &cdgFilename, const QString &audioF
     m_cdgMode = true;
     m_filename = audioFilename;
     m_cdgFilename = cdgFilename;
+    m_mediaInMemory = false;
+    m_cdgData.clear();
+    m_audioMemSrc.clear();
+}
+
+void MediaBackend::setMediaCdg(const QString &name, const QByteArray &cdgData, const QByteArray &audioData)
+{
+    m_cdgMode = true;
+    m_filename = name;
+    m_cdgFilename = name;
+    m_mediaInMemory = true;
+    m_cdgData = cdgData;
+    m_audioMemSrc.setData(audioData);
+}
+
+void MediaBackend::setMediaCdg(const QString &name, const QByteArray &cdgData, std::unique_ptr<QIODevice> audioStream)
+{
+    m_cdgMode = true;
+    m_filename = name;
+    m_cdgFilename = name;
+    m_mediaInMemory = true;
+    m_cdgData = cdgData;
+    m_audioMemSrc.setStream(std::move(audioStream));
 }
 
 void MediaBackend::setMuted(const bool &muted)
@@ -537,6 +592,8 @@ void MediaBackend::timerSlow_timeout()
         }
         m_positionWatchdogLastPos = currPos;
     }
+
+    m_videoFanout.logStats(m_objName);
 }
 
 void MediaBackend::setVideoOffset(const int offsetMs) {
@@ -733,6 +790,7 @@ void MediaBackend::buildPipeline()
 
     m_decoder = gst_element_factory_make("uridecodebin", "uridecodebin");
     g_signal_connect(m_decoder, "pad-added", G_CALLBACK(padAddedToDecoder_cb), this);
+    g_signal_connect(m_decoder, "source-setup", G_CALLBACK(sourceSetup_cb), this);
     g_object_ref(m_decoder);
 
     m_cdgSrc = new CdgAppSrc();
@@ -764,18 +822,6 @@ void MediaBackend::buildVideoSinkBin()
 
     m_queueMainVideo = gst_element_factory_make("queue", "m_queueMainVideo");
     gst_bin_add(reinterpret_cast<GstBin *>(m_videoBin), m_queueMainVideo);
-    m_prescalerVideoConvert = gst_element_factory_make("videoconvert", "m_prescalerVideoConvert");
-    m_prescaler = gst_element_factory_make("videoscale", "m_prescaler");
-    g_object_set(m_prescaler, "method", 0, nullptr);
-    m_prescalerCapsFilter = gst_element_factory_make("capsfilter", "m_prescalerCapsFilter");
-    auto cdgPreScaleCaps = gst_caps_new_simple(
-            "video/x-raw",
-            "format", G_TYPE_STRING, "RGB",
-            "width",  G_TYPE_INT, 1152,
-            "height", G_TYPE_INT, 768,
-            NULL);
-    g_object_set(G_OBJECT(m_prescalerCapsFilter), "caps", cdgPreScaleCaps, nullptr);
-    gst_caps_unref(cdgPreScaleCaps);
 
     auto queuePad = gst_element_get_static_pad(m_queueMainVideo, "sink");
     auto ghostVideoPad = gst_ghost_pad_new("sink", queuePad);
@@ -783,11 +829,23 @@ void MediaBackend::buildVideoSinkBin()
     gst_element_add_pad(m_videoBin, ghostVideoPad);
     gst_object_unref(queuePad);
 
-    m_videoTee = gst_element_factory_make("tee", "videoTee");
-    gst_bin_add_many(reinterpret_cast<GstBin *>(m_videoBin), m_prescalerVideoConvert, m_prescaler, m_prescalerCapsFilter, m_videoTee, nullptr);
-    gst_element_link(m_queueMainVideo, m_videoTee);
-
+    m_videoFanout.build(reinterpret_cast<GstBin *>(m_videoBin), m_queueMainVideo);
+}
 
+int MediaBackend::cdgPrescaleFactor()
+{
+    // Largest integer factor at which the cdg frame still fits the biggest output surface.
+    // Capped at 5x (1440x960) to keep the per-frame memory traffic reasonable, at least 4x
+    // like the videoscale based prescaler this replaces when the surfaces aren't sized yet.
+    int factor = 0;
+    for (auto &vd : m_videoSinks)
+    {
+        if (vd.preview)
+            continue;
+        auto size = vd.surface->size() * vd.surface->devicePixelRatioF();
+        factor = std::max(factor, std::min(size.width() / cdg::FRAME_DIM_CROPPED.width(), size.height() / cdg::FRAME_DIM_CROPPED.height()));
+    }
+    return factor < 1 ? 4 : std::min(factor, 5);
 }
 
 void MediaBackend::buildAudioSinkBin()
@@ -930,6 +988,33 @@ void MediaBackend::padAddedToDecoder_cb(GstElement *element,  GstPad *pad, gpoin
     }
 }
 
+void MediaBackend::sourceSetup_cb([[maybe_unused]]GstElement *decoder, GstElement *source, gpointer caller)
+{
+    auto *backend = (MediaBackend*)caller;
+    if (backend->m_mediaInMemory && GST_IS_APP_SRC(source))
+        backend->m_audioMemSrc.attach(GST_APP_SRC(source));
+}
+
+GstPadProbeReturn MediaBackend::firstFrameProbe_cb([[maybe_unused]]GstPad *pad, [[maybe_unused]]GstPadProbeInfo *info, gpointer caller)
+{
+    auto *backend = (MediaBackend*)caller;
+    // Whoever resets the id first owns the probe removal
+    if (backend->m_firstFrameProbeId.exchange(0) == 0)
+        return GST_PAD_PROBE_OK;
+    emit backend->firstVideoFrame(backend->m_firstFrameTimer.elapsed());
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void MediaBackend::removeFirstFrameProbe()
+{
+    auto probeId = m_firstFrameProbeId.exchange(0);
+    if (probeId == 0)
+        return;
+    auto queuePad = gst_element_get_static_pad(m_queueMainVideo, "sink");
+    gst_pad_remove_probe(queuePad, probeId);
+    gst_object_unref(queuePad);
+}
+
 void MediaBackend::stopPipeline()
 {
     gst_element_set_state(m_pipeline, GST_STATE_NULL);
@@ -1110,10 +1195,6 @@ void MediaBackend::setAudioOutputDevice(const AudioOutputDevice &device)
     if (playAfter)
     {
         qInfo() << m_objName << " - Resuming playback";
-        if (m_cdgMode)
-            setMediaCdg(m_cdgFilename, m_filename);
-        else
-            setMedia(m_filename);
         play();
         qInfo() << m_objName << " - Waiting for playing state";
         GstState curState;
@@ -1142,21 +1223,27 @@ void MediaBackend::setAudioOutputDevice(const QString &deviceName)
     }
 }
 
-void MediaBackend::setVideoOutputWidgets(const std::vector<QWidget*>& surfaces)
+void MediaBackend::setVideoOutputWidgets(const std::vector<QWidget*>& surfaces, const std::vector<QWidget*>& previewSurfaces)
 {
     if (!m_videoSinks.empty())
     {
         throw std::runtime_error(("Video output widget(s) already set."));
     }
 
+    for (auto &surface : surfaces)
+    {
+        m_videoSinks.push_back(VideoSinkData { surface });
+    }
+    for (auto &surface : previewSurfaces)
+    {
+        m_videoSinks.push_back(VideoSinkData { surface, nullptr, nullptr, nullptr, true });
+    }
+
     int i = 0;
 
-    for (auto &surface : surfaces)
+    for (auto &vd : m_videoSinks)
     {
         i++;
-        VideoSinkData vd;
-
-        vd.surface = surface;
 
         if (m_videoAccelEnabled)
         {
@@ -1165,18 +1252,27 @@ void MediaBackend::setVideoOutputWidgets(const std::vector<QWidget*>& surfaces)
         }
         else
         {
-            vd.softwareRenderVideoSink = new SoftwareRenderVideoSink(surface);
+            vd.softwareRenderVideoSink = new SoftwareRenderVideoSink(vd.surface);
+            if (settings.videoScaleInSoftwareSink())
+                vd.softwareRenderVideoSink->setScalingMode(SoftwareRenderVideoSink::ScalingMode::InSink);
             vd.videoSink = GST_ELEMENT(vd.softwareRenderVideoSink->getSink());
         }
+        gst_bin_add(GST_BIN(m_videoBin), vd.videoSink);
 
-        auto videoQueue = gst_element_factory_make("queue", QString("videoqueue%1").arg(i).toLocal8Bit());
-        auto videoConv = gst_element_factory_make("videoconvert", QString("preOutVideoConvert%1").arg(i).toLocal8Bit());
-        vd.videoScale = gst_element_factory_make("videoscale", QString("videoScale%1").arg(i).toLocal8Bit());
-
-        gst_bin_add_many(GST_BIN(m_videoBin), videoQueue, videoConv, vd.videoScale, vd.videoSink, nullptr);
-        gst_element_link_many(m_videoTee, videoQueue, videoConv, vd.videoScale, vd.videoSink, nullptr);
+        // Conversion is shared by all outputs. Only software sinks that want frames at the
+        // exact size of their surface need scaling of their own, the others scale on the gpu
+        // or while painting.
+        GstElement *first = vd.videoSink;
+        if (!m_videoAccelEnabled && !settings.videoScaleInSoftwareSink())
+        {
+            vd.videoScale = gst_element_factory_make("videoscale", QString("videoScale%1").arg(i).toLocal8Bit());
+            gst_bin_add(GST_BIN(m_videoBin), vd.videoScale);
+            gst_element_link(vd.videoScale, vd.videoSink);
+            first = vd.videoScale;
+        }
 
-        m_videoSinks.push_back(vd);
+        m_videoFanout.addOutput(vd.surface->objectName().isEmpty() ? QString("output %1").arg(i) : vd.surface->objectName(),
+                                first, vd.videoSink, vd.preview);
     }
 
     resetVideoSinks();
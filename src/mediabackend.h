@@ -34,6 +34,7 @@
 #include <QThread>
 #include <QMutex>
 #include <QImage>
+#include <QElapsedTimer>
 #include "audiofader.h"
 #include "softwarerendervideosink.h"
 #include <QPointer>
@@ -43,6 +44,8 @@
 #include "cdg/cdgfilereader.h"
 #include "settings.h"
 #include "gstreamer/gstreamerhelper.h"
+#include "gstreamer/memoryappsrc.h"
+#include "gstreamer/videofanout.h"
 
 #define STUP 1.0594630943592952645618252949461
 #define STDN 0.94387431268169349664191315666784
@@ -92,12 +95,16 @@ public:
     void setAccelType(const accel &type=accel::XVideo) { m_accelMode = type; }
     void setAudioOutputDevice(const AudioOutputDevice &device);
     void setAudioOutputDevice(const QString &deviceName);
-    void setVideoOutputWidgets(const std::vector<QWidget*>& surfaces);
+    // Previews get a downsampled copy of the video shared among them, see VideoFanout
+    void setVideoOutputWidgets(const std::vector<QWidget*>& surfaces, const std::vector<QWidget*>& previewSurfaces = {});
     void setVideoEnabled(const bool &enabled);
     [[nodiscard]] bool isVideoEnabled() const { return m_videoEnabled; }
     bool hasActiveVideo();
     [[nodiscard]] int getVolume() const { return m_volume; }
     void forceVideoExpose();
+    // Plays a cdg track whose audio is read from audioStream while it plays, e.g. a
+    // zip member being inflated, instead of having it all in memory up front
+    void setMediaCdg(const QString &name, const QByteArray &cdgData, std::unique_ptr<QIODevice> audioStream);
 
     void writePipelinesGraphToFile(const QString& filePath);
 
@@ -129,6 +136,7 @@ private:
         GstElement *videoSink { nullptr };
         GstElement *videoScale { nullptr };
         SoftwareRenderVideoSink *softwareRenderVideoSink { nullptr };
+        bool preview { false };
     };
 
 
@@ -160,10 +168,7 @@ private:
     GstElement *m_faderVolumeElement { nullptr };
     GstElement *m_equalizer { nullptr };
     GstElement *m_audioSink { nullptr };
-    GstElement *m_prescalerCapsFilter { nullptr };
     GstElement *m_queueMainVideo { nullptr };
-    GstElement *m_prescaler { nullptr };
-    GstElement *m_prescalerVideoConvert { nullptr };
 
     GstCaps *m_audioCapsStereo { nullptr };
     GstCaps *m_audioCapsMono { nullptr };
@@ -175,7 +180,7 @@ private:
 
     /* VIDEO SINK */
     GstElement *m_videoBin { nullptr }; // GstBin
-    GstElement *m_videoTee { nullptr };
+    VideoFanout m_videoFanout;
 
     std::vector<VideoSinkData> m_videoSinks;
 
@@ -184,6 +189,12 @@ private:
 
     QString m_filename;
     QString m_cdgFilename;
+    // Set when the current media is played from memory instead of from files
+    bool m_mediaInMemory{false};
+    QByteArray m_cdgData;
+    MemoryAppSrc m_audioMemSrc;
+    QElapsedTimer m_firstFrameTimer;
+    std::atomic<gulong> m_firstFrameProbeId{0};
     QStringList m_outputDeviceNames;
     QTimer m_gstBusMsgHandlerTimer;
     QTimer m_timerFast;
@@ -212,6 +223,7 @@ private:
 
     void buildPipeline();
     void buildVideoSinkBin();
+    int cdgPrescaleFactor();
     void buildAudioSinkBin();
     void resetVideoSinks();
     const char* getVideoSinkElementNameForFactory();
@@ -221,6 +233,9 @@ private:
 
     void gstBusFunc(GstMessage *message);
     static void padAddedToDecoder_cb(GstElement *element,  GstPad *pad, gpointer caller);
+    static void sourceSetup_cb(GstElement *decoder, GstElement *source, gpointer caller);
+    static GstPadProbeReturn firstFrameProbe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer caller);
+    void removeFirstFrameProbe();
     void stopPipeline();
     void resetPipeline();
     void patchPipelineSinks();
@@ -236,6 +251,8 @@ public slots:
     void pause();
     void setMedia(const QString &filename);
     void setMediaCdg(const QString &cdgFilename, const QString &audioFilename);
+    // Plays a cdg track held in memory, name is only used for logging
+    void setMediaCdg(const QString &name, const QByteArray &cdgData, const QByteArray &audioData);
     void setMuted(const bool &muted);
     bool isMuted();
     void setPosition(const qint64 &position);
@@ -268,6 +285,8 @@ signals:
     void silenceDetected();
     void pitchChanged(const int key);
     void audioError(const QString &msg);
+    // Time from play() to the first video frame entering the video bin
+    void firstVideoFrame(const qint64 msSincePlay);
 
 };
 
@@ -0,0 +1,239 @@
+#include "songcatalog.h"
+
+#include <QHash>
+#include <algorithm>
+#include <limits>
+
+namespace {
+constexpr qint64 noLastPlay = std::numeric_limits<qint64>::min();
+}
+
+void PackedStrings::clear() {
+    m_chars.clear();
+    m_offsets.assign(1, 0);
+}
+
+void PackedStrings::squeeze() {
+    m_chars.squeeze();
+    m_offsets.shrink_to_fit();
+}
+
+quint32 PackedStrings::append(const QString &str) {
+    m_chars.append(str);
+    m_offsets.push_back(quint32(m_chars.size()));
+    return quint32(m_offsets.size() - 2);
+}
+
+size_t PackedStrings::memoryUsage() const {
+    return size_t(m_chars.capacity()) * sizeof(QChar) + m_offsets.capacity() * sizeof(quint32);
+}
+
+void StringPool::clear() {
+    m_strings.clear();
+    m_lower.clear();
+    m_slots.clear();
+}
+
+void StringPool::squeeze() {
+    m_strings.squeeze();
+    m_lower.squeeze();
+}
+
+quint32 StringPool::intern(const QString &str) {
+    if ((m_strings.size() + 1) * 2 > m_slots.size())
+        grow();
+    const size_t mask = m_slots.size() - 1;
+    for (size_t slot = qHash(str) & mask;; slot = (slot + 1) & mask) {
+        if (m_slots[slot] == 0) {
+            const quint32 id = m_strings.append(str);
+            m_lower.append(str.toLower());
+            m_slots[slot] = id + 1;
+            return id;
+        }
+        if (m_strings.at(m_slots[slot] - 1) == str)
+            return m_slots[slot] - 1;
+    }
+}
+
+void StringPool::grow() {
+    std::vector<quint32> slots(std::max<size_t>(64, m_slots.size() * 2), 0);
+    const size_t mask = slots.size() - 1;
+    for (quint32 id = 0; id < m_strings.size(); id++) {
+        size_t slot = qHash(m_strings.at(id)) & mask;
+        while (slots[slot] != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = id + 1;
+    }
+    m_slots.swap(slots);
+}
+
+size_t StringPool::memoryUsage() const {
+    return m_strings.memoryUsage() + m_lower.memoryUsage() + m_slots.capacity() * sizeof(quint32);
+}
+
+void RowHashTable::clear() {
+    m_slots.clear();
+    m_count = 0;
+}
+
+void RowHashTable::insert(const uint hash, const quint32 row) {
+    if ((m_count + 1) * 2 > m_slots.size())
+        grow();
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = hash & mask;
+    while (m_slots[slot].row != 0)
+        slot = (slot + 1) & mask;
+    m_slots[slot] = Slot{hash, row + 1};
+    m_count++;
+}
+
+void RowHashTable::grow() {
+    std::vector<Slot> slots(std::max<size_t>(64, m_slots.size() * 2));
+    const size_t mask = slots.size() - 1;
+    for (const auto &old : m_slots) {
+        if (old.row == 0)
+            continue;
+        size_t slot = old.hash & mask;
+        while (slots[slot].row != 0)
+            slot = (slot + 1) & mask;
+        slots[slot] = old;
+    }
+    m_slots.swap(slots);
+}
+
+void SearchKeys::clear() {
+    m_keys.clear();
+    m_keysNoApos.clear();
+    m_noAposIdx.clear();
+}
+
+void SearchKeys::squeeze() {
+    m_keys.squeeze();
+    m_keysNoApos.squeeze();
+    m_noAposIdx.shrink_to_fit();
+}
+
+quint32 SearchKeys::append(const QString &str) {
+    QString key = str.toLower();
+    key.replace('&', " and ");
+    if (key.contains('\'')) {
+        m_noAposIdx.push_back(m_keysNoApos.append(QString(key).remove('\'')));
+    } else {
+        m_noAposIdx.push_back(noAposCopy);
+    }
+    return m_keys.append(key);
+}
+
+size_t SearchKeys::memoryUsage() const {
+    return m_keys.memoryUsage() + m_keysNoApos.memoryUsage() + m_noAposIdx.capacity() * sizeof(quint32);
+}
+
+void SongCatalog::clear() {
+    m_ids.clear();
+    m_durations.clear();
+    m_plays.clear();
+    m_lastPlays.clear();
+    m_artistIds.clear();
+    m_titleIds.clear();
+    m_songIdIds.clear();
+    m_dropped.clear();
+    m_artists.clear();
+    m_titles.clear();
+    m_songIds.clear();
+    m_filenames.clear();
+    m_paths.clear();
+    m_searchKeys.clear();
+    m_artistKeys.clear();
+    m_titleKeys.clear();
+    m_idIndex.clear();
+    m_pathIndex.clear();
+}
+
+void SongCatalog::squeeze() {
+    m_ids.shrink_to_fit();
+    m_durations.shrink_to_fit();
+    m_plays.shrink_to_fit();
+    m_lastPlays.shrink_to_fit();
+    m_artistIds.shrink_to_fit();
+    m_titleIds.shrink_to_fit();
+    m_songIdIds.shrink_to_fit();
+    m_dropped.shrink_to_fit();
+    m_artists.squeeze();
+    m_titles.squeeze();
+    m_songIds.squeeze();
+    m_filenames.squeeze();
+    m_paths.squeeze();
+    m_searchKeys.squeeze();
+    m_artistKeys.squeeze();
+    m_titleKeys.squeeze();
+}
+
+SongCatalog::Row SongCatalog::append(const KaraokeSong &song) {
+    m_ids.push_back(song.id);
+    m_durations.push_back(song.duration);
+    m_plays.push_back(song.plays);
+    m_lastPlays.push_back(song.lastPlay.isValid() ? song.lastPlay.toMSecsSinceEpoch() : noLastPlay);
+    m_artistIds.push_back(m_artists.intern(song.artist));
+    if (m_artistIds.back() == m_artistKeys.size())
+        m_artistKeys.append(song.artist);
+    m_titleIds.push_back(m_titles.intern(song.title));
+    if (m_titleIds.back() == m_titleKeys.size())
+        m_titleKeys.append(song.title);
+    m_songIdIds.push_back(m_songIds.intern(song.songid));
+    m_dropped.push_back(song.songid.contains("!!DROPPED!!"));
+    m_filenames.append(song.filename);
+    m_paths.append(song.path);
+    m_searchKeys.append(song.searchString);
+    const auto row = Row(m_ids.size() - 1);
+    m_idIndex.insert(qHash(song.id), row);
+    m_pathIndex.insert(qHash(song.path), row);
+    return row;
+}
+
+size_t SongCatalog::memoryUsage() const {
+    return (m_ids.capacity() + m_durations.capacity() + m_plays.capacity()) * sizeof(int) +
+           m_lastPlays.capacity() * sizeof(qint64) +
+           (m_artistIds.capacity() + m_titleIds.capacity() + m_songIdIds.capacity()) * sizeof(quint32) +
+           m_dropped.capacity() / 8 +
+           m_artists.memoryUsage() + m_titles.memoryUsage() + m_songIds.memoryUsage() +
+           m_filenames.memoryUsage() + m_paths.memoryUsage() + m_searchKeys.memoryUsage() +
+           m_artistKeys.memoryUsage() + m_titleKeys.memoryUsage() +
+           m_idIndex.memoryUsage() + m_pathIndex.memoryUsage();
+}
+
+QDateTime SongCatalog::lastPlay(const Row row) const {
+    if (m_lastPlays[row] == noLastPlay)
+        return QDateTime();
+    return QDateTime::fromMSecsSinceEpoch(m_lastPlays[row]);
+}
+
+KaraokeSong SongCatalog::song(const Row row) const {
+    return KaraokeSong{
+            id(row),
+            artist(row).toString(),
+            artistL(row).toString(),
+            title(row).toString(),
+            titleL(row).toString(),
+            songId(row).toString(),
+            songIdL(row).toString(),
+            duration(row),
+            filename(row).toString(),
+            path(row).toString(),
+            searchString(row).toString(),
+            plays(row),
+            lastPlay(row)
+    };
+}
+
+SongCatalog::Row SongCatalog::findById(const int id) const {
+    return m_idIndex.find(qHash(id), [&](const Row row) { return m_ids[row] == id; });
+}
+
+SongCatalog::Row SongCatalog::findByPath(const QString &path) const {
+    return m_pathIndex.find(qHash(path), [&](const Row row) { return m_paths.at(row) == path; });
+}
+
+void SongCatalog::recordPlay(const Row row, const QDateTime &when) {
+    m_plays[row]++;
+    m_lastPlays[row] = when.toMSecsSinceEpoch();
+}
@@ -0,0 +1,190 @@
+#ifndef SONGCATALOG_H
+#define SONGCATALOG_H
+
+#include <QDateTime>
+#include <QString>
+#include <QStringRef>
+#include <vector>
+
+struct KaraokeSong {
+    int id{0};
+    QString artist;
+    QString artistL;
+    QString title;
+    QString titleL;
+    QString songid;
+    QString songidL;
+    int duration{0};
+    QString filename;
+    QString path;
+    QString searchString;
+    int plays;
+    QDateTime lastPlay;
+};
+
+// Append-only string arena.  All strings share one character buffer and are
+// addressed by their insertion index, so storing a string costs its characters
+// plus a single offset instead of a separate heap allocation.
+class PackedStrings {
+public:
+    void clear();
+    void squeeze();
+    quint32 append(const QString &str);
+    [[nodiscard]] QStringRef at(const quint32 idx) const {
+        return {&m_chars, int(m_offsets[idx]), int(m_offsets[idx + 1] - m_offsets[idx])};
+    }
+    [[nodiscard]] size_t size() const { return m_offsets.size() - 1; }
+    [[nodiscard]] size_t memoryUsage() const;
+
+private:
+    QString m_chars;
+    std::vector<quint32> m_offsets{0};
+};
+
+// Deduplicating string pool, each distinct string is stored once along with its lowercase form.
+class StringPool {
+public:
+    void clear();
+    void squeeze();
+    quint32 intern(const QString &str);
+    [[nodiscard]] QStringRef at(const quint32 id) const { return m_strings.at(id); }
+    [[nodiscard]] QStringRef lowerAt(const quint32 id) const { return m_lower.at(id); }
+    [[nodiscard]] size_t size() const { return m_strings.size(); }
+    [[nodiscard]] size_t memoryUsage() const;
+
+private:
+    void grow();
+    PackedStrings m_strings;
+    PackedStrings m_lower;
+    // Open addressing hash table holding id + 1, 0 marks an empty slot
+    std::vector<quint32> m_slots;
+};
+
+// Pre-normalized search haystacks.  Keys are stored lowercased with '&' expanded
+// to " and ", and a second copy with apostrophes stripped is kept only for the
+// keys that actually contain one, so matching never has to allocate.
+class SearchKeys {
+public:
+    void clear();
+    void squeeze();
+    quint32 append(const QString &str);
+    [[nodiscard]] QStringRef at(const quint32 idx, const bool ignoreApos) const {
+        if (ignoreApos && m_noAposIdx[idx] != noAposCopy)
+            return m_keysNoApos.at(m_noAposIdx[idx]);
+        return m_keys.at(idx);
+    }
+    [[nodiscard]] size_t size() const { return m_keys.size(); }
+    [[nodiscard]] size_t memoryUsage() const;
+
+private:
+    static constexpr quint32 noAposCopy = 0xFFFFFFFF;
+    PackedStrings m_keys;
+    PackedStrings m_keysNoApos;
+    std::vector<quint32> m_noAposIdx;
+};
+
+// Open addressing hash table of catalog rows keyed by a caller supplied hash, the
+// caller also decides whether a row with a matching hash really is a match.
+// Entries are never removed, lookups return the newest matching row.
+class RowHashTable {
+public:
+    static constexpr quint32 noRow = 0xFFFFFFFF;
+    void clear();
+    void insert(uint hash, quint32 row);
+    template<typename Matches>
+    [[nodiscard]] quint32 find(const uint hash, Matches matches) const {
+        quint32 found = noRow;
+        if (m_slots.empty())
+            return found;
+        const size_t mask = m_slots.size() - 1;
+        for (size_t slot = hash & mask; m_slots[slot].row != 0; slot = (slot + 1) & mask) {
+            const quint32 row = m_slots[slot].row - 1;
+            if (m_slots[slot].hash == hash && (found == noRow || row > found) && matches(row))
+                found = row;
+        }
+        return found;
+    }
+    [[nodiscard]] size_t memoryUsage() const { return m_slots.capacity() * sizeof(Slot); }
+
+private:
+    struct Slot {
+        uint hash{0};
+        // Row + 1, 0 marks an empty slot
+        quint32 row{0};
+    };
+    void grow();
+    std::vector<Slot> m_slots;
+    size_t m_count{0};
+};
+
+// Column oriented storage for the karaoke song catalog.  Songs are addressed by
+// a stable row number that never changes once appended, sorting and filtering
+// are done on vectors of rows.  Rows are never removed, callers drop them from
+// their row lists instead.
+class SongCatalog {
+public:
+    using Row = quint32;
+    static constexpr Row noRow = RowHashTable::noRow;
+
+    void clear();
+    void squeeze();
+    // The lowercase fields of song are ignored, they are derived by the catalog.
+    Row append(const KaraokeSong &song);
+    [[nodiscard]] size_t size() const { return m_ids.size(); }
+    [[nodiscard]] size_t memoryUsage() const;
+
+    [[nodiscard]] int id(const Row row) const { return m_ids[row]; }
+    [[nodiscard]] QStringRef artist(const Row row) const { return m_artists.at(m_artistIds[row]); }
+    [[nodiscard]] QStringRef artistL(const Row row) const { return m_artists.lowerAt(m_artistIds[row]); }
+    [[nodiscard]] QStringRef title(const Row row) const { return m_titles.at(m_titleIds[row]); }
+    [[nodiscard]] QStringRef titleL(const Row row) const { return m_titles.lowerAt(m_titleIds[row]); }
+    [[nodiscard]] QStringRef songId(const Row row) const { return m_songIds.at(m_songIdIds[row]); }
+    [[nodiscard]] QStringRef songIdL(const Row row) const { return m_songIds.lowerAt(m_songIdIds[row]); }
+    [[nodiscard]] QStringRef filename(const Row row) const { return m_filenames.at(row); }
+    [[nodiscard]] QStringRef path(const Row row) const { return m_paths.at(row); }
+    [[nodiscard]] QStringRef searchString(const Row row) const { return m_searchKeys.at(row, false); }
+    [[nodiscard]] QStringRef searchKey(const Row row, const bool ignoreApos) const {
+        return m_searchKeys.at(row, ignoreApos);
+    }
+    [[nodiscard]] QStringRef artistKey(const Row row, const bool ignoreApos) const {
+        return m_artistKeys.at(m_artistIds[row], ignoreApos);
+    }
+    [[nodiscard]] QStringRef titleKey(const Row row, const bool ignoreApos) const {
+        return m_titleKeys.at(m_titleIds[row], ignoreApos);
+    }
+    [[nodiscard]] int duration(const Row row) const { return m_durations[row]; }
+    [[nodiscard]] int plays(const Row row) const { return m_plays[row]; }
+    [[nodiscard]] QDateTime lastPlay(const Row row) const;
+    [[nodiscard]] qint64 lastPlayMSecs(const Row row) const { return m_lastPlays[row]; }
+    [[nodiscard]] bool isDropped(const Row row) const { return m_dropped[row]; }
+    [[nodiscard]] KaraokeSong song(Row row) const;
+    // Newest row holding the given song id or path, noRow if there is none
+    [[nodiscard]] Row findById(int id) const;
+    [[nodiscard]] Row findByPath(const QString &path) const;
+
+    void setDuration(const Row row, const int duration) { m_durations[row] = duration; }
+    void recordPlay(Row row, const QDateTime &when);
+
+private:
+    std::vector<int> m_ids;
+    std::vector<int> m_durations;
+    std::vector<int> m_plays;
+    std::vector<qint64> m_lastPlays;
+    std::vector<quint32> m_artistIds;
+    std::vector<quint32> m_titleIds;
+    std::vector<quint32> m_songIdIds;
+    std::vector<bool> m_dropped;
+    StringPool m_artists;
+    StringPool m_titles;
+    StringPool m_songIds;
+    PackedStrings m_filenames;
+    PackedStrings m_paths;
+    // Indexed by row for the search string, by pool id for artist and title
+    SearchKeys m_searchKeys;
+    SearchKeys m_artistKeys;
+    SearchKeys m_titleKeys;
+    RowHashTable m_idIndex;
+    RowHashTable m_pathIndex;
+};
+
+#endif // SONGCATALOG_H
@@ -0,0 +1,92 @@
+#include "songsearchindex.h"
+
+#include <algorithm>
+#include <iterator>
+
+void SongSearchIndex::clear() {
+    m_postings.clear();
+}
+
+void SongSearchIndex::addSong(const int row, const QString &text) {
+    for (const auto trigram : trigramsFor(text)) {
+        auto &postings = m_postings[trigram];
+        // Rows are normally added in ascending order, so appending is the common case
+        if (postings.empty() || postings.back() < row) {
+            postings.push_back(row);
+            continue;
+        }
+        auto it = std::lower_bound(postings.begin(), postings.end(), row);
+        if (*it != row)
+            postings.insert(it, row);
+    }
+}
+
+void SongSearchIndex::removeSong(const int row, const QString &text) {
+    for (const auto trigram : trigramsFor(text)) {
+        auto postingsIt = m_postings.find(trigram);
+        if (postingsIt == m_postings.end())
+            continue;
+        auto &postings = postingsIt->second;
+        auto it = std::lower_bound(postings.begin(), postings.end(), row);
+        if (it != postings.end() && *it == row)
+            postings.erase(it);
+        if (postings.empty())
+            m_postings.erase(postingsIt);
+    }
+}
+
+bool SongSearchIndex::candidates(const QStringList &needles, std::vector<int> &result) const {
+    result.clear();
+    std::vector<Trigram> trigrams;
+    for (const auto &needle : needles) {
+        auto needleTrigrams = trigramsFor(needle);
+        trigrams.insert(trigrams.end(), needleTrigrams.begin(), needleTrigrams.end());
+    }
+    if (trigrams.empty())
+        return false;
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+
+    std::vector<const std::vector<int> *> lists;
+    lists.reserve(trigrams.size());
+    for (const auto trigram : trigrams) {
+        auto it = m_postings.find(trigram);
+        if (it == m_postings.end())
+            return true;
+        lists.emplace_back(&it->second);
+    }
+    // Intersect starting with the rarest trigram to keep the working set small
+    std::sort(lists.begin(), lists.end(), [](const std::vector<int> *a, const std::vector<int> *b) {
+        return a->size() < b->size();
+    });
+    result = *lists.front();
+    std::vector<int> scratch;
+    for (size_t i = 1; i < lists.size() && !result.empty(); i++) {
+        scratch.clear();
+        std::set_intersection(result.begin(), result.end(), lists[i]->begin(), lists[i]->end(),
+                              std::back_inserter(scratch));
+        result.swap(scratch);
+    }
+    return true;
+}
+
+std::vector<SongSearchIndex::Trigram> SongSearchIndex::trigramsFor(const QString &text) {
+    // Apostrophes are dropped before indexing so that both the "ignore apostrophes"
+    // and the literal search modes get a superset of their matches from the index.
+    QString normalized = text;
+    normalized.remove('\'');
+    std::vector<Trigram> trigrams;
+    if (normalized.size() < 3)
+        return trigrams;
+    trigrams.reserve(normalized.size() - 2);
+    const QChar *chars = normalized.constData();
+    for (int i = 0; i + 2 < normalized.size(); i++) {
+        if (chars[i] == ' ' || chars[i + 1] == ' ' || chars[i + 2] == ' ')
+            continue;
+        trigrams.emplace_back((Trigram(chars[i].unicode()) << 32) | (Trigram(chars[i + 1].unicode()) << 16) |
+                              Trigram(chars[i + 2].unicode()));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    return trigrams;
+}
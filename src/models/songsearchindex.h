@@ -0,0 +1,31 @@
+#ifndef SONGSEARCHINDEX_H
+#define SONGSEARCHINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <unordered_map>
+#include <vector>
+
+// Inverted trigram index over the lowercased search text of the karaoke songs.
+// Each trigram maps to an ascending list of catalog rows whose text contains it,
+// so a query only has to intersect a few posting lists instead of scanning the
+// whole catalog.  The index only narrows the candidate set, callers still have
+// to verify the candidates against the real haystack.
+class SongSearchIndex {
+public:
+    void clear();
+    void addSong(int row, const QString &text);
+    void removeSong(int row, const QString &text);
+    // Fills result with the rows of all songs that may match every needle.
+    // Returns false if the needles are too short to be served by the index,
+    // in which case the caller has to fall back to a full scan.
+    bool candidates(const QStringList &needles, std::vector<int> &result) const;
+    [[nodiscard]] size_t trigramCount() const { return m_postings.size(); }
+
+private:
+    using Trigram = quint64;
+    static std::vector<Trigram> trigramsFor(const QString &text);
+    std::unordered_map<Trigram, std::vector<int>> m_postings;
+};
+
+#endif // SONGSEARCHINDEX_H
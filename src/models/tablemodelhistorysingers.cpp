@@ -6,6 +6,7 @@
 #include <QPainter>
 #include <QSvgRenderer>
 #include "settings.h"
+#include "dbaccess.h"
 
 extern Settings settings;
 
@@ -74,12 +75,11 @@ QVariant TableModelHistorySingers::data(const QModelIndex &index, int role) cons
 
 int TableModelHistorySingers::getSongCount(const int historySingerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT COUNT(id) FROM historySongs WHERE historySinger = :historySinger");
-    query.bindValue(":historySinger", historySingerId);
-    query.exec();
-    if (query.next())
-        return query.value(0).toInt();
+    auto query = DbAccess::prepared("SELECT COUNT(id) FROM historySongs WHERE historySinger = :historySinger");
+    query->bindValue(":historySinger", historySingerId);
+    query->exec();
+    if (query->next())
+        return query->value(0).toInt();
     return 0;
 }
 
@@ -4,6 +4,10 @@
 #include <QSqlError>
 #include <QDebug>
 #include <QDateTime>
+#include "dbaccess.h"
+#include "dbwriter.h"
+
+extern DbWriter dbWriter;
 
 TableModelHistorySongs::TableModelHistorySongs(TableModelKaraokeSongs &songsModel) : m_karaokeSongsModel(songsModel)
 {
@@ -89,22 +93,21 @@ void TableModelHistorySongs::loadSinger(const int historySingerId)
     emit layoutAboutToBeChanged();
     beginInsertRows(QModelIndex(),m_songs.size(),m_songs.size());
     m_songs.clear();
-    QSqlQuery query;
-    query.prepare("SELECT * from historySongs WHERE historySinger = :historySinger");
-    query.bindValue(":historySinger", historySingerId);
-    query.exec();
-    while (query.next())
+    auto query = DbAccess::prepared("SELECT * from historySongs WHERE historySinger = :historySinger");
+    query->bindValue(":historySinger", historySingerId);
+    query->exec();
+    while (query->next())
     {
         HistorySong song;
-        song.id = query.value(0).toUInt();
-        song.historySinger = query.value(1).toUInt();
-        song.filePath = query.value(2).toString();
-        song.artist = query.value(3).toString();
-        song.title = query.value(4).toString();
-        song.songid = query.value(5).toString();
-        song.keyChange = query.value(6).toInt();
-        song.plays = query.value(7).toUInt();
-        song.lastPlayed = (query.value(8).canConvert<QDateTime>()) ? query.value(8).toDateTime() : QDateTime();
+        song.id = query->value(0).toUInt();
+        song.historySinger = query->value(1).toUInt();
+        song.filePath = query->value(2).toString();
+        song.artist = query->value(3).toString();
+        song.title = query->value(4).toString();
+        song.songid = query->value(5).toString();
+        song.keyChange = query->value(6).toInt();
+        song.plays = query->value(7).toUInt();
+        song.lastPlayed = (query->value(8).canConvert<QDateTime>()) ? query->value(8).toDateTime() : QDateTime();
         m_songs.emplace_back(song);
     }
     sort(m_lastSortColumn, m_lastSortOrder);
@@ -116,12 +119,11 @@ void TableModelHistorySongs::loadSinger(const QString historySingerName)
 {
     qInfo() << "SingerHistoryTableModel::loadSinger(" << historySingerName << ") called";
     m_currentSinger = historySingerName;
-    QSqlQuery query;
-    query.prepare("SELECT id FROM historySingers WHERE name == :name LIMIT 1");
-    query.bindValue(":name", historySingerName);
-    query.exec();
-    if (query.next())
-        loadSinger(query.value(0).toUInt());
+    auto query = DbAccess::prepared("SELECT id FROM historySingers WHERE name == :name LIMIT 1");
+    query->bindValue(":name", historySingerName);
+    query->exec();
+    if (query->next())
+        loadSinger(query->value(0).toUInt());
     else
     {
         qInfo() << "No history found for singer, nothing loaded";
@@ -139,24 +141,17 @@ void TableModelHistorySongs::saveSong(const QString &singerName, const QString &
         qInfo() << "Song was added via drop from external source, not saving to history";
         return;
     }
-    QSqlQuery query;
+    // The lookups below have to see songs saved moments ago
+    dbWriter.waitForWrites();
     auto historySingerId = getSingerId(singerName);
     if (historySingerId != -1 && songExists(historySingerId, filePath))
     {
         qInfo() << "Song already in singer history, updating existing record";
-        query.prepare("UPDATE historySongs SET artist = :artist, title = :title, songid = :songid, "
-                      "keychange = :keychange, plays = plays + 1, lastplay = :datetime "
-                      "WHERE filePath = :filepath AND historysinger = :historysinger");
-        query.bindValue(":artist", artist);
-        query.bindValue(":title", title);
-        query.bindValue(":songid", songid);
-        query.bindValue(":keychange", keyChange);
-        query.bindValue(":filepath", filePath);
-        query.bindValue(":historysinger", historySingerId);
-        query.bindValue(":datetime", QDateTime::currentDateTime());
-        query.exec();
-        loadSinger(m_currentSinger);
-        qInfo() << query.lastError();
+        dbWriter.enqueue("UPDATE historySongs SET artist = ?, title = ?, songid = ?, "
+                         "keychange = ?, plays = plays + 1, lastplay = ? "
+                         "WHERE filePath = ? AND historysinger = ?",
+                         {artist, title, songid, keyChange, QDateTime::currentDateTime(), filePath, historySingerId});
+        dbWriter.afterWrites(this, [this] () { loadSinger(m_currentSinger); });
         return;
     }
     if (historySingerId == -1)
@@ -165,24 +160,16 @@ void TableModelHistorySongs::saveSong(const QString &singerName, const QString &
         historySingerId = addSinger(singerName);
     }
     qInfo() << "Adding new song to singer history";
-    query.prepare("INSERT INTO historySongs (historySinger, filepath, artist, title, songid, keychange, plays, lastplay) "
-                  "values (:historySinger, :filepath, :artist, :title, :songid, :keychange, 1, :datetime)");
-    query.bindValue(":artist", artist);
-    query.bindValue(":title", title);
-    query.bindValue(":songid", songid);
-    query.bindValue(":keychange", keyChange);
-    query.bindValue(":filepath", filePath);
-    query.bindValue(":historySinger", historySingerId);
-    query.bindValue(":datetime", QDateTime::currentDateTime());
-    query.exec();
-    qInfo() << query.lastError();
-    loadSinger(m_currentSinger);
+    dbWriter.enqueue("INSERT INTO historySongs (historySinger, filepath, artist, title, songid, keychange, plays, lastplay) "
+                     "values (?, ?, ?, ?, ?, ?, 1, ?)",
+                     {historySingerId, filePath, artist, title, songid, keyChange, QDateTime::currentDateTime()});
+    dbWriter.afterWrites(this, [this] () { loadSinger(m_currentSinger); });
 }
 
 void TableModelHistorySongs::saveSong(const QString &singerName, const QString &filePath, const QString &artist, const QString &title, const QString &songid, const int keyChange, int plays, QDateTime lastPlayed)
 {
     qInfo() << "filepath: " << filePath;
-    QSqlQuery query;
+    dbWriter.waitForWrites();
     auto historySingerId = getSingerId(singerName);
     if (historySingerId != -1 && songExists(historySingerId, filePath))
     {
@@ -195,19 +182,10 @@ void TableModelHistorySongs::saveSong(const QString &singerName, const QString &
         historySingerId = addSinger(singerName);
     }
     qInfo() << "Adding new song to singer history";
-    query.prepare("INSERT INTO historySongs (historySinger, filepath, artist, title, songid, keychange, plays, lastplay) "
-                  "values (:historySinger, :filepath, :artist, :title, :songid, :keychange, :plays, :datetime)");
-    query.bindValue(":artist", artist);
-    query.bindValue(":title", title);
-    query.bindValue(":songid", songid);
-    query.bindValue(":keychange", keyChange);
-    query.bindValue(":filepath", filePath);
-    query.bindValue(":historySinger", historySingerId);
-    query.bindValue(":plays", plays);
-    query.bindValue(":datetime", lastPlayed);
-    query.exec();
-    qInfo() << query.lastError();
-    loadSinger(m_currentSinger);
+    dbWriter.enqueue("INSERT INTO historySongs (historySinger, filepath, artist, title, songid, keychange, plays, lastplay) "
+                     "values (?, ?, ?, ?, ?, ?, ?, ?)",
+                     {historySingerId, filePath, artist, title, songid, keyChange, plays, lastPlayed});
+    dbWriter.afterWrites(this, [this] () { loadSinger(m_currentSinger); });
 }
 
 void TableModelHistorySongs::deleteSong(const int historySongId)
@@ -232,12 +210,11 @@ int TableModelHistorySongs::addSinger(const QString name) const
 
 bool TableModelHistorySongs::songExists(const int historySingerId, const QString &filePath) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT id FROM historySongs WHERE historySinger = :historySinger AND filepath = :filePath LIMIT 1");
-    query.bindValue(":historySinger", historySingerId);
-    query.bindValue(":filePath", filePath);
-    query.exec();
-    if (query.next())
+    auto query = DbAccess::prepared("SELECT id FROM historySongs WHERE historySinger = :historySinger AND filepath = :filePath LIMIT 1");
+    query->bindValue(":historySinger", historySingerId);
+    query->bindValue(":filePath", filePath);
+    query->exec();
+    if (query->next())
         return true;
     return false;
 }
@@ -245,13 +222,12 @@ bool TableModelHistorySongs::songExists(const int historySingerId, const QString
 int TableModelHistorySongs::getSingerId(const QString &name) const
 {
     int retVal = -1;
-    QSqlQuery query;
-    query.prepare("SELECT id FROM historySingers WHERE name = :name LIMIT 1");
-    query.bindValue(":name", name);
-    query.exec();
-    if (query.next())
+    auto query = DbAccess::prepared("SELECT id FROM historySingers WHERE name = :name LIMIT 1");
+    query->bindValue(":name", name);
+    query->exec();
+    if (query->next())
     {
-        retVal = query.value(0).toInt();
+        retVal = query->value(0).toInt();
     }
     return retVal;
 }
@@ -259,22 +235,21 @@ int TableModelHistorySongs::getSingerId(const QString &name) const
 std::vector<HistorySong> TableModelHistorySongs::getSingerSongs(const int historySingerId)
 {
     std::vector<HistorySong> songs;
-    QSqlQuery query;
-    query.prepare("SELECT * from historySongs WHERE historySinger = :historySinger");
-    query.bindValue(":historySinger", historySingerId);
-    query.exec();
-    while (query.next())
+    auto query = DbAccess::prepared("SELECT * from historySongs WHERE historySinger = :historySinger");
+    query->bindValue(":historySinger", historySingerId);
+    query->exec();
+    while (query->next())
     {
         HistorySong song;
-        song.id = query.value(0).toUInt();
-        song.historySinger = query.value(1).toUInt();
-        song.filePath = query.value(2).toString();
-        song.artist = query.value(3).toString();
-        song.title = query.value(4).toString();
-        song.songid = query.value(5).toString();
-        song.keyChange = query.value(6).toInt();
-        song.plays = query.value(7).toUInt();
-        song.lastPlayed = query.value(8).toDateTime();
+        song.id = query->value(0).toUInt();
+        song.historySinger = query->value(1).toUInt();
+        song.filePath = query->value(2).toString();
+        song.artist = query->value(3).toString();
+        song.title = query->value(4).toString();
+        song.songid = query->value(5).toString();
+        song.keyChange = query->value(6).toInt();
+        song.plays = query->value(7).toUInt();
+        song.lastPlayed = query->value(8).toDateTime();
         songs.emplace_back(song);
     }
     return songs;
@@ -9,14 +9,24 @@
 #include <QSvgRenderer>
 #include <QMimeData>
 #include <QApplication>
+#include <QThread>
+#include <QtConcurrent>
 #include "settings.h"
+#include "dbwriter.h"
 
 extern Settings settings;
+extern DbWriter dbWriter;
 
 TableModelKaraokeSongs::TableModelKaraokeSongs(QObject *parent)
         : QAbstractTableModel(parent) {
     resizeIconsForFont(settings.applicationFont());
     connect(&searchTimer, &QTimer::timeout, this, &TableModelKaraokeSongs::searchExec);
+    connect(&m_searchWatcher, &QFutureWatcher<void>::finished, this, &TableModelKaraokeSongs::searchFinished);
+}
+
+TableModelKaraokeSongs::~TableModelKaraokeSongs() {
+    // Worker threads read straight from m_catalog, they have to be gone before it is destroyed
+    cancelSearch(true);
 }
 
 QVariant TableModelKaraokeSongs::headerData(int section, Qt::Orientation orientation, int role) const {
@@ -67,35 +77,37 @@ QVariant TableModelKaraokeSongs::data(const QModelIndex &index, int role) const
         }
     } else if (role == Qt::DecorationRole) {
         if (index.column() == COL_SONGID) {
-            if (m_filteredSongs.at(index.row())->path.endsWith("cdg", Qt::CaseInsensitive))
+            const auto path = m_catalog.path(m_filteredSongs.at(index.row()));
+            if (path.endsWith("cdg", Qt::CaseInsensitive))
                 return m_iconCdg;
-            else if (m_filteredSongs.at(index.row())->path.endsWith("zip", Qt::CaseInsensitive))
+            else if (path.endsWith("zip", Qt::CaseInsensitive))
                 return m_iconZip;
             else
                 return m_iconVid;
         }
     } else if (role == Qt::DisplayRole) {
+        const auto row = m_filteredSongs.at(index.row());
         switch (index.column()) {
             case TableModelKaraokeSongs::COL_ID:
-                return m_filteredSongs.at(index.row())->id;
+                return m_catalog.id(row);
             case TableModelKaraokeSongs::COL_ARTIST:
-                return m_filteredSongs.at(index.row())->artist;
+                return m_catalog.artist(row).toString();
             case TableModelKaraokeSongs::COL_TITLE:
-                return m_filteredSongs.at(index.row())->title;
+                return m_catalog.title(row).toString();
             case TableModelKaraokeSongs::COL_SONGID:
-                return m_filteredSongs.at(index.row())->songid;
+                return m_catalog.songId(row).toString();
             case TableModelKaraokeSongs::COL_FILENAME:
-                return m_filteredSongs.at(index.row())->filename;
+                return m_catalog.filename(row).toString();
             case TableModelKaraokeSongs::COL_DURATION:
-                if (m_filteredSongs.at(index.row())->duration < 1)
+                if (m_catalog.duration(row) < 1)
                     return QVariant();
-                return QTime(0, 0, 0, 0).addSecs(m_filteredSongs.at(index.row())->duration / 1000).toString(
+                return QTime(0, 0, 0, 0).addSecs(m_catalog.duration(row) / 1000).toString(
                         "m:ss");
             case TableModelKaraokeSongs::COL_PLAYS:
-                return m_filteredSongs.at(index.row())->plays;
+                return m_catalog.plays(row);
             case TableModelKaraokeSongs::COL_LASTPLAY:
                 QLocale locale;
-                return m_filteredSongs.at(index.row())->lastPlay.toString(
+                return m_catalog.lastPlay(row).toString(
                         locale.dateTimeFormat(QLocale::ShortFormat));
         }
     }
@@ -103,32 +115,53 @@ QVariant TableModelKaraokeSongs::data(const QModelIndex &index, int role) const
 }
 
 void TableModelKaraokeSongs::loadData() {
+    cancelSearch(true);
+    QElapsedTimer timer;
+    timer.start();
     emit layoutAboutToBeChanged();
     m_allSongs.clear();
     m_filteredSongs.clear();
+    m_catalog.clear();
+    m_searchIndex.clear();
+    for (auto it = m_missingPaths.begin(); it != m_missingPaths.end();) {
+        if (QFileInfo::exists(*it))
+            it = m_missingPaths.erase(it);
+        else
+            ++it;
+    }
+    // Play counts and durations may still be on their way to the database
+    dbWriter.waitForWrites();
     QSqlQuery query;
+    query.setForwardOnly(true);
     query.exec("SELECT songid,artist,title,discid,duration,filename,path,searchstring,plays,lastplay "
                "FROM dbsongs WHERE discid != '!!BAD!!'");
-    if (query.size() > 0)
-        m_filteredSongs.reserve(query.size());
     while (query.next()) {
-        auto song = m_allSongs.emplace_back(std::make_shared<KaraokeSong>(KaraokeSong{
+        if (!m_missingPaths.isEmpty() && m_missingPaths.contains(query.value(6).toString()))
+            continue;
+        // Lowercase fields are left empty, the catalog derives them once per distinct string
+        auto row = m_catalog.append(KaraokeSong{
                 query.value(0).toInt(),
                 query.value(1).toString(),
-                query.value(1).toString().toLower(),
+                QString(),
                 query.value(2).toString(),
-                query.value(2).toString().toLower(),
+                QString(),
                 query.value(3).toString(),
-                query.value(3).toString().toLower(),
+                QString(),
                 query.value(4).toInt(),
                 query.value(5).toString(),
                 query.value(6).toString(),
-                query.value(7).toString().replace('&', " and ").toLower(),
+                query.value(7).toString(),
                 query.value(8).toInt(),
                 query.value(9).toDateTime()
-        }));
+        });
+        m_allSongs.emplace_back(row);
+        m_searchIndex.addSong(int(row), searchIndexText(row));
     }
-    qInfo() << "Loaded " << m_filteredSongs.size() << " karaoke songs from database.";
+    m_catalog.squeeze();
+    rebuildSongPositions();
+    rebuildFilteredPositions();
+    qInfo() << "Loaded " << m_allSongs.size() << " karaoke songs from database in " << timer.elapsed()
+            << "ms, catalog size: " << m_catalog.memoryUsage() / 1024 << "KiB";
     search(m_lastSearch);
     emit layoutChanged();
 }
@@ -139,6 +172,8 @@ void TableModelKaraokeSongs::search(const QString &searchString) {
     m_lastSearch.replace('&', " and ");
     if (settings.ignoreAposInSearch())
         m_lastSearch.replace('\'', ' ');
+    // Results of a search still running are stale as soon as the search string changes
+    cancelSearch();
     if (searchTimer.isActive())
         searchTimer.stop();
     searchTimer.start(100);
@@ -146,56 +181,161 @@ void TableModelKaraokeSongs::search(const QString &searchString) {
 
 void TableModelKaraokeSongs::searchExec() {
     searchTimer.stop();
-    emit layoutAboutToBeChanged();
-    std::vector<std::string> searchTerms;
-    std::string s = m_lastSearch.toLower().toStdString();
-    std::string::size_type prev_pos = 0, pos = 0;
-    while ((pos = s.find(' ', pos)) != std::string::npos) {
-        searchTerms.emplace_back(s.substr(prev_pos, pos - prev_pos));
-        prev_pos = ++pos;
-    }
-    searchTerms.emplace_back(s.substr(prev_pos, pos - prev_pos));
-    m_filteredSongs.clear();
-    m_filteredSongs.reserve(m_allSongs.size());
+    cancelSearch();
+    auto job = std::make_shared<SearchJob>();
+    job->catalog = &m_catalog;
 #if QT_VERSION < QT_VERSION_CHECK(5, 15, 0)
-    auto needles = m_lastSearch.split(' ', QString::SplitBehavior::SkipEmptyParts);
+    job->needles = m_lastSearch.split(' ', QString::SplitBehavior::SkipEmptyParts);
 #else
-    auto needles = m_lastSearch.split(' ', Qt::SplitBehavior(Qt::SkipEmptyParts));
+    job->needles = m_lastSearch.split(' ', Qt::SplitBehavior(Qt::SkipEmptyParts));
 #endif
-    std::for_each(m_allSongs.begin(), m_allSongs.end(), [&](const std::shared_ptr<KaraokeSong> &song) {
-        if (song->songid.contains("!!DROPPED!!"))
-            return;
-        QString haystack;
-        switch (m_searchType) {
-            case TableModelKaraokeSongs::SEARCH_TYPE_ALL: {
-                haystack = song->searchString;
-                break;
-            }
-            case TableModelKaraokeSongs::SEARCH_TYPE_ARTIST: {
-                haystack = song->artistL.replace('&', " and ");
-                break;
-            }
-            case TableModelKaraokeSongs::SEARCH_TYPE_TITLE: {
-                haystack = song->titleL.replace('&', " and ");
-                break;
-            }
+    job->searchType = m_searchType;
+    job->ignoreApos = settings.ignoreAposInSearch();
+    std::vector<int> candidates;
+    if (m_searchIndex.candidates(job->needles, candidates)) {
+        // Map the index hits back to their position in the sorted song list
+        std::vector<quint32> positions;
+        positions.reserve(candidates.size());
+        for (const int row : candidates) {
+            if (m_allSongsPos.at(row) != noPosition)
+                positions.emplace_back(m_allSongsPos.at(row));
         }
-        if (settings.ignoreAposInSearch())
-            haystack.remove('\'');
-        bool match{true};
-        for (const auto &needle : needles) {
-            if (!haystack.contains(needle)) {
-                match = false;
-                break;
-            }
+        std::sort(positions.begin(), positions.end());
+        job->rows.reserve(positions.size());
+        for (const auto pos : positions)
+            job->rows.emplace_back(m_allSongs.at(pos));
+    } else {
+        // Search terms too short for the trigram index, fall back to a full scan
+        job->rows = m_allSongs;
+    }
+    // Several chunks per core so that a canceled search stops quickly and the load stays balanced
+    const size_t chunkSize = std::max<size_t>(1024, job->rows.size() / (QThread::idealThreadCount() * 4) + 1);
+    for (size_t begin = 0; begin < job->rows.size(); begin += chunkSize)
+        job->chunks.push_back(SearchChunk{begin, std::min(begin + chunkSize, job->rows.size()), {}});
+    m_searchJob = job;
+    m_searchWatcher.setFuture(QtConcurrent::map(job->chunks, [job](SearchChunk &chunk) {
+        if (job->canceled)
+            return;
+        for (size_t i = chunk.begin; i < chunk.end; i++) {
+            if (songMatches(*job->catalog, job->rows[i], job->needles, job->searchType, job->ignoreApos))
+                chunk.matches.emplace_back(job->rows[i]);
         }
-        if (match)
-            m_filteredSongs.emplace_back(song);
-    });
-    m_filteredSongs.shrink_to_fit();
+    }));
+}
+
+void TableModelKaraokeSongs::searchFinished() {
+    if (!m_searchJob || m_searchWatcher.isCanceled())
+        return;
+    auto job = std::move(m_searchJob);
+    size_t matchCount{0};
+    for (const auto &chunk : job->chunks)
+        matchCount += chunk.matches.size();
+    emit layoutAboutToBeChanged();
+    m_filteredSongs.clear();
+    m_filteredSongs.reserve(matchCount);
+    for (auto &chunk : job->chunks)
+        m_filteredSongs.insert(m_filteredSongs.end(), chunk.matches.begin(), chunk.matches.end());
+    rebuildFilteredPositions();
     emit layoutChanged();
 }
 
+bool TableModelKaraokeSongs::cancelSearch(const bool wait) {
+    if (!m_searchJob)
+        return false;
+    m_searchJob->canceled = true;
+    m_searchWatcher.cancel();
+    // Chunks that already started still read the catalog, wait for them before it is modified
+    if (wait)
+        m_searchWatcher.waitForFinished();
+    m_searchJob.reset();
+    return true;
+}
+
+bool TableModelKaraokeSongs::songMatches(const SongCatalog &catalog, const SongCatalog::Row row,
+                                         const QStringList &needles, const SearchType searchType,
+                                         const bool ignoreApos) {
+    if (catalog.isDropped(row))
+        return false;
+    QStringRef haystack;
+    switch (searchType) {
+        case TableModelKaraokeSongs::SEARCH_TYPE_ALL: {
+            haystack = catalog.searchKey(row, ignoreApos);
+            break;
+        }
+        case TableModelKaraokeSongs::SEARCH_TYPE_ARTIST: {
+            haystack = catalog.artistKey(row, ignoreApos);
+            break;
+        }
+        case TableModelKaraokeSongs::SEARCH_TYPE_TITLE: {
+            haystack = catalog.titleKey(row, ignoreApos);
+            break;
+        }
+    }
+    for (const auto &needle : needles) {
+        if (!haystack.contains(needle))
+            return false;
+    }
+    return true;
+}
+
+void TableModelKaraokeSongs::rebuildSongPositions() {
+    m_allSongsPos.assign(m_catalog.size(), noPosition);
+    for (size_t i = 0; i < m_allSongs.size(); i++)
+        m_allSongsPos[m_allSongs[i]] = quint32(i);
+}
+
+void TableModelKaraokeSongs::rebuildFilteredPositions() {
+    m_filteredPos.assign(m_catalog.size(), noPosition);
+    for (size_t i = 0; i < m_filteredSongs.size(); i++)
+        m_filteredPos[m_filteredSongs[i]] = quint32(i);
+}
+
+SongCatalog::Row TableModelKaraokeSongs::liveRowForId(const int songId) const {
+    // The catalog keeps rows of removed songs around, only report the ones still listed
+    const auto row = m_catalog.findById(songId);
+    if (row == SongCatalog::noRow || m_allSongsPos[row] == noPosition)
+        return SongCatalog::noRow;
+    return row;
+}
+
+SongCatalog::Row TableModelKaraokeSongs::liveRowForPath(const QString &path) const {
+    const auto row = m_catalog.findByPath(path);
+    if (row == SongCatalog::noRow || m_allSongsPos[row] == noPosition)
+        return SongCatalog::noRow;
+    return row;
+}
+
+QString TableModelKaraokeSongs::searchIndexText(const SongCatalog::Row row) const {
+    // Artist and title are included explicitly so that the index is a superset of
+    // every search type even if the stored search string is stale or empty.
+    QString text;
+    text.append(m_catalog.searchKey(row, false));
+    text.append(' ');
+    text.append(m_catalog.artistKey(row, false));
+    text.append(' ');
+    text.append(m_catalog.titleKey(row, false));
+    return text;
+}
+
+void TableModelKaraokeSongs::removeSongsWithPath(const QString &path) {
+    const auto catalogRow = liveRowForPath(path);
+    if (catalogRow == SongCatalog::noRow)
+        return;
+    if (m_filteredPos[catalogRow] != noPosition) {
+        emit layoutAboutToBeChanged();
+        m_filteredSongs.erase(m_filteredSongs.begin() + m_filteredPos[catalogRow]);
+        rebuildFilteredPositions();
+        emit layoutChanged();
+    }
+
+    m_searchIndex.removeSong(int(catalogRow), searchIndexText(catalogRow));
+    m_allSongs.erase(m_allSongs.begin() + m_allSongsPos[catalogRow]);
+    rebuildSongPositions();
+    // An in-flight search may still hold the removed song, run it again
+    if (cancelSearch())
+        search(m_lastSearch);
+}
+
 void TableModelKaraokeSongs::setSearchType(TableModelKaraokeSongs::SearchType type) {
     if (m_searchType == type)
         return;
@@ -204,56 +344,38 @@ void TableModelKaraokeSongs::setSearchType(TableModelKaraokeSongs::SearchType ty
 }
 
 int TableModelKaraokeSongs::getIdForPath(const QString &path) {
-    auto it = std::find_if(m_allSongs.begin(), m_allSongs.end(), [&](const std::shared_ptr<KaraokeSong> &song) {
-        return (song->path == path);
-    });
-    if (it == m_allSongs.end())
+    const auto catalogRow = liveRowForPath(path);
+    if (catalogRow == SongCatalog::noRow)
         return -1;
-    return it->get()->id;
+    return m_catalog.id(catalogRow);
 }
 
 QString TableModelKaraokeSongs::getPath(const int songId) {
-    auto it = std::find_if(m_allSongs.begin(), m_allSongs.end(), [&songId](const std::shared_ptr<KaraokeSong> &song) {
-        return (song->id == songId);
-    });
-    return it->get()->path;
+    const auto catalogRow = liveRowForId(songId);
+    if (catalogRow == SongCatalog::noRow)
+        return QString();
+    return m_catalog.path(catalogRow).toString();
 }
 
 void TableModelKaraokeSongs::updateSongHistory(const int songId) {
-    auto it = find_if(m_allSongs.begin(), m_allSongs.end(), [&songId](const std::shared_ptr<KaraokeSong> &song) {
-        if (song->id == songId)
-            return true;
-        return false;
-    });
-    if (it != m_allSongs.end()) {
-        it->get()->plays++;
-        it->get()->lastPlay = QDateTime::currentDateTime();
-    }
-
-    auto it2 = find_if(m_filteredSongs.begin(), m_filteredSongs.end(),
-                       [&songId](const std::shared_ptr<KaraokeSong> &song) {
-                           if (song->id == songId)
-                               return true;
-                           return false;
-                       });
-    if (it2 != m_filteredSongs.end()) {
-        int row = (int) std::distance(m_filteredSongs.begin(), it2);
-        emit dataChanged(this->index(row, COL_PLAYS), this->index(row, COL_LASTPLAY), QVector<int>(Qt::DisplayRole));
+    if (const auto catalogRow = liveRowForId(songId); catalogRow != SongCatalog::noRow) {
+        m_catalog.recordPlay(catalogRow, QDateTime::currentDateTime());
+        if (m_filteredPos[catalogRow] != noPosition) {
+            int row = int(m_filteredPos[catalogRow]);
+            emit dataChanged(this->index(row, COL_PLAYS), this->index(row, COL_LASTPLAY),
+                             QVector<int>(Qt::DisplayRole));
+        }
     }
 
-    QSqlQuery query;
-    query.prepare("UPDATE dbSongs set plays = plays + :incVal, lastplay = :curTs WHERE songid = :songid");
-    query.bindValue(":curTs", QDateTime::currentDateTime());
-    query.bindValue(":songid", songId);
-    query.bindValue(":incVal", 1);
-    query.exec();
+    dbWriter.enqueue("UPDATE dbSongs set plays = plays + 1, lastplay = ? WHERE songid = ?",
+                     {QDateTime::currentDateTime(), songId});
 }
 
-KaraokeSong &TableModelKaraokeSongs::getSong(const int songId) {
-    auto it = std::find_if(m_allSongs.begin(), m_allSongs.end(), [&songId](const std::shared_ptr<KaraokeSong> &song) {
-        return (song->id == songId);
-    });
-    return **it;
+KaraokeSong TableModelKaraokeSongs::getSong(const int songId) {
+    const auto catalogRow = liveRowForId(songId);
+    if (catalogRow == SongCatalog::noRow)
+        return KaraokeSong();
+    return m_catalog.song(catalogRow);
 }
 
 void TableModelKaraokeSongs::resizeIconsForFont(const QFont &font) {
@@ -295,37 +417,37 @@ void TableModelKaraokeSongs::sort(int column, Qt::SortOrder order) {
     m_lastSortColumn = column;
     m_lastSortOrder = order;
 
-    auto sortLambda = [&column](const std::shared_ptr<KaraokeSong> &a, const std::shared_ptr<KaraokeSong> &b) -> bool {
+    auto sortLambda = [&](const SongCatalog::Row a, const SongCatalog::Row b) -> bool {
         switch (column) {
             case COL_ARTIST:
-                if (a->artistL == b->artistL) {
-                    if (a->titleL == b->titleL) {
-                        return (a->songidL < b->songidL);
+                if (m_catalog.artistL(a) == m_catalog.artistL(b)) {
+                    if (m_catalog.titleL(a) == m_catalog.titleL(b)) {
+                        return (m_catalog.songIdL(a) < m_catalog.songIdL(b));
                     }
-                    return (a->titleL < b->titleL);
+                    return (m_catalog.titleL(a) < m_catalog.titleL(b));
                 }
-                return (a->artistL < b->artistL);
+                return (m_catalog.artistL(a) < m_catalog.artistL(b));
             case COL_TITLE:
-                if (a->titleL == b->titleL) {
-                    if (a->artistL == b->artistL) {
-                        return (a->songidL < b->songidL);
+                if (m_catalog.titleL(a) == m_catalog.titleL(b)) {
+                    if (m_catalog.artistL(a) == m_catalog.artistL(b)) {
+                        return (m_catalog.songIdL(a) < m_catalog.songIdL(b));
                     }
-                    return (a->artistL < b->artistL);
+                    return (m_catalog.artistL(a) < m_catalog.artistL(b));
                 }
-                return (a->titleL < b->titleL);
+                return (m_catalog.titleL(a) < m_catalog.titleL(b));
             case COL_SONGID:
-                return (a->songidL < b->songidL);
+                return (m_catalog.songIdL(a) < m_catalog.songIdL(b));
             case COL_FILENAME:
-                return (a->filename.toLower() < b->filename.toLower());
+                return (QStringRef::compare(m_catalog.filename(a), m_catalog.filename(b), Qt::CaseInsensitive) < 0);
             case COL_DURATION:
-                return (a->duration < b->duration);
+                return (m_catalog.duration(a) < m_catalog.duration(b));
             case COL_PLAYS:
-                return (a->plays < b->plays);
+                return (m_catalog.plays(a) < m_catalog.plays(b));
             case COL_LASTPLAY:
-                return (a->lastPlay < b->lastPlay);
+                return (m_catalog.lastPlayMSecs(a) < m_catalog.lastPlayMSecs(b));
 
             default:
-                return (a->id < b->id);
+                return (m_catalog.id(a) < m_catalog.id(b));
         }
     };
 
@@ -335,24 +457,18 @@ void TableModelKaraokeSongs::sort(int column, Qt::SortOrder order) {
     } else {
         std::sort(m_allSongs.rbegin(), m_allSongs.rend(), sortLambda);
     }
+    rebuildSongPositions();
     QApplication::restoreOverrideCursor();
     search(m_lastSearch);
 }
 
 void TableModelKaraokeSongs::setSongDuration(QString &path, int duration) {
-    auto it = find_if(m_allSongs.begin(), m_allSongs.end(), [&path](const std::shared_ptr<KaraokeSong> &song) {
-        return (song->path == path);
-    });
-    if (it == m_allSongs.end())
+    const auto catalogRow = liveRowForPath(path);
+    if (catalogRow == SongCatalog::noRow)
         return;
-    it->get()->duration = duration;
-    int songId = it->get()->id;
-    auto it2 = find_if(m_filteredSongs.begin(), m_filteredSongs.end(),
-                       [&songId](const std::shared_ptr<KaraokeSong> &song) {
-                           return (song->id == songId);
-                       });
-    if (it2 != m_filteredSongs.end()) {
-        int row = (int) std::distance(m_filteredSongs.begin(), it2);
+    m_catalog.setDuration(catalogRow, duration);
+    if (m_filteredPos[catalogRow] != noPosition) {
+        int row = int(m_filteredPos[catalogRow]);
         emit dataChanged(this->index(row, COL_DURATION), this->index(row, COL_DURATION), QVector<int>(Qt::DisplayRole));
     }
 }
@@ -363,20 +479,14 @@ void TableModelKaraokeSongs::markSongBad(QString path) {
     query.bindValue(":path", path);
     query.exec();
 
-    emit layoutAboutToBeChanged();
-    auto newFilteredEnd = std::remove_if(m_filteredSongs.begin(), m_filteredSongs.end(),
-                                         [&path](const std::shared_ptr<KaraokeSong> &song) {
-                                             return (song->path == path);
-                                         });
-    m_filteredSongs.erase(newFilteredEnd, m_filteredSongs.end());
-    emit layoutChanged();
-
-    auto newAllSongsEnd = std::remove_if(m_allSongs.begin(), m_allSongs.end(),
-                                         [&path](const std::shared_ptr<KaraokeSong> &song) {
-                                             return (song->path == path);
-                                         });
-    m_allSongs.erase(newAllSongsEnd, m_allSongs.end());
+    removeSongsWithPath(path);
+}
 
+void TableModelKaraokeSongs::hideMissingSongs(const QStringList &paths) {
+    for (const auto &path : paths) {
+        m_missingPaths.insert(path);
+        removeSongsWithPath(path);
+    }
 }
 
 TableModelKaraokeSongs::DeleteStatus TableModelKaraokeSongs::removeBadSong(QString path) {
@@ -393,19 +503,7 @@ TableModelKaraokeSongs::DeleteStatus TableModelKaraokeSongs::removeBadSong(QStri
         query.bindValue(":path", path);
         query.exec();
 
-        emit layoutAboutToBeChanged();
-        auto newFilteredEnd = std::remove_if(m_filteredSongs.begin(), m_filteredSongs.end(),
-                                             [&path](const std::shared_ptr<KaraokeSong> &song) {
-                                                 return (song->path == path);
-                                             });
-        m_filteredSongs.erase(newFilteredEnd, m_filteredSongs.end());
-
-        emit layoutChanged();
-        auto newAllSongsEnd = std::remove_if(m_allSongs.begin(), m_allSongs.end(),
-                                             [&path](const std::shared_ptr<KaraokeSong> &song) {
-                                                 return (song->path == path);
-                                             });
-        m_allSongs.erase(newAllSongsEnd, m_allSongs.end());
+        removeSongsWithPath(path);
 
         if (isCdg) {
             if (!QFile::remove(mediaFile)) {
@@ -468,7 +566,13 @@ int TableModelKaraokeSongs::addSong(KaraokeSong song) {
     if (query.lastInsertId().isValid()) {
         int lastInsertId = query.lastInsertId().toInt();
         song.id = lastInsertId;
-        m_allSongs.push_back(std::make_shared<KaraokeSong>(song));
+        // Appending may reallocate the catalog columns under a running search
+        cancelSearch(true);
+        const auto row = m_catalog.append(song);
+        m_allSongs.push_back(row);
+        m_allSongsPos.push_back(quint32(m_allSongs.size() - 1));
+        m_filteredPos.push_back(noPosition);
+        m_searchIndex.addSong(int(row), searchIndexText(row));
         search(m_lastSearch);
         return lastInsertId;
     } else {
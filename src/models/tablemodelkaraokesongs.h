@@ -5,23 +5,13 @@
 #include <QDateTime>
 #include <QImage>
 #include <memory>
+#include <atomic>
 #include <QTimer>
-
-struct KaraokeSong {
-    int id{0};
-    QString artist;
-    QString artistL;
-    QString title;
-    QString titleL;
-    QString songid;
-    QString songidL;
-    int duration{0};
-    QString filename;
-    QString path;
-    QString searchString;
-    int plays;
-    QDateTime lastPlay;
-};
+#include <QFutureWatcher>
+#include <QSet>
+#include <QElapsedTimer>
+#include "songcatalog.h"
+#include "songsearchindex.h"
 
 class TableModelKaraokeSongs : public QAbstractTableModel {
 Q_OBJECT
@@ -49,6 +39,7 @@ public:
     };
 
     explicit TableModelKaraokeSongs(QObject *parent = nullptr);
+    ~TableModelKaraokeSongs() override;
     [[nodiscard]] QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
     [[nodiscard]] int rowCount(const QModelIndex &parent) const override;
     [[nodiscard]] int columnCount(const QModelIndex &parent) const override;
@@ -62,16 +53,46 @@ public:
     int getIdForPath(const QString &path);
     QString getPath(int songId);
     void updateSongHistory(int songId);
-    KaraokeSong &getSong(int songId);
+    KaraokeSong getSong(int songId);
     void markSongBad(QString path);
+    // Hides songs whose files are gone for the rest of the session, they come back on
+    // their own once the files are there again
+    void hideMissingSongs(const QStringList &paths);
     DeleteStatus removeBadSong(QString path);
     static QString findCdgAudioFile(const QString& path);
     int addSong(KaraokeSong song);
 
 
 private:
-    std::vector<std::shared_ptr<KaraokeSong>> m_filteredSongs;
-    std::vector< std::shared_ptr<KaraokeSong> > m_allSongs;
+    struct SearchChunk {
+        size_t begin{0};
+        size_t end{0};
+        std::vector<SongCatalog::Row> matches;
+    };
+    // Snapshot of everything a background search needs, shared with the worker threads.
+    // The catalog itself is not copied, it must not be appended to while a job runs.
+    struct SearchJob {
+        const SongCatalog *catalog{nullptr};
+        std::vector<SongCatalog::Row> rows;
+        std::vector<SearchChunk> chunks;
+        QStringList needles;
+        SearchType searchType{SearchType::SEARCH_TYPE_ALL};
+        bool ignoreApos{false};
+        std::atomic_bool canceled{false};
+    };
+    SongCatalog m_catalog;
+    std::vector<SongCatalog::Row> m_filteredSongs;
+    // Catalog rows of all usable songs in the current sort order
+    std::vector<SongCatalog::Row> m_allSongs;
+    static constexpr quint32 noPosition = 0xFFFFFFFF;
+    // Position of each catalog row in m_allSongs, used to return index hits in sort
+    // order, noPosition for rows that are no longer part of the song list
+    std::vector<quint32> m_allSongsPos;
+    // Position of each catalog row in m_filteredSongs, noPosition if it is filtered out
+    std::vector<quint32> m_filteredPos;
+    SongSearchIndex m_searchIndex;
+    // Paths of songs found missing from disk, skipped when loading
+    QSet<QString> m_missingPaths;
     QString m_lastSearch;
     Qt::SortOrder m_lastSortOrder{Qt::AscendingOrder};
     int m_lastSortColumn{1};
@@ -83,7 +104,19 @@ private:
 
     void resizeIconsForFont(const QFont &font);
     void searchExec();
+    void searchFinished();
+    bool cancelSearch(bool wait = false);
+    void rebuildSongPositions();
+    void rebuildFilteredPositions();
+    [[nodiscard]] SongCatalog::Row liveRowForId(int songId) const;
+    [[nodiscard]] SongCatalog::Row liveRowForPath(const QString &path) const;
+    void removeSongsWithPath(const QString &path);
+    [[nodiscard]] QString searchIndexText(SongCatalog::Row row) const;
+    static bool songMatches(const SongCatalog &catalog, SongCatalog::Row row, const QStringList &needles,
+                            SearchType searchType, bool ignoreApos);
     QTimer searchTimer{this};
+    std::shared_ptr<SearchJob> m_searchJob;
+    QFutureWatcher<void> m_searchWatcher;
 
 public slots:
 
@@ -24,6 +24,7 @@
 #include <QSqlQuery>
 #include <QSqlRecord>
 #include <QDebug>
+#include "dirmanifest.h"
 
 #define UNUSED(x) (void)x
 
@@ -183,6 +184,7 @@ void TableModelKaraokeSourceDirs::delSourceDir(int index)
     int dbid = mydata.at(index).getIndex();
     QSqlQuery query;
     query.exec("DELETE FROM sourceDirs WHERE ROWID == " + QString::number(dbid));
+    DirManifest::remove(QSqlDatabase::database(), mydata.at(index).getPath());
     layoutAboutToBeChanged();
     loadFromDB();
     layoutChanged();
@@ -10,12 +10,24 @@
 #include <QUrl>
 #include <QSvgRenderer>
 #include "settings.h"
+#include "dbaccess.h"
+#include "dbwriter.h"
 
 extern Settings settings;
+extern DbWriter dbWriter;
 
 TableModelQueueSongs::TableModelQueueSongs(TableModelKaraokeSongs &karaokeSongsModel, QObject *parent)
     : QAbstractTableModel(parent), m_karaokeSongsModel(karaokeSongsModel)
 {
+    // Multi-song drags move one song at a time, write the queue once they're all done
+    m_commitTimer.setSingleShot(true);
+    m_commitTimer.setInterval(0);
+    connect(&m_commitTimer, &QTimer::timeout, this, &TableModelQueueSongs::commitChanges);
+}
+
+TableModelQueueSongs::~TableModelQueueSongs()
+{
+    commitPendingChanges();
 }
 
 QVariant TableModelQueueSongs::headerData(int section, Qt::Orientation orientation, int role) const
@@ -118,37 +130,40 @@ QVariant TableModelQueueSongs::data(const QModelIndex &index, int role) const
 void TableModelQueueSongs::loadSinger(const int singerId)
 {
     qInfo() << "loadSinger( " << singerId << " ) fired";
+    commitPendingChanges();
+    dbWriter.waitForWrites();
     emit layoutAboutToBeChanged();
     m_songs.clear();
     m_songs.shrink_to_fit();
+    m_storedPositions.clear();
     m_curSingerId = singerId;
-    QSqlQuery query;
-    query.prepare("SELECT queuesongs.qsongid, queuesongs.singer, queuesongs.song, queuesongs.played, "
-                  "queuesongs.keychg, queuesongs.position, rotationsingers.name, dbsongs.artist, "
-                  "dbsongs.title, dbsongs.discid, dbsongs.duration, dbsongs.path FROM queuesongs "
-                  "INNER JOIN rotationsingers ON rotationsingers.singerid = queuesongs.singer "
-                  "INNER JOIN dbsongs ON dbsongs.songid = queuesongs.song WHERE queuesongs.singer = :singerId "
-                  "ORDER BY queuesongs.position");
-    query.bindValue(":singerId", singerId);
-    query.exec();
-    qInfo() << query.lastError();
-    //qInfo() << query.lastQuery();
-    qInfo() << "quey returned " << query.size() << " rows";
-    while (query.next())
+    auto query = DbAccess::prepared("SELECT queuesongs.qsongid, queuesongs.singer, queuesongs.song, queuesongs.played, "
+                                    "queuesongs.keychg, queuesongs.position, rotationsingers.name, dbsongs.artist, "
+                                    "dbsongs.title, dbsongs.discid, dbsongs.duration, dbsongs.path FROM queuesongs "
+                                    "INNER JOIN rotationsingers ON rotationsingers.singerid = queuesongs.singer "
+                                    "INNER JOIN dbsongs ON dbsongs.songid = queuesongs.song WHERE queuesongs.singer = :singerId "
+                                    "ORDER BY queuesongs.position");
+    query->bindValue(":singerId", singerId);
+    query->exec();
+    qInfo() << query->lastError();
+    //qInfo() << query->lastQuery();
+    qInfo() << "quey returned " << query->size() << " rows";
+    while (query->next())
     {
         m_songs.emplace_back(QueueSong{
-                                query.value(0).toInt(),
-                                 query.value(1).toInt(),
-                                 query.value(2).toInt(),
-                                 query.value(3).toBool(),
-                                 query.value(4).toInt(),
-                                 query.value(5).toInt(),
-                                 query.value(7).toString(),
-                                 query.value(8).toString(),
-                                 query.value(9).toString(),
-                                 query.value(10).toInt(),
-                                 query.value(11).toString()
+                                query->value(0).toInt(),
+                                 query->value(1).toInt(),
+                                 query->value(2).toInt(),
+                                 query->value(3).toBool(),
+                                 query->value(4).toInt(),
+                                 query->value(5).toInt(),
+                                 query->value(7).toString(),
+                                 query->value(8).toString(),
+                                 query->value(9).toString(),
+                                 query->value(10).toInt(),
+                                 query->value(11).toString()
                              });
+        m_storedPositions[m_songs.back().id] = m_songs.back().position;
     }
     emit layoutChanged();
 }
@@ -215,7 +230,7 @@ void TableModelQueueSongs::move(const int oldPosition, const int newPosition)
         return (a.position < b.position);
     });
     emit layoutChanged();
-    commitChanges();
+    scheduleCommit();
     emit queueModified(m_curSingerId);
 }
 
@@ -227,16 +242,18 @@ void TableModelQueueSongs::moveSongId(const int songId, const int newPosition)
 int TableModelQueueSongs::add(const int songId)
 {
     KaraokeSong ksong = m_karaokeSongsModel.getSong(songId);
-    QSqlQuery query;
-    query.prepare("INSERT INTO queuesongs (singer,song,artist,title,discid,path,keychg,played,position) "
-                  "VALUES (:singerId,:songId,:songId,:songId,:songId,:songId,:key,:played,:position)");
-    query.bindValue(":singerId", m_curSingerId);
-    query.bindValue(":songId", songId);
-    query.bindValue(":key", 0);
-    query.bindValue(":played", false);
-    query.bindValue(":position", (int)m_songs.size());
-    query.exec();
-    auto queueSongId = query.lastInsertId().toInt();
+    // The new id comes from the database, so anything queued before has to be in there first
+    dbWriter.waitForWrites();
+    auto query = DbAccess::prepared("INSERT INTO queuesongs (singer,song,artist,title,discid,path,keychg,played,position) "
+                                    "VALUES (:singerId,:songId,:songId,:songId,:songId,:songId,:key,:played,:position)");
+    query->bindValue(":singerId", m_curSingerId);
+    query->bindValue(":songId", songId);
+    query->bindValue(":key", 0);
+    query->bindValue(":played", false);
+    query->bindValue(":position", (int)m_songs.size());
+    query->exec();
+    auto queueSongId = query->lastInsertId().toInt();
+    m_storedPositions[queueSongId] = (int)m_songs.size();
     emit layoutAboutToBeChanged();
     m_songs.emplace_back(QueueSong{
                              queueSongId,
@@ -276,17 +293,13 @@ void TableModelQueueSongs::remove(const int songId)
     });
     emit layoutChanged();
     qInfo() << "songs after delete" << m_songs.size();
-    commitChanges();
+    scheduleCommit();
     emit queueModified(m_curSingerId);
 }
 
 void TableModelQueueSongs::setKey(const int songId, const int semitones)
 {
-    QSqlQuery query;
-    query.prepare("UPDATE queuesongs SET keychg = :key WHERE qsongid = :id");
-    query.bindValue(":id", songId);
-    query.bindValue(":key", semitones);
-    query.exec();
+    dbWriter.enqueue("UPDATE queuesongs SET keychg = ? WHERE qsongid = ?", {semitones, songId});
     auto it = std::find_if(m_songs.begin(), m_songs.end(), [&songId] (QueueSong &song)
     {
         return (song.id == songId);
@@ -295,20 +308,25 @@ void TableModelQueueSongs::setKey(const int songId, const int semitones)
         return;
     it->keyChange = semitones;
     emit dataChanged(this->index(it->position, COL_KEY),this->index(it->position, COL_KEY),QVector<int>{Qt::DisplayRole});
+    emit queueModified(m_curSingerId);
 }
 
 void TableModelQueueSongs::setPlayed(const int songId, const bool played) {
     qInfo() << "Setting songId " << songId << " to played = " << played;
-    QSqlQuery query;
-    query.prepare("UPDATE queuesongs SET played = :played WHERE qsongid = :id");
-    query.bindValue(":id", songId);
-    query.bindValue(":played", played);
-    query.exec();
+    dbWriter.enqueue("UPDATE queuesongs SET played = ? WHERE qsongid = ?", {played, songId});
     auto it = std::find_if(m_songs.begin(), m_songs.end(), [&songId](QueueSong &song) {
         return (song.id == songId);
     });
     if (it == m_songs.end())
+    {
+        // Song of a singer other than the one shown, e.g. started straight from the rotation
+        auto query = DbAccess::prepared("SELECT singer FROM queuesongs WHERE qsongid = :id");
+        query->bindValue(":id", songId);
+        query->exec();
+        if (query->first())
+            emit queueModified(query->value(0).toInt());
         return;
+    }
     it->played = played;
     emit dataChanged(this->index(it->position, 0), this->index(it->position, columnCount() - 1),
                          QVector<int>{Qt::FontRole, Qt::BackgroundRole, Qt::ForegroundRole});
@@ -318,36 +336,70 @@ void TableModelQueueSongs::setPlayed(const int songId, const bool played) {
 void TableModelQueueSongs::removeAll()
 {
     emit layoutAboutToBeChanged();
-    QSqlQuery query;
-    query.prepare("DELETE FROM queuesongs WHERE singer = :singerId");
-    query.bindValue(":singerId", m_curSingerId);
-    query.exec();
+    m_commitTimer.stop();
+    dbWriter.enqueue("DELETE FROM queuesongs WHERE singer = ?", {m_curSingerId});
     m_songs.clear();
     m_songs.shrink_to_fit();
+    m_storedPositions.clear();
     emit layoutChanged();
     emit queueModified(m_curSingerId);
 }
 
+void TableModelQueueSongs::commitPendingChanges()
+{
+    if (m_commitTimer.isActive())
+        commitChanges();
+}
+
+void TableModelQueueSongs::scheduleCommit()
+{
+    m_commitTimer.start();
+}
+
 void TableModelQueueSongs::commitChanges()
 {
-    QSqlQuery query;
-    query.exec("BEGIN TRANSACTION");
-    query.prepare("DELETE FROM queuesongs WHERE singer = :singerId");
-    query.bindValue(":singerId", m_curSingerId);
-    query.exec();
-    query.prepare("INSERT INTO queuesongs (qsongid,singer,song,artist,title,discid,path,keychg,played,position) "
-                  "VALUES(:id,:singerId,:songId,:songId,:songId,:songId,:songId,:key,:played,:position)");
-    std::for_each(m_songs.begin(), m_songs.end(), [&] (QueueSong &song)
+    m_commitTimer.stop();
+    // Keys and played flags are written as they change, only positions and removed
+    // songs have to be brought in line with what was stored last time
+    std::unordered_map<int, int> positions;
+    QStringList positionCases;
+    QStringList movedIds;
+    std::vector<QueueSong> unstored;
+    std::for_each(m_songs.begin(), m_songs.end(), [&] (QueueSong &song) {
+        positions[song.id] = song.position;
+        auto stored = m_storedPositions.find(song.id);
+        if (stored == m_storedPositions.end())
+            unstored.push_back(song);
+        else if (stored->second != song.position)
+        {
+            positionCases << QString("WHEN %1 THEN %2").arg(song.id).arg(song.position);
+            movedIds << QString::number(song.id);
+        }
+    });
+    QStringList removedIds;
+    std::for_each(m_storedPositions.begin(), m_storedPositions.end(), [&] (const auto &stored) {
+        if (positions.find(stored.first) == positions.end())
+            removedIds << QString::number(stored.first);
+    });
+    m_storedPositions = positions;
+    if (movedIds.isEmpty() && removedIds.isEmpty() && unstored.empty())
+        return;
+
+    std::vector<DbWriter::Statement> statements;
+    if (!removedIds.isEmpty())
+        statements.push_back({"DELETE FROM queuesongs WHERE qsongid IN (" + removedIds.join(",") + ")", {}});
+    if (!movedIds.isEmpty())
+        statements.push_back({"UPDATE queuesongs SET position = CASE qsongid " + positionCases.join(" ") + " END "
+                              "WHERE qsongid IN (" + movedIds.join(",") + ")", {}});
+    std::for_each(unstored.begin(), unstored.end(), [&] (QueueSong &song)
     {
-        query.bindValue(":id", song.id);
-        query.bindValue(":singerId", song.singerId);
-        query.bindValue(":songId", song.dbSongId);
-        query.bindValue(":key", song.keyChange);
-        query.bindValue(":played", song.played);
-        query.bindValue(":position", song.position);
-        query.exec();
+        statements.push_back({"INSERT INTO queuesongs (qsongid,singer,song,artist,title,discid,path,keychg,played,position) "
+                              "VALUES(?,?,?,?,?,?,?,?,?,?)",
+                              {song.id, song.singerId, song.dbSongId, song.dbSongId, song.dbSongId, song.dbSongId,
+                               song.dbSongId, song.keyChange, song.played, song.position}});
     });
-    query.exec("COMMIT");
+    dbWriter.enqueue(std::move(statements));
+    qDebug() << "Queue committed - moved:" << movedIds.size() << "removed:" << removedIds.size() << "inserted:" << unstored.size();
 }
 
 void TableModelQueueSongs::songAddSlot(int songId, int singerId, int keyChg)
@@ -362,21 +414,16 @@ void TableModelQueueSongs::songAddSlot(int songId, int singerId, int keyChg)
     {
         int newPos{0};
         KaraokeSong ksong = m_karaokeSongsModel.getSong(songId);
-        QSqlQuery query;
-        query.prepare("SELECT COUNT(qsongid) FROM queuesongs WHERE singer = :singerId");
-        query.bindValue(":singerId", singerId);
-        query.exec();
-        if (query.first())
-            newPos = query.value(0).toInt();
-        query.prepare("INSERT INTO queuesongs (singer,song,artist,title,discid,path,keychg,played,position) "
-                      "VALUES (:singerId,:songId,:songId,:songId,:songId,:songId,:key,:played,:position)");
-        query.bindValue(":singerId", singerId);
-        query.bindValue(":songId", songId);
-        query.bindValue(":key", keyChg);
-        query.bindValue(":played", false);
-        query.bindValue(":position", newPos);
-        query.exec();
-        qInfo() << query.lastError();
+        dbWriter.waitForWrites();
+        auto query = DbAccess::prepared("SELECT COUNT(qsongid) FROM queuesongs WHERE singer = :singerId");
+        query->bindValue(":singerId", singerId);
+        query->exec();
+        if (query->first())
+            newPos = query->value(0).toInt();
+        dbWriter.enqueue("INSERT INTO queuesongs (singer,song,artist,title,discid,path,keychg,played,position) "
+                         "VALUES (?,?,?,?,?,?,?,?,?)",
+                         {singerId, songId, songId, songId, songId, songId, keyChg, false, newPos});
+        emit queueModified(singerId);
     }
 }
 
@@ -471,7 +518,7 @@ bool TableModelQueueSongs::dropMimeData(const QMimeData *data, Qt::DropAction ac
             // moving up
             emit qSongsMoved(droprow, 0, droprow + ids.size() - 1, columnCount() - 1);
         }
-        commitChanges();
+        scheduleCommit();
         return true;
     }
     if (data->hasFormat("integer/songid"))
@@ -487,7 +534,7 @@ bool TableModelQueueSongs::dropMimeData(const QMimeData *data, Qt::DropAction ac
         QByteArray bytedata = data->data("integer/songid");
         songid = QString(bytedata.data()).toInt();
         insert(songid, droprow);
-        commitChanges();
+        scheduleCommit();
         return true;
     }
     else if (data->hasFormat("text/uri-list"))
@@ -505,7 +552,7 @@ bool TableModelQueueSongs::dropMimeData(const QMimeData *data, Qt::DropAction ac
                 droprow = rowCount();
             emit filesDroppedOnSinger(items, m_curSingerId, droprow);
         }
-        commitChanges();
+        scheduleCommit();
         return true;
     }
     return false;
@@ -571,7 +618,8 @@ void TableModelQueueSongs::sort(int column, Qt::SortOrder order)
         song.position = pos++;
     });
     emit layoutChanged();
-    commitChanges();
+    scheduleCommit();
+    emit queueModified(m_curSingerId);
 }
 
 void ItemDelegateQueueSongs::resizeIconsForFont(const QFont &font)
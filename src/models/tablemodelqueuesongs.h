@@ -5,7 +5,9 @@
 #include <QItemDelegate>
 #include <QModelIndex>
 #include <QPainter>
+#include <QTimer>
 #include <QUrl>
+#include <unordered_map>
 #include "tablemodelkaraokesongs.h"
 
 struct QueueSong {
@@ -43,6 +45,7 @@ class TableModelQueueSongs : public QAbstractTableModel
 public:
     enum {COL_ID=0,COL_DBSONGID,COL_ARTIST,COL_TITLE,COL_SONGID,COL_KEY,COL_DURATION,COL_PATH};
     explicit TableModelQueueSongs(TableModelKaraokeSongs &karaokeSongsModel, QObject *parent = nullptr);
+    ~TableModelQueueSongs() override;
     QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
@@ -57,6 +60,7 @@ public:
 
     void loadSinger(const int singerId);
     int getSingerId() const { return m_curSingerId; }
+    const std::vector<QueueSong> &songs() const { return m_songs; }
     int getPosition(const int songId);
     bool getPlayed(const int songId);
     int getKey(const int songId);
@@ -69,11 +73,16 @@ public:
     void setPlayed(const int qSongId, const bool played = true);
     void removeAll();
     void commitChanges();
+    void commitPendingChanges();
 
 private:
     int m_curSingerId{0};
     TableModelKaraokeSongs &m_karaokeSongsModel;
     std::vector<QueueSong> m_songs;
+    QTimer m_commitTimer;
+    // Positions as last written to the database, so commits only touch what moved
+    std::unordered_map<int, int> m_storedPositions;
+    void scheduleCommit();
 
 signals:
     void queueModified(int singerId);
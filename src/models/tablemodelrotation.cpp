@@ -9,13 +9,27 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include "settings.h"
+#include "dbaccess.h"
+#include "dbwriter.h"
 
 extern Settings settings;
+extern DbWriter dbWriter;
 
 TableModelRotation::TableModelRotation(QObject *parent)
     : QAbstractTableModel(parent)
 {
     resizeIconsForFont(settings.applicationFont());
+    // Rotation changes often come in bursts (drag and drop, fair adds), so the table is
+    // rewritten once the event loop gets back to it instead of after every single step
+    m_commitTimer.setSingleShot(true);
+    m_commitTimer.setInterval(0);
+    connect(&m_commitTimer, &QTimer::timeout, this, &TableModelRotation::commitChanges);
+    connect(&settings, &Settings::rotationDurationSettingsModified, this, &TableModelRotation::rebuildWaitTimes);
+}
+
+TableModelRotation::~TableModelRotation()
+{
+    commitPendingChanges();
 }
 
 QVariant TableModelRotation::headerData(int section, Qt::Orientation orientation, int role) const
@@ -68,8 +82,8 @@ QVariant TableModelRotation::data(const QModelIndex &index, int role) const
         if (m_currentSingerId != -1)
             curSingerPos = getSingerPosition(m_currentSingerId);
         auto hoverSingerPos{index.sibling(index.row(), COL_POSITION).data().toInt()};
-        int totalWaitDuration = 0;
         int singerId = index.data(Qt::UserRole).toInt();
+        int totalWaitDuration = estimatedWaitSecs(singerId);
         int qSongsSung = numSongsSung(singerId);
         int qSongsUnsung = numSongsUnsung(singerId);
         if (m_currentSingerId == singerId)
@@ -79,43 +93,10 @@ QVariant TableModelRotation::data(const QModelIndex &index, int role) const
         else if (curSingerPos < hoverSingerPos)
         {
             toolTipText = "Wait: " + QString::number(hoverSingerPos - curSingerPos) + " - Sung: " + QString::number(qSongsSung) + " - Unsung: " + QString::number(qSongsUnsung);
-            for (int i=curSingerPos; i < hoverSingerPos; i++)
-            {
-                int sId = singerIdAtPosition(i);
-                if (i == curSingerPos)
-                {
-                    totalWaitDuration += m_remainSecs;
-                }
-                else if (sId != singerId)
-                {
-                    int nextDuration = nextSongDurationSecs(sId);
-                    totalWaitDuration += nextDuration;
-                }
-            }
         }
         else if (curSingerPos > hoverSingerPos)
         {
             toolTipText = "Wait: " + QString::number(hoverSingerPos + (rowCount() - curSingerPos)) + " - Sung: " + QString::number(qSongsSung) + " - Unsung: " + QString::number(qSongsUnsung);
-            for (int i=0; i < hoverSingerPos; i++)
-            {
-                int sId = singerIdAtPosition(i);
-                if (sId != singerId)
-                {
-                    int nextDuration = nextSongDurationSecs(sId);
-                    totalWaitDuration += nextDuration;
-                }
-            }
-            for (int i=curSingerPos; i < rowCount(); i++)
-            {
-                int sId = singerIdAtPosition(i);
-                if (i == curSingerPos)
-                    totalWaitDuration += 240;
-                else if (sId != singerId)
-                {
-                    int nextDuration = nextSongDurationSecs(sId);
-                    totalWaitDuration += nextDuration;
-                }
-            }
         }
         toolTipText += "\nTime Added: " + m_singers.at(index.row()).addTs.toString("h:mm a");
 
@@ -209,8 +190,12 @@ QVariant TableModelRotation::data(const QModelIndex &index, int role) const
 
 void TableModelRotation::loadData()
 {
+    // A reorder still waiting on the commit timer has to reach the database before it's read back
+    commitPendingChanges();
     emit layoutAboutToBeChanged();
     m_singers.clear();
+    m_storedPositions.clear();
+    dbWriter.waitForWrites();
     QSqlQuery query;
     query.exec("SELECT singerid,name,position,regular,addts FROM rotationsingers ORDER BY position");
     qInfo() << "TableModelRotation - SQL error on load: " << query.lastError();
@@ -223,33 +208,214 @@ void TableModelRotation::loadData()
                                    query.value(3).toBool(),
                                    query.value(4).toDateTime()
                                });
+        m_storedPositions[m_singers.back().id] = m_singers.back().position;
     }
+    m_queueStates.clear();
+    // Same join as refreshSingerQueue() and the queue view, queue entries whose song is gone don't count
+    query.exec("SELECT queuesongs.singer, queuesongs.qsongid, queuesongs.played, queuesongs.keychg, "
+               "dbsongs.songid, dbsongs.artist, dbsongs.title, dbsongs.discid, dbsongs.path, dbsongs.duration "
+               "FROM queuesongs INNER JOIN dbsongs ON dbsongs.songid = queuesongs.song "
+               "ORDER BY queuesongs.singer, queuesongs.position");
+    while (query.next())
+    {
+        auto &state = m_queueStates[query.value(0).toInt()];
+        if (query.value(2).toBool())
+        {
+            state.sung++;
+            continue;
+        }
+        state.unsung++;
+        if (state.nextQueueSongId != -1)
+            continue;
+        state.nextQueueSongId = query.value(1).toInt();
+        state.nextKeyChg = query.value(3).toInt();
+        state.nextArtist = query.value(5).toString();
+        state.nextTitle = query.value(6).toString();
+        state.nextSongId = query.value(7).toString();
+        state.nextPath = query.value(8).toString();
+        state.nextDurationMs = query.value(9).toInt();
+    }
+    rebuildWaitTimes();
     emit layoutChanged();
     qInfo() << "Loaded " << m_singers.size() << " rotation singers";
 }
 
+void TableModelRotation::setSingerQueue(const int singerId, const std::vector<QueueSong> &songs)
+{
+    SingerQueueState state;
+    int nextPosition{-1};
+    std::for_each(songs.begin(), songs.end(), [&] (const QueueSong &song) {
+        if (song.played)
+        {
+            state.sung++;
+            return;
+        }
+        state.unsung++;
+        if (nextPosition != -1 && song.position > nextPosition)
+            return;
+        nextPosition = song.position;
+        state.nextQueueSongId = song.id;
+        state.nextArtist = song.artist;
+        state.nextTitle = song.title;
+        state.nextSongId = song.songId;
+        state.nextPath = song.path;
+        state.nextKeyChg = song.keyChange;
+        state.nextDurationMs = song.duration;
+    });
+    auto oldSecs = nextSongDurationSecs(singerId);
+    m_queueStates[singerId] = state;
+    auto delta = nextSongDurationSecs(singerId) - oldSecs;
+    auto pos = m_waitPositions.find(singerId);
+    if (delta != 0 && pos != m_waitPositions.end())
+    {
+        // Only the singers behind this one wait longer or shorter
+        std::for_each(m_waitPrefixSecs.begin() + pos->second + 1, m_waitPrefixSecs.end(), [delta] (int &secs) {
+            secs += delta;
+        });
+    }
+    singerQueueChanged(singerId);
+}
+
+void TableModelRotation::rebuildWaitTimes()
+{
+    m_waitPrefixSecs.assign(m_singers.size() + 1, 0);
+    m_waitPositions.clear();
+    for (size_t i = 0; i < m_singers.size(); i++)
+    {
+        m_waitPositions[m_singers[i].id] = i;
+        m_waitPrefixSecs[i + 1] = m_waitPrefixSecs[i] + nextSongDurationSecs(m_singers[i].id);
+    }
+}
+
+int TableModelRotation::estimatedWaitSecs(const int singerId) const
+{
+    auto pos = m_waitPositions.find(singerId);
+    if (pos == m_waitPositions.end() || singerId == m_currentSingerId)
+        return 0;
+    auto cur = m_waitPositions.find(m_currentSingerId);
+    if (cur == m_waitPositions.end())
+    {
+        // Without a current singer the top of the rotation stands in for the one on stage, like the tooltip always did
+        if (pos->second == 0)
+            return 0;
+        return m_remainSecs - m_waitPrefixSecs[1] + m_waitPrefixSecs[pos->second];
+    }
+    // The rest of the current song, then everyone between the current singer and this one
+    int secs = m_remainSecs - m_waitPrefixSecs[cur->second + 1] + m_waitPrefixSecs[pos->second];
+    if (pos->second < cur->second)
+        secs += m_waitPrefixSecs.back();
+    return secs;
+}
+
+void TableModelRotation::refreshSingerQueue(const int singerId)
+{
+    // Read the queue back once whatever changed it has made it to the database
+    dbWriter.afterWrites(this, [this, singerId] () {
+        auto query = DbAccess::prepared("SELECT queuesongs.qsongid, queuesongs.song, queuesongs.played, queuesongs.keychg, queuesongs.position, "
+                                        "dbsongs.artist, dbsongs.title, dbsongs.discid, dbsongs.duration, dbsongs.path "
+                                        "FROM queuesongs INNER JOIN dbsongs ON dbsongs.songid = queuesongs.song "
+                                        "WHERE queuesongs.singer = :singerid ORDER BY queuesongs.position");
+        query->bindValue(":singerid", singerId);
+        query->exec();
+        std::vector<QueueSong> songs;
+        while (query->next())
+        {
+            songs.emplace_back(QueueSong{
+                                   query->value(0).toInt(),
+                                   singerId,
+                                   query->value(1).toInt(),
+                                   query->value(2).toBool(),
+                                   query->value(3).toInt(),
+                                   query->value(4).toInt(),
+                                   query->value(5).toString(),
+                                   query->value(6).toString(),
+                                   query->value(7).toString(),
+                                   query->value(8).toInt(),
+                                   query->value(9).toString()
+                               });
+        }
+        setSingerQueue(singerId, songs);
+    });
+}
+
+void TableModelRotation::singerQueueChanged(const int singerId)
+{
+    auto row = getSingerPosition(singerId);
+    if (row < 0 || row >= rowCount())
+        return;
+    emit dataChanged(index(row, 0), index(row, columnCount() - 1), QVector<int>{Qt::DisplayRole, Qt::DecorationRole, Qt::ToolTipRole});
+}
+
+const SingerQueueState &TableModelRotation::queueState(const int singerId) const
+{
+    static const SingerQueueState emptyQueue;
+    auto it = m_queueStates.find(singerId);
+    if (it == m_queueStates.end())
+        return emptyQueue;
+    return it->second;
+}
+
+void TableModelRotation::scheduleCommit()
+{
+    m_commitTimer.start();
+}
+
+void TableModelRotation::commitPendingChanges()
+{
+    if (m_commitTimer.isActive())
+        commitChanges();
+}
+
 void TableModelRotation::commitChanges()
 {
-    QSqlQuery query;
-    query.exec("BEGIN TRANSACTION");
-    query.exec("DELETE FROM rotationsingers");
-    query.prepare("INSERT INTO rotationsingers (singerid,name,position,regular,regularid,addts) VALUES(:singerid,:name,:pos,:regular,:regularid,:addts)");
+    m_commitTimer.stop();
+    // Names and regular flags are written as they change, so only positions and
+    // removed singers need to be brought in line with what was stored last time
+    std::unordered_map<int, int> positions;
+    QStringList positionCases;
+    QStringList movedIds;
+    std::vector<RotationSinger> unstored;
     std::for_each(m_singers.begin(), m_singers.end(), [&] (RotationSinger &singer) {
-        query.bindValue(":singerid", singer.id);
-        query.bindValue(":name", singer.name);
-        query.bindValue(":pos", singer.position);
-        query.bindValue(":regular", singer.regular);
-        query.bindValue(":regularid", -1);
-        query.bindValue(":addts", singer.addTs);
-        query.exec();
+        positions[singer.id] = singer.position;
+        auto stored = m_storedPositions.find(singer.id);
+        if (stored == m_storedPositions.end())
+            unstored.push_back(singer);
+        else if (stored->second != singer.position)
+        {
+            positionCases << QString("WHEN %1 THEN %2").arg(singer.id).arg(singer.position);
+            movedIds << QString::number(singer.id);
+        }
+    });
+    QStringList removedIds;
+    std::for_each(m_storedPositions.begin(), m_storedPositions.end(), [&] (const auto &stored) {
+        if (positions.find(stored.first) == positions.end())
+            removedIds << QString::number(stored.first);
     });
-    query.exec("COMMIT");
+    m_storedPositions = positions;
+    if (movedIds.isEmpty() && removedIds.isEmpty() && unstored.empty())
+        return;
+
+    std::vector<DbWriter::Statement> statements;
+    if (!removedIds.isEmpty())
+        statements.push_back({"DELETE FROM rotationsingers WHERE singerid IN (" + removedIds.join(",") + ")", {}});
+    if (!movedIds.isEmpty())
+        statements.push_back({"UPDATE rotationsingers SET position = CASE singerid " + positionCases.join(" ") + " END "
+                              "WHERE singerid IN (" + movedIds.join(",") + ")", {}});
+    std::for_each(unstored.begin(), unstored.end(), [&] (RotationSinger &singer) {
+        statements.push_back({"INSERT INTO rotationsingers (singerid,name,position,regular,regularid,addts) VALUES(?,?,?,?,?,?)",
+                              {singer.id, singer.name, singer.position, singer.regular, -1, singer.addTs}});
+    });
+    dbWriter.enqueue(std::move(statements));
+    qDebug() << "Rotation committed - moved:" << movedIds.size() << "removed:" << removedIds.size() << "inserted:" << unstored.size();
 }
 
 int TableModelRotation::singerAdd(const QString &name, const int positionHint)
 {
     auto curTs = QDateTime::currentDateTime();
     int addPos = m_singers.size();
+    // The new id comes from the database, so anything queued before has to be in there first
+    commitPendingChanges();
+    dbWriter.waitForWrites();
     QSqlQuery query;
     query.prepare("INSERT INTO rotationsingers (name,position,regular,regularid,addts) VALUES(:name,:pos,:regular,:regularid,:addts)");
     query.bindValue(":name", name);
@@ -273,6 +439,8 @@ int TableModelRotation::singerAdd(const QString &name, const int positionHint)
                                false,
                                curTs
                            });
+    m_storedPositions[singerId] = addPos;
+    rebuildWaitTimes();
     emit layoutChanged();
 
     int curSingerPos = getSingerPosition(m_currentSingerId);
@@ -324,7 +492,8 @@ void TableModelRotation::singerMove(const int oldPosition, const int newPosition
         return (a.position < b.position);
     });
     if (!skipCommit)
-        commitChanges();
+        scheduleCommit();
+    rebuildWaitTimes();
     emit layoutChanged();
     emit rotationModified();
     outputRotationDebug();
@@ -342,11 +511,7 @@ void TableModelRotation::singerSetName(const int singerId, const QString &newNam
     }
     it->name = newName;
     emit dataChanged(this->index(it->position, COL_NAME), this->index(it->position, COL_NAME),QVector<int>{Qt::DisplayRole});
-    QSqlQuery query;
-    query.prepare("UPDATE rotationsingers SET name = :name WHERE singerid = :singerid");
-    query.bindValue(":name", newName);
-    query.bindValue(":singerid", singerId);
-    query.exec();
+    dbWriter.enqueue("UPDATE rotationsingers SET name = ? WHERE singerid = ?", {newName, singerId});
     emit rotationModified();
     outputRotationDebug();
 }
@@ -358,13 +523,15 @@ void TableModelRotation::singerDelete(const int singerId)
        return (singer.id == singerId);
     });
     m_singers.erase(it, m_singers.end());
+    m_queueStates.erase(singerId);
     int pos{0};
     std::for_each(m_singers.begin(), m_singers.end(), [&pos] (RotationSinger &singer) {
        singer.position = pos++;
     });
+    rebuildWaitTimes();
     emit layoutChanged();
     emit rotationModified();
-    commitChanges();
+    scheduleCommit();
     outputRotationDebug();
 }
 
@@ -393,11 +560,7 @@ void TableModelRotation::singerSetRegular(const int singerId, const bool isRegul
     });
     it->regular = isRegular;
     emit dataChanged(this->index(it->position, COL_REGULAR), this->index(it->position, COL_REGULAR),QVector<int>{Qt::DisplayRole});
-    QSqlQuery query;
-    query.prepare("UPDATE rotationsingers SET regular = :regular WHERE singerid = :singerid");
-    query.bindValue(":regular", isRegular);
-    query.bindValue(":singerid", singerId);
-    query.exec();
+    dbWriter.enqueue("UPDATE rotationsingers SET regular = ? WHERE singerid = ?", {isRegular, singerId});
 }
 
 void TableModelRotation::singerMakeRegular(const int singerId)
@@ -483,67 +646,37 @@ QStringList TableModelRotation::historySingers() const
 
 QString TableModelRotation::nextSongPath(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT dbsongs.path FROM dbsongs,queuesongs WHERE queuesongs.singer = :singerid AND queuesongs.played = 0 AND dbsongs.songid = queuesongs.song ORDER BY position LIMIT 1");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toString();
-    return QString();
+    return queueState(singerId).nextPath;
 }
 
 QString TableModelRotation::nextSongArtist(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT dbsongs.artist FROM dbsongs,queuesongs WHERE queuesongs.singer = :singerid AND queuesongs.played = 0 AND dbsongs.songid = queuesongs.song ORDER BY position LIMIT 1");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toString();
-    return QString();
+    return queueState(singerId).nextArtist;
 }
 
 QString TableModelRotation::nextSongTitle(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT dbsongs.title FROM dbsongs,queuesongs WHERE queuesongs.singer = :singerid AND queuesongs.played = 0 AND dbsongs.songid = queuesongs.song ORDER BY position LIMIT 1");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toString();
-    return QString();
+    return queueState(singerId).nextTitle;
 }
 
 QString TableModelRotation::nextSongArtistTitle(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT dbsongs.artist, dbsongs.title FROM dbsongs,queuesongs WHERE queuesongs.singer = :singerid AND queuesongs.played = 0 AND dbsongs.songid = queuesongs.song ORDER BY position LIMIT 1");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toString() + " - " + query.value(1).toString();
+    auto &state = queueState(singerId);
+    if (state.nextQueueSongId != -1)
+        return state.nextArtist + " - " + state.nextTitle;
     return " - empty - ";
 }
 
 QString TableModelRotation::nextSongSongId(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT dbsongs.discid FROM dbsongs,queuesongs WHERE queuesongs.singer = :singerid AND queuesongs.played = 0 AND dbsongs.songid = queuesongs.song ORDER BY position LIMIT 1");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toString();
-    return QString();
+    return queueState(singerId).nextSongId;
 }
 
 int TableModelRotation::nextSongDurationSecs(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT dbsongs.duration FROM dbsongs,queuesongs WHERE queuesongs.singer = :singerid AND queuesongs.played = 0 AND dbsongs.songid = queuesongs.song ORDER BY position LIMIT 1");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return (query.value(0).toInt() / 1000) + settings.estimationSingerPad();
+    auto &state = queueState(singerId);
+    if (state.nextQueueSongId != -1)
+        return (state.nextDurationMs / 1000) + settings.estimationSingerPad();
     else if (!settings.estimationSkipEmptySingers())
         return settings.estimationEmptySongLength() + settings.estimationSingerPad();
     return 0;
@@ -551,42 +684,28 @@ int TableModelRotation::nextSongDurationSecs(const int singerId) const
 
 int TableModelRotation::rotationDuration()
 {
-    int secs = 0;
-    std::for_each(m_singers.begin(), m_singers.end(), [&] (RotationSinger &singer) {
-        secs += nextSongDurationSecs(singer.id);
-    });
-    return secs;
+    return m_waitPrefixSecs.back();
 }
 
 int TableModelRotation::nextSongKeyChg(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT keychg FROM queuesongs WHERE singer = :singerid AND played = 0 ORDER BY position LIMIT 1");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toInt();
-    return 0;
+    return queueState(singerId).nextKeyChg;
 }
 
 int TableModelRotation::nextSongQueueId(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT qsongid FROM queuesongs WHERE singer = :singerid AND played = 0 ORDER BY position LIMIT 1");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toInt();
-    return -1;
+    return queueState(singerId).nextQueueSongId;
 }
 
 void TableModelRotation::clearRotation()
 {
     emit layoutAboutToBeChanged();
-    QSqlQuery query;
-    query.exec("DELETE from queuesongs");
-    query.exec("DELETE FROM rotationsingers");
+    m_commitTimer.stop();
+    dbWriter.enqueue(std::vector<DbWriter::Statement>{{"DELETE FROM queuesongs", {}}, {"DELETE FROM rotationsingers", {}}});
     m_singers.clear();
+    m_storedPositions.clear();
+    m_queueStates.clear();
+    rebuildWaitTimes();
     settings.setCurrentRotationPosition(-1);
     m_currentSingerId = -1;
     emit layoutChanged();
@@ -614,35 +733,18 @@ bool TableModelRotation::rotationIsValid()
 
 int TableModelRotation::numSongs(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT COUNT(qsongid) FROM queuesongs WHERE singer = :singerid");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toInt();
-    return -1;
+    auto &state = queueState(singerId);
+    return state.sung + state.unsung;
 }
 
 int TableModelRotation::numSongsSung(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT COUNT(qsongid) FROM queuesongs WHERE singer = :singerid AND played = true");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toInt();
-    return -1;
+    return queueState(singerId).sung;
 }
 
 int TableModelRotation::numSongsUnsung(const int singerId) const
 {
-    QSqlQuery query;
-    query.prepare("SELECT COUNT(qsongid) FROM queuesongs WHERE singer = :singerid AND played = false");
-    query.bindValue(":singerid", singerId);
-    query.exec();
-    if (query.first())
-        return query.value(0).toInt();
-    return -1;
+    return queueState(singerId).unsung;
 }
 
 QDateTime TableModelRotation::timeAdded(const int singerId)
@@ -682,8 +784,9 @@ void TableModelRotation::fixSingerPositions()
     std::for_each(m_singers.begin(), m_singers.end(), [&pos] (RotationSinger &singer) {
        singer.position = pos++;
     });
+    rebuildWaitTimes();
     emit layoutChanged();
-    commitChanges();
+    scheduleCommit();
 }
 
 void TableModelRotation::resizeIconsForFont(const QFont &font)
@@ -839,7 +942,7 @@ bool TableModelRotation::dropMimeData(const QMimeData *data, Qt::DropAction acti
         std::for_each(ids.begin(), ids.end(), [&] (auto val) {
             singerMove(getSingerPosition(val.toInt()), droprow, false);
         });
-        commitChanges();
+        scheduleCommit();
         qInfo() << "droprow: " << droprow;
         emit rotationModified();
         if (droprow == rowCount() - 1)
@@ -7,6 +7,9 @@
 #include <QImage>
 #include <QItemDelegate>
 #include <QPainter>
+#include <QTimer>
+#include <unordered_map>
+#include "tablemodelqueuesongs.h"
 
 struct RotationSinger {
     int id{0};
@@ -16,6 +19,20 @@ struct RotationSinger {
     QDateTime addTs;
 };
 
+// What the rotation needs to know about a singer's queue, kept in memory so
+// drawing and tooltips never have to hit the database
+struct SingerQueueState {
+    int nextQueueSongId{-1};
+    QString nextArtist;
+    QString nextTitle;
+    QString nextSongId;
+    QString nextPath;
+    int nextKeyChg{0};
+    int nextDurationMs{0};
+    int sung{0};
+    int unsung{0};
+};
+
 class ItemDelegateRotation : public QItemDelegate
 {
     Q_OBJECT
@@ -42,6 +59,7 @@ public:
     enum {COL_ID=0,COL_NAME,COL_POSITION,COL_NEXT_SONG,COL_REGULAR,COL_ADDTS,COL_DELETE};
     enum {ADD_FAIR=0,ADD_BOTTOM,ADD_NEXT};
     explicit TableModelRotation(QObject *parent = nullptr);
+    ~TableModelRotation() override;
     QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     int columnCount(const QModelIndex &parent = QModelIndex()) const override;
@@ -49,6 +67,9 @@ public:
     void loadData();
 
     void commitChanges();
+    void commitPendingChanges();
+    void setSingerQueue(const int singerId, const std::vector<QueueSong> &songs);
+    void refreshSingerQueue(const int singerId);
     int singerAdd(const QString& name, const int positionHint = ADD_BOTTOM);
     void singerMove(const int oldPosition, const int newPosition, const bool skipCommit = false);
     void singerSetName(const int singerId, const QString &newName);
@@ -72,6 +93,7 @@ public:
     QString nextSongSongId(const int singerId) const;
     int nextSongDurationSecs(const int singerId) const;
     int rotationDuration();
+    int estimatedWaitSecs(const int singerId) const;
     int nextSongKeyChg(const int singerId) const;
     int nextSongQueueId(const int singerId) const;
     void clearRotation();
@@ -94,6 +116,17 @@ private:
     QImage m_iconYellowCircle;
     int m_curFontHeight;
     int m_remainSecs{0};
+    std::unordered_map<int, SingerQueueState> m_queueStates;
+    // m_waitPrefixSecs[i] is the estimated time taken by the singers at positions 0 to i-1
+    std::vector<int> m_waitPrefixSecs{0};
+    std::unordered_map<int, int> m_waitPositions;
+    QTimer m_commitTimer;
+    // Positions as last written to the database, so commits only touch what moved
+    std::unordered_map<int, int> m_storedPositions;
+    const SingerQueueState &queueState(const int singerId) const;
+    void scheduleCommit();
+    void singerQueueChanged(const int singerId);
+    void rebuildWaitTimes();
 
 signals:
     void songDroppedOnSinger(int singerId, int songId, int dropRow);
@@ -22,7 +22,7 @@
 #include "mzarchive.h"
 #include <QDebug>
 #include <QFile>
-#include <QBuffer>
+#include <QDir>
 #include <QTemporaryDir>
 #include "src/miniz/miniz.h"
 #ifdef Q_OS_WIN
@@ -31,6 +31,114 @@
 #include <unistd.h>
 #endif
 
+namespace {
+
+size_t readZipData(void *opaque, mz_uint64 offset, void *buf, size_t n)
+{
+    auto *file = static_cast<QFile *>(opaque);
+    if (!file->seek(qint64(offset)))
+        return 0;
+    const qint64 bytesRead = file->read(static_cast<char *>(buf), qint64(n));
+    return bytesRead < 0 ? 0 : size_t(bytesRead);
+}
+
+size_t writeFileData(void *opaque, mz_uint64 offset, const void *buf, size_t n)
+{
+    auto *file = static_cast<QFile *>(opaque);
+    if (file->pos() != qint64(offset) && !file->seek(qint64(offset)))
+        return 0;
+    const qint64 bytesWritten = file->write(static_cast<const char *>(buf), qint64(n));
+    return bytesWritten < 0 ? 0 : size_t(bytesWritten);
+}
+
+// Opens the archive through positional reads on zipFile.  miniz only reads the
+// end of central directory record and the central directory itself here, member
+// data is read later on demand.
+bool openZip(QFile &zipFile, mz_zip_archive &archive)
+{
+    memset(&archive, 0, sizeof(archive));
+    if (!zipFile.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+    {
+        qWarning() << "Error opening zip file: " << zipFile.fileName();
+        return false;
+    }
+    archive.m_pRead = readZipData;
+    archive.m_pIO_opaque = &zipFile;
+    if (!mz_zip_reader_init(&archive, mz_uint64(zipFile.size()), MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY))
+    {
+        QString err(mz_zip_get_error_string(mz_zip_get_last_error(&archive)));
+        qWarning() << "unzip error: " << err;
+        return false;
+    }
+    return true;
+}
+
+// One member of an archive, inflated a chunk at a time as it is read
+class MzMemberReader : public QIODevice
+{
+public:
+    explicit MzMemberReader(const QString &archiveFile) : m_zipFile(archiveFile) {}
+    ~MzMemberReader() override { close(); }
+
+    bool openMember(int fileIndex, qint64 size)
+    {
+        if (!openZip(m_zipFile, m_archive))
+        {
+            m_zipFile.close();
+            return false;
+        }
+        m_zipOpen = true;
+        m_iter = mz_zip_reader_extract_iter_new(&m_archive, mz_uint(fileIndex), 0);
+        if (!m_iter)
+        {
+            QString err(mz_zip_get_error_string(mz_zip_get_last_error(&m_archive)));
+            qWarning() << "unzip error: " << err;
+            close();
+            return false;
+        }
+        m_size = size;
+        return QIODevice::open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    }
+
+    bool isSequential() const override { return true; }
+    qint64 size() const override { return m_size; }
+
+    void close() override
+    {
+        QIODevice::close();
+        if (m_iter)
+            mz_zip_reader_extract_iter_free(m_iter);
+        m_iter = nullptr;
+        if (m_zipOpen)
+            mz_zip_reader_end(&m_archive);
+        m_zipOpen = false;
+        m_zipFile.close();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        const size_t bytesRead = mz_zip_reader_extract_iter_read(m_iter, data, size_t(maxSize));
+        if (m_iter->status < TINFL_STATUS_DONE)
+        {
+            QString err(mz_zip_get_error_string(mz_zip_get_last_error(&m_archive)));
+            qWarning() << "unzip error: " << err;
+            return -1;
+        }
+        return qint64(bytesRead);
+    }
+    qint64 writeData([[maybe_unused]]const char *data, [[maybe_unused]]qint64 maxSize) override { return -1; }
+
+private:
+    QFile m_zipFile;
+    mz_zip_archive m_archive;
+    bool m_zipOpen{false};
+    mz_zip_reader_extract_iter_state *m_iter{nullptr};
+    qint64 m_size{0};
+};
+
+}
+
 MzArchive::MzArchive(QString ArchiveFile, QObject *parent) : QObject(parent)
 {
     archiveFile = ArchiveFile;
@@ -62,38 +170,38 @@ unsigned int MzArchive::getSongDuration()
 
 QByteArray MzArchive::getCDGData()
 {
-    QByteArray data;
-    if (findCDG())
-    {
-        mz_zip_archive archive;
-        memset(&archive, 0, sizeof(archive));
-        if (!mz_zip_reader_init_file(&archive, archiveFile.toLocal8Bit(), 0))
-        {
-             QString err(mz_zip_get_error_string(mz_zip_get_last_error(&archive)));
-             qWarning() << "unzip error: " << err;
-             return data;
-        }
+    if (!findCDG())
+        return QByteArray();
+    if (!m_cdgSupportedCompression)
+        return oka.getCDGData();
+    return extractEntryToMemory(m_cdgFileIndex, m_cdgSize);
+}
 
+QByteArray MzArchive::getAudioData()
+{
+    if (!findAudio())
+        return QByteArray();
+    if (!m_audioSupportedCompression)
+    {
+        qWarning() << archiveFile << " - Archive using non-standard compression method, falling back to infozip based zip handling";
         QTemporaryDir dir;
-        QString cdgTmpFile = dir.path() + QDir::separator() + "tmp.cdg";
-        qWarning() << "Extracting CDG file to tmp path: " << cdgTmpFile;
-        if (mz_zip_reader_extract_file_to_file(&archive, cdgFileName.toLocal8Bit(), cdgTmpFile.toLocal8Bit(),0))
-        {
-            QFile cdg(cdgTmpFile);
-            cdg.open(QFile::ReadOnly);
-            data = cdg.readAll();
-            mz_zip_reader_end(&archive);
-            return data;
-        }
-        else
-        {
-            QString err(mz_zip_get_error_string(mz_zip_get_last_error(&archive)));
-            qWarning() << "unzip error: " << err;
-        }
-        mz_zip_reader_end(&archive);
-        return data;
+        if (!oka.extractAudio(dir.path(), "tmp" + audioExt))
+            return QByteArray();
+        QFile audioFile(dir.path() + QDir::separator() + "tmp" + audioExt);
+        audioFile.open(QFile::ReadOnly);
+        return audioFile.readAll();
     }
-    return data;
+    return extractEntryToMemory(m_audioFileIndex, m_audioSize);
+}
+
+std::unique_ptr<QIODevice> MzArchive::openAudioStream()
+{
+    if (!findAudio() || !m_audioSupportedCompression)
+        return nullptr;
+    auto reader = std::make_unique<MzMemberReader>(archiveFile);
+    if (!reader->openMember(m_audioFileIndex, m_audioSize))
+        return nullptr;
+    return reader;
 }
 
 QString MzArchive::getArchiveFile() const
@@ -111,6 +219,8 @@ void MzArchive::setArchiveFile(const QString &value)
     m_cdgSize = 0;
     m_audioSize = 0;
     lastError = "";
+    m_entriesScanned = false;
+    m_entriesValid = false;
     m_audioSupportedCompression = false;
     m_cdgSupportedCompression = false;
 }
@@ -147,27 +257,9 @@ bool MzArchive::extractAudio(QString destPath, QString destFile)
             qWarning() << archiveFile << " - Archive using non-standard compression method, falling back to infozip based zip handling";
             return oka.extractAudio(destPath, destFile);
         }
-        mz_zip_archive archive;
-        memset(&archive, 0, sizeof(archive));
-        //mz_zip_reader_init_file(&archive, archiveFile.toLocal8Bit(), 0);
-        QFile zipFile(archiveFile);
-        zipFile.open(QIODevice::ReadOnly);
-        QByteArray zipData = zipFile.readAll();
-        zipFile.close();
-        mz_zip_reader_init_mem(&archive, zipData.data(), zipData.size(), 0);
-        if (mz_zip_reader_extract_to_file(&archive, m_audioFileIndex, QString(destPath + QDir::separator() + destFile).toLocal8Bit(),0))
-        {
-            mz_zip_reader_end(&archive);
+        if (extractEntry(m_audioFileIndex, destPath + QDir::separator() + destFile))
             return true;
-        }
-        else
-        {
-            qCritical() << "Failed to extract mp3 file";
-            QString err(mz_zip_get_error_string(mz_zip_get_last_error(&archive)));
-            qWarning() << "unzip error: " << err;
-            mz_zip_reader_end(&archive);
-            return false;
-        }
+        qCritical() << "Failed to extract mp3 file";
     }
     return false;
 }
@@ -181,30 +273,58 @@ bool MzArchive::extractCdg(QString destPath, QString destFile)
             qWarning() << archiveFile << " - Archive using non-standard compression method, falling back to infozip based zip handling";
             return oka.extractCdg(destPath, destFile);
         }
-        mz_zip_archive archive;
-        memset(&archive, 0, sizeof(archive));
-        QFile zipFile(archiveFile);
-        zipFile.open(QIODevice::ReadOnly);
-        QByteArray zipData = zipFile.readAll();
-        zipFile.close();
-        mz_zip_reader_init_mem(&archive, zipData.data(), zipData.size(), 0);
-        if (mz_zip_reader_extract_to_file(&archive, m_cdgFileIndex, QString(destPath + QDir::separator() + destFile).toLocal8Bit(),0))
-        {
-            mz_zip_reader_end(&archive);
+        if (extractEntry(m_cdgFileIndex, destPath + QDir::separator() + destFile))
             return true;
-        }
-        else
-        {
-            qCritical() << "Failed to extract cdg file";
-            QString err(mz_zip_get_error_string(mz_zip_get_last_error(&archive)));
-            qWarning() << "unzip error: " << err;
-            mz_zip_reader_end(&archive);
-            return false;
-        }
+        qCritical() << "Failed to extract cdg file";
     }
     return false;
 }
 
+bool MzArchive::extractEntry(int fileIndex, const QString &destFilePath)
+{
+    QFile zipFile(archiveFile);
+    mz_zip_archive archive;
+    if (!openZip(zipFile, archive))
+        return false;
+    QFile destFile(destFilePath);
+    if (!destFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "Unable to open " << destFilePath << " for writing";
+        mz_zip_reader_end(&archive);
+        return false;
+    }
+    // Inflates straight from the archive file into the destination file in small chunks
+    bool success = mz_zip_reader_extract_to_callback(&archive, fileIndex, writeFileData, &destFile, 0);
+    if (!success)
+    {
+        QString err(mz_zip_get_error_string(mz_zip_get_last_error(&archive)));
+        qWarning() << "unzip error: " << err;
+    }
+    mz_zip_reader_end(&archive);
+    destFile.close();
+    if (!success)
+        destFile.remove();
+    return success;
+}
+
+QByteArray MzArchive::extractEntryToMemory(int fileIndex, int size)
+{
+    QByteArray data;
+    QFile zipFile(archiveFile);
+    mz_zip_archive archive;
+    if (!openZip(zipFile, archive))
+        return data;
+    data.resize(size);
+    if (!mz_zip_reader_extract_to_mem(&archive, fileIndex, data.data(), size_t(data.size()), 0))
+    {
+        QString err(mz_zip_get_error_string(mz_zip_get_last_error(&archive)));
+        qWarning() << "unzip error: " << err;
+        data.clear();
+    }
+    mz_zip_reader_end(&archive);
+    return data;
+}
+
 bool MzArchive::isValidKaraokeFile()
 {
     if (!findEntries())
@@ -260,25 +380,15 @@ bool MzArchive::findAudio()
 
 bool MzArchive::findEntries()
 {
-    if (m_audioFound && m_cdgFound && m_audioSupportedCompression && m_cdgSupportedCompression)
-        return true;
-    mz_zip_archive archive;
-    memset(&archive, 0, sizeof(archive));
-    mz_zip_archive_file_stat fStat;
-
+    if (m_entriesScanned)
+        return m_entriesValid;
+    m_entriesScanned = true;
+    m_entriesValid = false;
     QFile zipFile(archiveFile);
-    if (!zipFile.open(QIODevice::ReadOnly))
-    {
-        qWarning() << "Error opening zip file";
-        return false;
-    }
-    QByteArray zipData = zipFile.readAll();
-    zipFile.close();
-    if (!mz_zip_reader_init_mem(&archive, zipData.data(), zipData.size(), 0))
-    {
-        qWarning() << "Error opening zip file";
+    mz_zip_archive archive;
+    if (!openZip(zipFile, archive))
         return false;
-    }
+    mz_zip_archive_file_stat fStat;
     unsigned int files = mz_zip_reader_get_num_files(&archive);
     for (unsigned int i=0; i < files; i++)
     {
@@ -308,17 +418,17 @@ bool MzArchive::findEntries()
                     }
                 }
             }
-            if (m_audioFound && m_cdgFound && m_cdgSupportedCompression && m_audioSupportedCompression)
-            {
-                mz_zip_reader_end(&archive);
-                return true;
-            }
-            else if (m_audioFound && m_cdgFound && (!m_cdgSupportedCompression || !m_audioSupportedCompression))
-                return oka.isValidKaraokeFile();
+            if (m_audioFound && m_cdgFound)
+                break;
         }
     }
     mz_zip_reader_end(&archive);
-    return false;
+    if (m_audioFound && m_cdgFound)
+    {
+        if (m_cdgSupportedCompression && m_audioSupportedCompression)
+            m_entriesValid = true;
+        else
+            m_entriesValid = oka.isValidKaraokeFile();
+    }
+    return m_entriesValid;
 }
-
-
@@ -22,8 +22,10 @@
 #ifndef MZARCHIVE_H
 #define MZARCHIVE_H
 
+#include <QIODevice>
 #include <QObject>
 #include <QStringList>
+#include <memory>
 #include <okarchive.h>
 //#include <quazip.h>
 
@@ -36,6 +38,11 @@ public:
     explicit MzArchive(QObject *parent = 0);
     unsigned int getSongDuration();
     QByteArray getCDGData();
+    QByteArray getAudioData();
+    // The audio member as an open device that inflates it while it's being read,
+    // size() is its uncompressed size.  Null if the archive's compression method
+    // isn't supported by miniz, getAudioData() falls back to infozip for those.
+    std::unique_ptr<QIODevice> openAudioStream();
     QString getArchiveFile() const;
     void setArchiveFile(const QString &value);
     bool checkCDG();
@@ -64,7 +71,13 @@ private:
     bool m_cdgSupportedCompression{false};
     bool m_cdgFound{false};
     bool m_audioFound{false};
+    // Entry table of the current archive file, read from its central directory
+    // once and reused until setArchiveFile() is called again
+    bool m_entriesScanned{false};
+    bool m_entriesValid{false};
     bool findEntries();
+    bool extractEntry(int fileIndex, const QString &destFilePath);
+    QByteArray extractEntryToMemory(int fileIndex, int size);
     QStringList audioExtensions;
     OkArchive oka;
 
@@ -12,6 +12,7 @@
 #include <QPushButton>
 #include "settings.h"
 #include "idledetect.h"
+#include "dbaccess.h"
 
 extern Settings settings;
 extern IdleDetect *filter;
@@ -167,7 +168,13 @@ void OKJSongbookAPI::updateSongDb()
     emit remoteSongDbUpdateStart();
     int songsPerDoc = 1000;
     QList<QJsonDocument> jsonDocs;
-    QSqlQuery query;
+    // Read on a connection of its own.  The query stays open across processEvents() and would
+    // otherwise hold the gui's connection on the snapshot it started from for the whole upload.
+    auto db = QSqlDatabase::contains("songbooksync") ? QSqlDatabase::database("songbooksync", false)
+                                                     : DbAccess::readOnlyClone("songbooksync");
+    if (!db.isOpen())
+        DbAccess::open(db);
+    QSqlQuery query(db);
     int numEntries = 0;
     if (cancelUpdate)
         return;
@@ -644,6 +644,10 @@ bool Settings::cdgPrescalingEnabled() {
     return settings->value("cdgPrescaling", false).toBool();
 }
 
+bool Settings::videoScaleInSoftwareSink() {
+    return settings->value("videoScaleInSoftwareSink", false).toBool();
+}
+
 bool Settings::rotationAltSortOrder() {
     return settings->value("rotationAltSortOrder", true).toBool();
 }
@@ -665,6 +669,10 @@ void Settings::setCdgPrescalingEnabled(bool enabled) {
     settings->setValue("cdgPrescaling", enabled);
 }
 
+void Settings::setVideoScaleInSoftwareSink(bool enabled) {
+    settings->setValue("videoScaleInSoftwareSink", enabled);
+}
+
 void Settings::setSlideShowInterval(int secs) {
     if (secs <= 5) {
         settings->setValue("slideShowInterval", 5);
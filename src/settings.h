@@ -297,6 +297,7 @@ public:
     void saveShortcutKeySequence(const QString &name, const QKeySequence &sequence);
     QKeySequence loadShortcutKeySequence(const QString &name);
     bool cdgPrescalingEnabled();
+    bool videoScaleInSoftwareSink();
     bool rotationAltSortOrder();
     bool treatAllSingersAsRegs();
 
@@ -358,6 +359,7 @@ public slots:
     void setTreatAllSingersAsRegs(const bool enabled);
     void setRotationAltSortOrder(bool enabled);
     void setCdgPrescalingEnabled(bool enabled);
+    void setVideoScaleInSoftwareSink(bool enabled);
     void setSlideShowInterval(int secs);
     void setHardwareAccelEnabled(const bool enabled);
     void setDbDoubleClickAddsSong(const bool enabled);
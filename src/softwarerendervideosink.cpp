@@ -3,6 +3,32 @@
 #include <QObject>
 #include <QPainter>
 #include <QResizeEvent>
+#include <QPaintEvent>
+#include <gst/video/gstvideometa.h>
+#include "cdg/cdgappsrc.h"
+#include <cstring>
+
+namespace {
+
+template<typename Pixel>
+void scaleLine(const uchar *src, uchar *dst, const int *columnMap, const int width)
+{
+    auto srcPixels = reinterpret_cast<const Pixel*>(src);
+    auto dstPixels = reinterpret_cast<Pixel*>(dst);
+    for (int x = 0; x < width; x++)
+        dstPixels[x] = srcPixels[columnMap[x]];
+}
+
+// Nearest source pixel for each of the dstSize target pixels, sampling at pixel centers
+// so integer factors map exactly to repeated source pixels
+void buildScaleMap(std::vector<int> &map, const int srcSize, const int dstSize)
+{
+    map.resize(dstSize);
+    for (int i = 0; i < dstSize; i++)
+        map[i] = int((qint64(2 * i + 1) * srcSize) / (2 * qint64(dstSize)));
+}
+
+}
 
 SoftwareRenderVideoSink::SoftwareRenderVideoSink(QWidget *surface)
 {
@@ -37,12 +63,14 @@ SoftwareRenderVideoSink::SoftwareRenderVideoSink(QWidget *surface)
 
     m_surface->installEventFilter(this);
 
-    connect(this, SIGNAL(newFrameAvailable()), m_surface, SLOT(update()), Qt::QueuedConnection);
+    connect(this, &SoftwareRenderVideoSink::newFrameAvailable, this, &SoftwareRenderVideoSink::requestRepaint, Qt::QueuedConnection);
 }
 
 SoftwareRenderVideoSink::~SoftwareRenderVideoSink()
 {
     m_surface->removeEventFilter(this);
+    for (auto &frame : m_frames)
+        releaseFrame(frame);
     g_object_unref(m_appSink);
     gst_caps_unref(m_videoCaps);
     m_appSink = nullptr;
@@ -52,10 +80,9 @@ bool SoftwareRenderVideoSink::eventFilter(QObject *obj, QEvent *event)
 {
     if (event->type() == QEvent::Paint)
     {
-        m_pendingRepaint = false;
         if (m_active)
         {
-            return pullSampleAndDrawImage();
+            return drawLatestFrame(static_cast<QPaintEvent *>(event)->rect());
         }
         else
         {
@@ -74,91 +101,348 @@ bool SoftwareRenderVideoSink::eventFilter(QObject *obj, QEvent *event)
     }
 }
 
+void SoftwareRenderVideoSink::setScalingMode(ScalingMode mode)
+{
+    m_scalingMode = mode;
+    m_scaledValid = false;
+    if (mode == ScalingMode::Upstream)
+    {
+        onSurfaceResized(m_surface->size());
+        return;
+    }
+    // Accept frames of any size, nothing upstream has to scale them
+    m_videoCaps = gst_caps_make_writable(m_videoCaps);
+    for (guint i = 0; i < gst_caps_get_size(m_videoCaps); i++)
+    {
+        gst_structure_remove_fields(gst_caps_get_structure(m_videoCaps, i), "width", "height", nullptr);
+    }
+    gst_app_sink_set_caps(m_appSink, m_videoCaps);
+    gst_element_send_event(GST_ELEMENT(m_appSink), gst_event_new_reconfigure());
+}
+
+void SoftwareRenderVideoSink::setKeepAspectRatio(bool keep)
+{
+    if (keep == m_keepAspectRatio)
+        return;
+    m_keepAspectRatio = keep;
+    m_scaledValid = false;
+    m_surface->update();
+}
+
 void SoftwareRenderVideoSink::onSurfaceResized(const QSize &size)
 {
+    if (m_scalingMode == ScalingMode::InSink)
+    {
+        // The scaled image and maps are rebuilt for the new size on the next paint
+        m_scaledValid = false;
+        return;
+    }
     // Tell what image dimension we can handle and let
     // the Videoscale element earlier in the pipeline do the actual scaline.
+    m_videoCaps = gst_caps_make_writable(m_videoCaps);
     gst_caps_set_simple(m_videoCaps, "width", G_TYPE_INT, size.width(), "height", G_TYPE_INT, size.height(), nullptr);
     gst_app_sink_set_caps(m_appSink, m_videoCaps);
     gst_element_send_event(GST_ELEMENT(m_appSink), gst_event_new_reconfigure());
 }
 
-GstFlowReturn SoftwareRenderVideoSink::NewSampleCallback([[maybe_unused]]GstAppSink *appsink, gpointer user_data)
+GstFlowReturn SoftwareRenderVideoSink::NewSampleCallback(GstAppSink *appsink, gpointer user_data)
 {
     SoftwareRenderVideoSink *me = (SoftwareRenderVideoSink*) user_data;
+    GstSample* sample = gst_app_sink_try_pull_sample(appsink, 0);
+    if (!sample)
+        return GST_FLOW_OK;
     me->m_active = true;
-    if (!me->m_pendingRepaint)
+
+    me->publishFrame(sample);
+
+    if (!me->m_pendingRepaint.exchange(true))
     {
-        me->m_pendingRepaint = true;
         emit me->newFrameAvailable();
     }
 
     return GST_FLOW_OK;
 }
 
-void SoftwareRenderVideoSink::cleanupFunction(void* _info)
+void SoftwareRenderVideoSink::publishFrame(GstSample *sample)
+{
+    // Streaming thread only
+    Frame &frame = m_frames[m_writeFrame];
+    releaseFrame(frame);
+
+    auto s = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+    int width = 0;
+    int height = 0;
+    gst_structure_get_int(s, "width", &width);
+    gst_structure_get_int(s, "height", &height);
+    auto format = gst_structure_get_string(s, "format");
+    auto qtFormat = strcmp(format, "RGB16") == 0 ? QImage::Format_RGB16 : QImage::Format_RGB32;
+
+    auto buffer = gst_sample_get_buffer(sample);
+    frame.sample = sample;
+    gst_buffer_map(buffer, &frame.map, GST_MAP_READ);
+    frame.image = QImage(frame.map.data, width, height, qtFormat);
+    frame.pts = GST_BUFFER_PTS(buffer);
+    frame.duration = GST_BUFFER_DURATION(buffer);
+    frame.dirty = QRect();
+    frame.fullRepaint = !frameDirtyRect(sample, frame.image.size(), frame.dirty);
+
+    // If the gui hasn't taken the previous frame yet it gets this one instead, so this
+    // one has to carry its changes too. Should the gui take it in the meantime the
+    // union just repaints a little more than needed.
+    if (m_middleFrame.load(std::memory_order_acquire) & FRESH_FRAME)
+    {
+        frame.fullRepaint |= m_publishedFullRepaint;
+        frame.dirty |= m_publishedDirty;
+    }
+    m_publishedDirty = frame.dirty;
+    m_publishedFullRepaint = frame.fullRepaint;
+
+    frame.publishedUs = g_get_monotonic_time();
+    int previous = m_middleFrame.exchange(m_writeFrame | FRESH_FRAME, std::memory_order_acq_rel);
+    if (previous & FRESH_FRAME)
+        m_framesDropped++;
+    m_writeFrame = previous & ~FRESH_FRAME;
+}
+
+bool SoftwareRenderVideoSink::takeLatestFrame()
+{
+    // Gui thread only
+    if (!(m_middleFrame.load(std::memory_order_acquire) & FRESH_FRAME))
+        return false;
+    if (m_readFrameUnpainted)
+        m_framesDropped++;
+
+    // The frame handed back may be released by the streaming thread at any time, so
+    // nothing may look at m_buffer's pixels until it points to the new frame
+    m_readFrame = m_middleFrame.exchange(m_readFrame, std::memory_order_acq_rel) & ~FRESH_FRAME;
+    const Frame &frame = m_frames[m_readFrame];
+    if (frame.fullRepaint || frame.image.size() != m_buffer.size())
+        m_unpaintedFullRepaint = true;
+    else
+        m_unpaintedDirty |= frame.dirty;
+    m_buffer = frame.image;
+    m_readFrameUnpainted = true;
+    return true;
+}
+
+QRect SoftwareRenderVideoSink::takeUnpaintedSurfaceRect()
+{
+    QRect rect;
+    if (m_unpaintedFullRepaint)
+        rect = m_surface->rect();
+    else if (!m_unpaintedDirty.isEmpty())
+        rect = frameToSurfaceRect(m_unpaintedDirty, m_buffer.size());
+    m_unpaintedDirty = QRect();
+    m_unpaintedFullRepaint = false;
+    return rect;
+}
+
+void SoftwareRenderVideoSink::releaseFrame(Frame &frame)
 {
-    SampleInfo *info = static_cast<SampleInfo*>(_info);
+    if (!frame.sample)
+        return;
+    frame.image = QImage();
+    gst_buffer_unmap(gst_sample_get_buffer(frame.sample), &frame.map);
+    gst_sample_unref(frame.sample);
+    frame.sample = nullptr;
+}
 
-    gst_buffer_unmap(info->buffer, info->bufferInfo);
-    gst_sample_unref(info->sample);
-    delete info->bufferInfo;
-    delete info;
+SoftwareRenderVideoSink::FrameCounters SoftwareRenderVideoSink::frameCounters() const
+{
+    return FrameCounters{m_framesPainted, m_framesDropped, m_framesLate};
 }
 
-bool SoftwareRenderVideoSink::pullSampleAndDrawImage()
+bool SoftwareRenderVideoSink::frameDirtyRect(GstSample *sample, const QSize &frameSize, QRect &dirty)
 {
-    // Pull sample and paint it. Must be called from gui thread!
-    GstSample* sample = gst_app_sink_try_pull_sample(m_appSink, 0);
+    // Changed areas are only meaningful relative to the frame received right before this one
+    auto buffer = gst_sample_get_buffer(sample);
+    auto offset = GST_BUFFER_OFFSET(buffer);
+    bool consecutive = offset != GST_BUFFER_OFFSET_NONE && m_lastFrameOffset != GST_BUFFER_OFFSET_NONE &&
+            offset == m_lastFrameOffset + 1 && frameSize == m_lastFrameSize;
+    m_lastFrameOffset = offset;
+    m_lastFrameSize = frameSize;
+    if (!consecutive)
+        return false;
 
-    if (sample)
+    // Scaling elements upstream transform the region along with the frame
+    bool found = false;
+    gpointer state = nullptr;
+    const auto dirtyQuark = g_quark_from_static_string(CDG_DIRTY_ROI_TYPE);
+    while (auto meta = gst_buffer_iterate_meta_filtered(buffer, &state, GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))
     {
-        SampleInfo *info = new SampleInfo();
-        info->sample = sample;
-        info->bufferInfo = new GstMapInfo;
-        GstCaps *caps;
-        GstStructure *s;
-        const gchar *format;
-        int width, height;
-
-        caps = gst_sample_get_caps(sample);
-        s = gst_caps_get_structure(caps, 0);
-        gst_structure_get_int(s, "width", &width);
-        gst_structure_get_int(s, "height", &height);
-        format = gst_structure_get_string(s, "format");
-
-        info->buffer = gst_sample_get_buffer (sample);
-
-        gst_buffer_map(info->buffer, info->bufferInfo, GST_MAP_READ);
-        guint8 *rawFrame = info->bufferInfo->data;
-
-        QImage::Format qtFormat;
-
-        if (strcmp(format, "RGB16") == 0)
-            qtFormat = QImage::Format_RGB16;
-        else if (strcmp(format, "BGRx") == 0)
-            qtFormat = QImage::Format_RGB32;
-
-        QImage frame(rawFrame, width, height, qtFormat, cleanupFunction, info);
-        m_buffer = frame;
+        auto roi = reinterpret_cast<GstVideoRegionOfInterestMeta *>(meta);
+        if (roi->roi_type != dirtyQuark)
+            continue;
+        dirty |= QRect(roi->x, roi->y, roi->w, roi->h);
+        found = true;
     }
+    return found && QRect(QPoint(0, 0), frameSize).contains(dirty);
+}
+
+QRect SoftwareRenderVideoSink::targetRect(const QSize &frameSize) const
+{
+    auto target = m_surface->contentsRect();
+    if (m_scalingMode != ScalingMode::InSink || !m_keepAspectRatio || frameSize.isEmpty())
+        return target;
+    auto size = frameSize.scaled(target.size(), Qt::KeepAspectRatio);
+    return QRect(target.x() + (target.width() - size.width()) / 2, target.y() + (target.height() - size.height()) / 2, size.width(), size.height());
+}
+
+QRect SoftwareRenderVideoSink::frameToSurfaceRect(const QRect &frameRect, const QSize &frameSize) const
+{
+    auto target = targetRect(frameSize);
+    if (frameSize.isEmpty())
+        return target;
+    qreal sx = qreal(target.width()) / frameSize.width();
+    qreal sy = qreal(target.height()) / frameSize.height();
+    QRectF mapped(target.x() + frameRect.x() * sx, target.y() + frameRect.y() * sy, frameRect.width() * sx, frameRect.height() * sy);
+    // grow by a pixel to cover smoothing and rounding at the edges
+    return mapped.toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+void SoftwareRenderVideoSink::requestRepaint()
+{
+    // Cleared first so a frame published from here on asks for another repaint
+    m_pendingRepaint = false;
+    if (!takeLatestFrame())
+        return;
+    // Only the changed area needs painting, the paint handler takes the changes over
+    if (m_unpaintedFullRepaint)
+        m_surface->update();
+    else if (!m_unpaintedDirty.isEmpty())
+        m_surface->update(frameToSurfaceRect(m_unpaintedDirty, m_buffer.size()));
     else
+        m_readFrameUnpainted = false; // looks the same as what is shown, nothing to paint or drop
+}
+
+void SoftwareRenderVideoSink::updateScaledFrame(const QRect &dirtySurfaceRect, GstClockTime pts)
+{
+    const auto target = targetRect(m_buffer.size());
+    if (!m_scaledValid || m_scaled.size() != target.size() || m_scaled.format() != m_buffer.format() || m_scaledFrameSize != m_buffer.size())
     {
-        // No sample found in queue - are we still playing?
+        m_scaled = QImage(target.size(), m_buffer.format());
+        m_scaledFrameSize = m_buffer.size();
+        buildScaleMap(m_columnMap, m_buffer.width(), target.width());
+        buildScaleMap(m_rowMap, m_buffer.height(), target.height());
+        scaleRect(m_scaled.rect());
+        m_scaledValid = true;
+        m_scaledPts = pts;
+        return;
+    }
+    // The same frame again, e.g. a still cdg frame re-sent after a seek
+    if (pts != GST_CLOCK_TIME_NONE && pts == m_scaledPts)
+        return;
+    m_scaledPts = pts;
+    scaleRect(dirtySurfaceRect.translated(-target.topLeft()) & m_scaled.rect());
+}
+
+void SoftwareRenderVideoSink::scaleRect(const QRect &rect)
+{
+    if (rect.isEmpty())
+        return;
+    const int bytesPerPixel = m_scaled.depth() / 8;
+    const size_t lineBytes = size_t(rect.width()) * bytesPerPixel;
+    const int *columns = m_columnMap.data() + rect.left();
+    for (int y = rect.top(); y <= rect.bottom(); y++)
+    {
+        uchar *dst = m_scaled.scanLine(y) + rect.left() * bytesPerPixel;
+        // Upscaled lines sampling the same source line are plain copies of the one above
+        if (y > rect.top() && m_rowMap[y] == m_rowMap[y - 1])
+        {
+            memcpy(dst, m_scaled.constScanLine(y - 1) + rect.left() * bytesPerPixel, lineBytes);
+            continue;
+        }
+        const uchar *src = m_buffer.constScanLine(m_rowMap[y]);
+        if (bytesPerPixel == 4)
+            scaleLine<quint32>(src, dst, columns, rect.width());
+        else
+            scaleLine<quint16>(src, dst, columns, rect.width());
+    }
+}
+
+void SoftwareRenderVideoSink::recordFrameStats(qint64 paintNs)
+{
+    if (!m_statTimer.isValid())
+    {
+        m_statTimer.start();
+        m_statCpuStart = std::clock();
+    }
+    m_statPaintNs += paintNs;
+    m_statFrames++;
+    if (m_statTimer.elapsed() < 10000)
+        return;
+
+    // Process cpu time includes the upstream scaling on the streaming threads, which is
+    // what makes the two scaling modes comparable
+    double cpuMs = double(std::clock() - m_statCpuStart) * 1000.0 / CLOCKS_PER_SEC;
+    qInfo() << "Software video sink" << (m_scalingMode == ScalingMode::InSink ? "(in-sink scaling)" : "(upstream scaling)")
+            << m_surface->size() << "-" << m_statFrames << "frames, paint:" << m_statPaintNs / m_statFrames / 1000
+            << "us/frame, process cpu:" << cpuMs / m_statFrames << "ms/frame - total painted:" << m_framesPainted
+            << "dropped:" << m_framesDropped << "late:" << m_framesLate;
+    m_statTimer.restart();
+    m_statCpuStart = std::clock();
+    m_statPaintNs = 0;
+    m_statFrames = 0;
+}
+
+bool SoftwareRenderVideoSink::drawLatestFrame(const QRect &paintRect)
+{
+    // Paints the newest published frame, never waits for the streaming thread. Must be called from gui thread!
+    QElapsedTimer paintTimer;
+    paintTimer.start();
+    takeLatestFrame();
+
+    QRect dirtySurfaceRect = takeUnpaintedSurfaceRect();
+    // Frames taken after the repaint was requested may have changed more than this paint covers
+    if (!dirtySurfaceRect.isEmpty() && !paintRect.contains(dirtySurfaceRect))
+        m_surface->update(dirtySurfaceRect);
+
+    const bool newFrame = m_readFrameUnpainted;
+    if (!newFrame)
+    {
+        // No new frame - are we still playing? Only look at the current state, never wait for a change.
         GstState state = GST_STATE_NULL;
-        gst_element_get_state(reinterpret_cast<GstElement*>(m_appSink), &state, nullptr, GST_CLOCK_TIME_NONE);
+        gst_element_get_state(reinterpret_cast<GstElement*>(m_appSink), &state, nullptr, 0);
 
         if (state == GST_STATE_NULL)
         {
+            // The streaming thread is gone, all frames can be let go of from here
             m_active = false;
             m_buffer = QImage();
+            m_scaled = QImage();
+            m_scaledValid = false;
+            for (auto &frame : m_frames)
+                releaseFrame(frame);
+            m_middleFrame = m_middleFrame & ~FRESH_FRAME;
         }
     }
 
     if (!m_buffer.isNull())
     {
+        const Frame &frame = m_frames[m_readFrame];
         QPainter painter(m_surface);
-        painter.drawImage(m_surface->contentsRect(), m_buffer, m_buffer.rect());
+        if (m_scalingMode == ScalingMode::InSink)
+        {
+            updateScaledFrame(newFrame ? dirtySurfaceRect : QRect(), frame.pts);
+            auto target = targetRect(m_buffer.size());
+            if (!target.contains(paintRect))
+                painter.fillRect(paintRect, Qt::black);
+            auto area = paintRect & target;
+            painter.drawImage(area.topLeft(), m_scaled, area.translated(-target.topLeft()));
+        }
+        else
+        {
+            painter.drawImage(m_surface->contentsRect(), m_buffer, m_buffer.rect());
+        }
+        if (newFrame)
+        {
+            m_readFrameUnpainted = false;
+            m_framesPainted++;
+            const gint64 lateUs = GST_CLOCK_TIME_IS_VALID(frame.duration) ? gint64(frame.duration / GST_USECOND) : 40000;
+            if (g_get_monotonic_time() - frame.publishedUs > lateUs)
+                m_framesLate++;
+            recordFrameStats(paintTimer.nsecsElapsed());
+        }
         return true;
     }
 
@@ -4,20 +4,52 @@
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
 
+#include <QElapsedTimer>
 #include <QWidget>
+#include <array>
+#include <atomic>
+#include <ctime>
+#include <vector>
 
 
 class SoftwareRenderVideoSink : public QObject
 {
     Q_OBJECT
 
+public:
+    enum class ScalingMode
+    {
+        // Upstream videoscale delivers frames at the size of the surface
+        Upstream,
+        // Frames arrive at their native size and are scaled with nearest neighbour
+        // sampling while painting, keeping the scaled image between frames
+        InSink
+    };
+
+    struct FrameCounters
+    {
+        // Frames shown on the surface
+        quint64 painted {0};
+        // Frames replaced by a newer one before they could be painted
+        quint64 dropped {0};
+        // Frames painted more than a frame duration after they arrived
+        quint64 late {0};
+    };
+
 private:
 
-    struct SampleInfo
+    // A decoded frame, mapped on the streaming thread and wrapped in a QImage ready to paint
+    struct Frame
     {
-        GstSample *sample;
-        GstBuffer *buffer;
-        GstMapInfo *bufferInfo;
+        GstSample *sample {nullptr};
+        GstMapInfo map {};
+        QImage image;
+        // Area that changed since the previously published frame, unless fullRepaint is set
+        QRect dirty;
+        bool fullRepaint {true};
+        GstClockTime pts {GST_CLOCK_TIME_NONE};
+        GstClockTime duration {GST_CLOCK_TIME_NONE};
+        gint64 publishedUs {0};
     };
 
     std::atomic<bool> m_active {false};
@@ -25,15 +57,68 @@ private:
 
     QWidget *m_surface;
     QImage m_buffer;
+    ScalingMode m_scalingMode {ScalingMode::Upstream};
+    bool m_keepAspectRatio {false};
+
+    // InSink mode: m_buffer scaled to the surface, updated only where frames change
+    QImage m_scaled;
+    GstClockTime m_scaledPts {GST_CLOCK_TIME_NONE};
+    QSize m_scaledFrameSize;
+    bool m_scaledValid {false};
+    // Source column for every surface column and source row for every surface row
+    std::vector<int> m_columnMap;
+    std::vector<int> m_rowMap;
+
+    // Render cost statistics, logged periodically
+    QElapsedTimer m_statTimer;
+    std::clock_t m_statCpuStart {0};
+    qint64 m_statPaintNs {0};
+    int m_statFrames {0};
+
+    // Triple buffer handing frames from the streaming thread to the gui thread without
+    // either side waiting for the other. The streaming thread owns m_writeFrame and the
+    // gui thread m_readFrame, the third frame is handed over by atomically swapping
+    // indexes with m_middleFrame. FRESH_FRAME marks a middle frame the gui hasn't taken yet.
+    static constexpr int FRESH_FRAME = 4;
+    std::array<Frame, 3> m_frames;
+    std::atomic<int> m_middleFrame {1};
+    int m_writeFrame {0};
+    int m_readFrame {2};
+
+    // Only touched on the streaming thread
+    guint64 m_lastFrameOffset {GST_BUFFER_OFFSET_NONE};
+    QSize m_lastFrameSize;
+    // Changes of the last published frame, carried over if the gui hasn't taken it yet
+    QRect m_publishedDirty;
+    bool m_publishedFullRepaint {true};
+
+    // Only touched on the gui thread: changes of the frames taken since the last paint
+    QRect m_unpaintedDirty;
+    bool m_unpaintedFullRepaint {false};
+    bool m_readFrameUnpainted {false};
+
+    std::atomic<quint64> m_framesPainted {0};
+    std::atomic<quint64> m_framesDropped {0};
+    std::atomic<quint64> m_framesLate {0};
 
     void onSurfaceResized(const QSize &size);
+    bool frameDirtyRect(GstSample *sample, const QSize &frameSize, QRect &dirty);
+    QRect frameToSurfaceRect(const QRect &frameRect, const QSize &frameSize) const;
+    QRect targetRect(const QSize &frameSize) const;
+    void requestRepaint();
+    void publishFrame(GstSample *sample);
+    bool takeLatestFrame();
+    QRect takeUnpaintedSurfaceRect();
+    static void releaseFrame(Frame &frame);
 
     GstAppSink *m_appSink;
     GstCaps *m_videoCaps;
 
     static GstFlowReturn NewSampleCallback(GstAppSink *appsink, gpointer user_data);
-    bool pullSampleAndDrawImage();
-    static void cleanupFunction(void *info);
+    bool drawLatestFrame(const QRect &paintRect);
+    void updateScaledFrame(const QRect &dirtySurfaceRect, GstClockTime pts);
+    void scaleRect(const QRect &rect);
+    void recordFrameStats(qint64 paintNs);
 
 signals:
     void newFrameAvailable();
@@ -45,6 +130,10 @@ public:
     SoftwareRenderVideoSink(QWidget *surface);
     ~SoftwareRenderVideoSink();
     GstAppSink* getSink() { return m_appSink; }
+    void setScalingMode(ScalingMode mode);
+    // Letterboxes frames scaled in the sink, upstream scaling adds the borders itself
+    void setKeepAspectRatio(bool keep);
+    [[nodiscard]] FrameCounters frameCounters() const;
 
 
 };
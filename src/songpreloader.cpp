@@ -0,0 +1,102 @@
+#include "songpreloader.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QtConcurrent>
+#include "mzarchive.h"
+#include "okjutil.h"
+
+SongPreloader::SongPreloader(QObject *parent) : QObject(parent)
+{
+    connect(&m_watcher, &QFutureWatcher<PreloadedSong>::finished, this, &SongPreloader::loadFinished);
+}
+
+SongPreloader::~SongPreloader()
+{
+    m_watcher.waitForFinished();
+}
+
+bool SongPreloader::canPreload(const QString &path)
+{
+    return path.endsWith(".zip", Qt::CaseInsensitive) || path.endsWith(".cdg", Qt::CaseInsensitive);
+}
+
+void SongPreloader::preload(const QString &path)
+{
+    const QString requested = canPreload(path) ? path : QString();
+    if (requested == m_requestedPath)
+        return;
+    m_requestedPath = requested;
+    if (m_song.path != m_requestedPath)
+        m_song = PreloadedSong();
+    // A load that is already running can't be cancelled, loadFinished() picks up the new request
+    if (!m_requestedPath.isEmpty() && !m_watcher.isRunning())
+        startLoading(m_requestedPath);
+}
+
+bool SongPreloader::take(const QString &path, PreloadedSong &song)
+{
+    if (path.isEmpty() || path != m_requestedPath)
+        return false;
+    if (m_watcher.isRunning() && m_loadingPath == path)
+    {
+        // Already partway through, finishing it beats starting over
+        m_watcher.waitForFinished();
+        m_song = m_watcher.result();
+    }
+    if (m_song.path != path)
+        return false;
+    song = std::move(m_song);
+    m_song = PreloadedSong();
+    m_requestedPath.clear();
+    return true;
+}
+
+PreloadedSong SongPreloader::load(const QString &path)
+{
+    QElapsedTimer timer;
+    timer.start();
+    PreloadedSong song;
+    if (path.endsWith(".zip", Qt::CaseInsensitive))
+    {
+        MzArchive archive(path);
+        if (!archive.checkCDG() || !archive.checkAudio())
+            return song;
+        song.audioData = archive.getAudioData();
+        song.cdgData = archive.getCDGData();
+    }
+    else
+    {
+        QFile cdgFile(path);
+        QFile audioFile(findMatchingAudioFile(path));
+        if (!cdgFile.open(QIODevice::ReadOnly) || !audioFile.open(QIODevice::ReadOnly))
+            return song;
+        song.cdgData = cdgFile.readAll();
+        song.audioData = audioFile.readAll();
+    }
+    // Leaving the path empty on failure makes play() take the regular path and report the problem
+    if (!song.cdgData.isEmpty() && !song.audioData.isEmpty())
+        song.path = path;
+    qInfo() << "SongPreloader - loaded " << path << " in " << timer.elapsed() << "ms";
+    return song;
+}
+
+void SongPreloader::startLoading(const QString &path)
+{
+    m_loadingPath = path;
+    m_watcher.setFuture(QtConcurrent::run(&SongPreloader::load, path));
+}
+
+void SongPreloader::loadFinished()
+{
+    if (m_loadingPath == m_requestedPath)
+    {
+        // take() may have collected the result already
+        if (m_song.path.isEmpty() && !m_requestedPath.isEmpty())
+            m_song = m_watcher.result();
+        return;
+    }
+    if (!m_requestedPath.isEmpty())
+        startLoading(m_requestedPath);
+}
@@ -0,0 +1,41 @@
+#ifndef SONGPRELOADER_H
+#define SONGPRELOADER_H
+
+#include <QByteArray>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QString>
+
+// Decompressed cdg and audio data of a karaoke track, ready for MediaBackend::setMediaCdg()
+struct PreloadedSong {
+    QString path;
+    QByteArray cdgData;
+    QByteArray audioData;
+};
+
+// Loads the karaoke track that is expected to play next in the background, so
+// that starting it doesn't have to wait on storage and zip extraction.  Holds a
+// single song, requesting a different one drops the previous one.
+class SongPreloader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SongPreloader(QObject *parent = nullptr);
+    ~SongPreloader() override;
+    // Starts loading path unless it is already loaded or loading, an empty path drops the preloaded song
+    void preload(const QString &path);
+    // Hands out the preloaded song if it is for path, waiting for it if it is still loading
+    bool take(const QString &path, PreloadedSong &song);
+    [[nodiscard]] static bool canPreload(const QString &path);
+
+private:
+    static PreloadedSong load(const QString &path);
+    void startLoading(const QString &path);
+    void loadFinished();
+    QFutureWatcher<PreloadedSong> m_watcher;
+    QString m_requestedPath;
+    QString m_loadingPath;
+    PreloadedSong m_song;
+};
+
+#endif // SONGPRELOADER_H